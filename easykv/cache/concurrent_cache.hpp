@@ -224,6 +224,20 @@ public:
         return res;
     }
 
+    bool Erase(const typename PassBy<TKey>::type key) {
+        std::unique_lock<std::mutex> lock(list_mutex_);
+        TNode* node_ptr = nullptr;
+        map_.visit(key, [&](const auto& x) {
+            node_ptr = x.second;
+        });
+        if (node_ptr == nullptr) {
+            return false;
+        }
+        map_.erase(key);
+        list_.Erase(node_ptr);
+        return true;
+    }
+
     size_t TrueSize() const {
         return list_.size();
     }
@@ -366,6 +380,12 @@ public:
         return value_ptr;
     }
 
+    // a key put again while in main_lru_ is also in window_lru_, both copies go
+    bool Erase(const typename PassBy<TKey>::type key) {
+        bool erased = window_lru_->Erase(key);
+        return main_lru_->Erase(key) || erased;
+    }
+
 private:
     void refresh_loop() {
         while(true) {
@@ -184,6 +184,10 @@ public:
         node->nxt->pre = node->pre;
         return node;
     }
+    inline void Erase(Node<T>* node) {
+        delete Extract(node);
+        --size_;
+    }
     inline size_t size() const {
         return size_;
     }
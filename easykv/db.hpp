@@ -1,35 +1,102 @@
 #pragma once
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstring>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "easykv/lsm/blob_file.hpp"
+#include "easykv/lsm/block_cache.hpp"
+#include "easykv/lsm/iterator.hpp"
 #include "easykv/lsm/manifest.hpp"
 #include "easykv/lsm/memtable.hpp"
+#include "easykv/lsm/row_cache.hpp"
 #include "easykv/lsm/sst.hpp"
+#include "easykv/lsm/table_cache.hpp"
+#include "easykv/lsm/version_edit.hpp"
+#include "easykv/options.hpp"
 #include "easykv/pool/thread_pool.hpp"
+#include "easykv/utils/file.hpp"
 #include "easykv/utils/lock.hpp"
+#include "easykv/write_batch.hpp"
 
 namespace easykv {
 
 class DB {
 public:
-    DB() {
-        memtable_ = std::make_shared<lsm::MemeTable>();
+    // throws std::runtime_error when another DB, in this process or another, has db_path open
+    explicit DB(const DBOptions& options = DBOptions()): options_(options) {
+        if (!options_.db_path.empty() && !common::CreateDirs(options_.db_path)) {
+            std::cout << "create db path " << options_.db_path << " failed" << std::endl;
+        }
+        for (auto& path : options_.level_paths) {
+            if (!common::CreateDirs(path)) {
+                std::cout << "create level path " << path << " failed" << std::endl;
+            }
+        }
+        LockDB();
+        memtable_ = NewMemTable();
+        lsm::TableOptions table_options;
+        table_options.block_size = options_.block_size;
+        table_options.read_mode = options_.read_mode;
+        table_options.use_direct_writes = options_.use_direct_writes;
+        table_options.bytes_per_sync = options_.bytes_per_sync;
+        table_options.memory_budget = options_.memory_budget;
+        table_options.db_path = options_.db_path;
+        table_options.level_paths = options_.level_paths;
+        table_options.merge_operator = options_.merge_operator;
+        table_options.compaction_filter_factory = options_.compaction_filter_factory;
+        table_options.rate_limiter = options_.rate_limiter;
+        table_options.learned_index_max_error = options_.learned_index_max_error;
+        table_options.data_block_hash_ratio = options_.data_block_hash_ratio;
+        if (options_.block_cache_capacity > 0) {
+            table_options.block_cache = std::make_shared<lsm::BlockCache>(options_.block_cache_capacity, options_.memory_budget);
+        }
+        table_cache_ = std::make_shared<lsm::TableCache>(options_.max_open_files, table_options,
+            std::make_shared<lsm::FileDeleter>(options_.delete_rate_bytes_per_sec));
+        if (options_.row_cache_capacity > 0) {
+            row_cache_ = std::make_unique<lsm::RowCache>(options_.row_cache_capacity);
+        }
+        current_ = std::make_shared<lsm::Manifest>(table_cache_);
+        sst_id_ = current_->max_sst_id();
+        seq_ = current_->last_sequence();
+        manifest_log_ = std::make_unique<lsm::ManifestLog>(current_->log_name());
+        manifest_log_->Open();
+        RollManifest();
+        if (options_.freeze_immutable_memtables) {
+            freeze_pool_ = std::make_unique<cpputil::pool::ThreadPool>(1, "freeze");
+        }
         to_sst_thread_ = std::thread(&DB::ToSSTLoop, this);
-        manifest_queue_.emplace_back(std::make_shared<lsm::Manifest>());
-        sst_id_ = manifest_queue_.back()->max_sst_id();
+        if (options_.flush_cpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(options_.flush_cpu, &cpus);
+            auto err = pthread_setaffinity_np(to_sst_thread_.native_handle(), sizeof(cpus), &cpus);
+            if (err != 0) {
+                std::cout << "pin flush thread to cpu " << options_.flush_cpu << " failed: " << strerror(err) << std::endl;
+            }
+        }
     }
 
     ~DB() {
         {
             easykv::common::RWLock::WriteLock w_lock(memtable_lock_);
             if (memtable_->size() > 0) {
-                inmemtables_.emplace_back(memtable_);
+                FreezeMemTable();
             }
         }
         {
@@ -41,43 +108,734 @@ public:
             to_sst_thread_.join();
         }
         {
-            easykv::common::RWLock::WriteLock w_lock(manifest_lock_);
-            manifest_queue_.back()->Save();
+            std::unique_lock<std::mutex> lock(version_mutex_);
+            RollManifest();
+        }
+        if (options_.memory_budget) {
+            options_.memory_budget->Release(lsm::MemoryConsumer::kMemTable, memtable_charge_);
+        }
+        if (lock_fd_ != -1) {
+            close(lock_fd_);
         }
     }
 
     bool Get(std::string_view key, std::string& value) {
+        lsm::PinnableValue pinned;
+        if (!Get(key, pinned)) {
+            return false;
+        }
+        value.assign(pinned.view());
+        return true;
+    }
+
+    // value stays pinned in the data block, blob or cached row it was found in until it is reset
+    bool Get(std::string_view key, lsm::PinnableValue& value) {
+        if (!row_cache_) {
+            return GetFromLSM(key, value);
+        }
+        if (row_cache_->Get(key, value)) {
+            return true;
+        }
+        auto epoch = row_cache_->epoch(key);
+        uint64_t expire_at = 0;
+        if (!GetFromLSM(key, value, &expire_at)) {
+            return false;
+        }
+        row_cache_->Fill(key, value.view(), epoch, expire_at);
+        return true;
+    }
+
+    void Put(std::string_view key, std::string_view value) {
+        Write(key, value, lsm::kTypeValue);
+    }
+
+    // key reads as deleted once ttl has passed, compaction drops the value from then on
+    void Put(std::string_view key, std::string_view value, std::chrono::milliseconds ttl) {
+        std::string entry(value);
+        lsm::AppendExpiry(entry, lsm::NowMicros() + std::chrono::duration_cast<std::chrono::microseconds>(ttl).count());
+        Write(key, entry, lsm::kTypeValueWithTTL);
+    }
+
+    void Delete(std::string_view key) {
+        Write(key, std::string_view(), lsm::kTypeDeletion);
+    }
+
+    // a blind write, operand is folded into the value of key by DBOptions::merge_operator. false without one
+    bool Merge(std::string_view key, std::string_view operand) {
+        if (!options_.merge_operator) {
+            return false;
+        }
+        Write(key, operand, lsm::kTypeMerge);
+        return true;
+    }
+
+    // entries are applied in order, a concurrent reader may see a prefix of the batch
+    void Write(const WriteBatch& batch) {
+        for (auto& entry : batch.entries()) {
+            Write(entry.key, entry.value, entry.type);
+        }
+    }
+
+    /*
+    keys of batch must be strictly increasing and past every key in the db, e.g. time ordered metrics.
+    the batch becomes one sst in the last level, it never passes the memtable or a compaction.
+    false with nothing written when the order does not hold, Write takes the batch then,
+    or when the sst could not be written or logged
+    */
+    bool BulkAppend(const WriteBatch& batch) {
+        auto& entries = batch.entries();
+        if (entries.empty()) {
+            return true;
+        }
+        size_t size = 0;
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (i > 0 && entries[i - 1].key >= entries[i].key) {
+                return false;
+            }
+            size += entries[i].key.size() + entries[i].value.size();
+        }
+        std::unique_lock<std::mutex> lock(version_mutex_);
+        auto version = current();
+        std::string largest;
+        if (version->LargestKey(largest) && entries.front().key <= largest) {
+            return false;
+        }
         {
+            // a key written after this check is newer than the batch and shadows it from the memtable or level 0
             easykv::common::RWLock::ReadLock r_lock(memtable_lock_);
-            if (memtable_->Get(key, value)) {
-                return true;
+            if (memtable_->LastKey(largest) && entries.front().key <= largest) {
+                return false;
+            }
+            for (auto& inmemtable : inmemtables_) {
+                if (inmemtable->LastKey(largest) && entries.front().key <= largest) {
+                    return false;
+                }
+            }
+        }
+        auto& table_options = table_cache_->options();
+        auto level = version->last_level();
+        auto path_id = table_options.PathId(level);
+        auto id = ++sst_id_;
+        uint64_t largest_seq = seq_ += entries.size();
+        lsm::TableBuilder builder(lsm::SST::FileName(id, table_options.Path(path_id)), table_options);
+        builder.SetSeqRange(largest_seq - entries.size() + 1, largest_seq);
+        bool ok = builder.Open(size);
+        for (size_t i = 0; ok && i < entries.size(); i++) {
+            builder.Add(entries[i].key, entries[i].value, entries[i].type);
+        }
+        auto sst = std::make_shared<lsm::SST>();
+        sst->SetId(id);
+        sst->SetOptions(table_options);
+        sst->SetPathId(path_id);
+        if (!ok || !builder.Finish() || !sst->Load()) {
+            std::cout << "bulk append sst " << id << " failed" << std::endl;
+            unlink(lsm::SST::FileName(id, table_options.Path(path_id)).c_str());
+            return false;
+        }
+        lsm::VersionEdit edit;
+        edit.AddFile(level, table_cache_->Insert(sst));
+        edit.SetLastSequence(largest_seq);
+        edit.SetNextFileId(sst_id_);
+        auto new_manifest = std::make_shared<lsm::Manifest>(*version);
+        new_manifest->Apply(edit);
+        return InstallVersion(std::move(new_manifest), {edit});
+    }
+
+    /*
+    ssts built by SstFileWriter become part of the db in one manifest edit, every file at the deepest
+    level where it is still the newest version of its keys. memtables holding keys of a file are flushed first.
+    files are copied into db_path, move_files hard links them and removes the originals instead.
+    a file landing in a level with a path of its own in level_paths is moved there before it is logged
+    */
+    bool IngestExternalFile(const std::vector<std::string>& files, bool move_files = false) {
+        auto& table_options = table_cache_->options();
+        std::vector<std::shared_ptr<lsm::FileMetaData> > metas;
+        bool ok = true;
+        for (auto& file : files) {
+            auto id = ++sst_id_;
+            auto name = lsm::SST::FileName(id, table_options.Path(0));
+            if (!(move_files && link(file.c_str(), name.c_str()) == 0) && !common::CopyFile(file, name)) {
+                std::cout << "ingest " << file << " failed" << std::endl;
+                ok = false;
+                break;
+            }
+            auto sst = std::make_shared<lsm::SST>();
+            sst->SetId(id);
+            sst->SetOptions(table_options);
+            sst->SetPathId(0);
+            if (!sst->Load() || sst->properties().entry_count == 0) {
+                std::cout << "ingest " << file << " is no sst" << std::endl;
+                unlink(name.c_str());
+                ok = false;
+                break;
+            }
+            metas.emplace_back(table_cache_->Insert(sst));
+        }
+        if (!ok) {
+            for (auto& meta : metas) {
+                unlink(lsm::SST::FileName(meta->id, table_options.Path(0)).c_str());
+            }
+            return false;
+        }
+        FlushOverlapping(metas);
+        {
+            std::unique_lock<std::mutex> lock(version_mutex_);
+            auto new_manifest = std::make_shared<lsm::Manifest>(*current());
+            lsm::VersionEdit edit;
+            for (auto& meta : metas) {
+                // one seq per file, a later file of files is newer than an earlier one
+                meta->properties.smallest_seq = meta->properties.largest_seq = ++seq_;
+                auto level = new_manifest->IngestLevel(*meta);
+                auto path_id = table_options.PathId(level);
+                if (path_id != meta->path_id) {
+                    auto moved = MoveSST(*meta, path_id);
+                    if (!moved) {
+                        ok = false;
+                        break;
+                    }
+                    meta = moved;
+                }
+                lsm::VersionEdit file_edit;
+                file_edit.AddFile(level, meta);
+                new_manifest->Apply(file_edit);
+                edit.AddFile(level, meta);
+            }
+            edit.SetLastSequence(seq_);
+            edit.SetNextFileId(sst_id_);
+            ok = ok && InstallVersion(std::move(new_manifest), {edit});
+        }
+        if (!ok) {
+            for (auto& meta : metas) {
+                unlink(lsm::SST::FileName(meta->id, table_options.Path(meta->path_id)).c_str());
             }
+            return false;
+        }
+        if (row_cache_) {
+            row_cache_->InvalidateAll();
+        }
+        if (move_files) {
+            for (auto& file : files) {
+                unlink(file.c_str());
+            }
+        }
+        return true;
+    }
+
+    // the file of meta goes to path_id, copied when the paths are on different devices. nullptr leaves it where it was
+    std::shared_ptr<lsm::FileMetaData> MoveSST(const lsm::FileMetaData& meta, size_t path_id) {
+        auto& table_options = table_cache_->options();
+        auto from = lsm::SST::FileName(meta.id, table_options.Path(meta.path_id));
+        auto to = lsm::SST::FileName(meta.id, table_options.Path(path_id));
+        if (rename(from.c_str(), to.c_str()) != 0) {
+            if (!common::CopyFile(from, to)) {
+                std::cout << "move " << from << " to " << to << " failed" << std::endl;
+                unlink(to.c_str());
+                return nullptr;
+            }
+            unlink(from.c_str());
+        }
+        table_cache_->Erase(meta.id);
+        auto sst = std::make_shared<lsm::SST>();
+        sst->SetId(meta.id);
+        sst->SetOptions(table_options);
+        sst->SetPathId(path_id);
+        if (!sst->Load()) {
+            std::cout << "open moved sst " << meta.id << " failed" << std::endl;
+            rename(to.c_str(), from.c_str());
+            return nullptr;
+        }
+        auto moved = table_cache_->Insert(sst);
+        moved->properties = meta.properties;
+        return moved;
+    }
+
+    // values and found are resized to keys, returns how many keys were found
+    size_t MultiGet(const std::vector<std::string_view>& keys, std::vector<std::string>& values, std::vector<bool>& found) {
+        values.resize(keys.size());
+        found.assign(keys.size(), false);
+        size_t cnt = 0;
+        for (size_t i = 0; i < keys.size(); i++) {
+            found[i] = Get(keys[i], values[i]);
+            cnt += found[i];
+        }
+        return cnt;
+    }
+
+    // merges memtables and ssts as of now, later writes may or may not be seen
+    std::unique_ptr<lsm::InternalIterator> NewIterator() {
+        std::vector<std::unique_ptr<lsm::InternalIterator> > children;
+        {
+            // memtables before the manifest, a memtable flushed in between is then seen twice, never lost
+            easykv::common::RWLock::ReadLock r_lock(memtable_lock_);
+            children.emplace_back(std::make_unique<lsm::MemTableIterator>(memtable_));
             for (auto it = inmemtables_.rbegin(); it != inmemtables_.rend(); ++it) {
-                if ((*it)->Get(key, value)) {
+                children.emplace_back(std::make_unique<lsm::MemTableIterator>(*it));
+            }
+        }
+        auto version = current();
+        version->AddIterators(children);
+        return std::make_unique<lsm::DBIterator>(std::make_unique<lsm::MergingIterator>(std::move(children)), table_cache_,
+            [this](std::string_view key, lsm::PinnableValue& value) {
+                return GetMerged(key, value);
+            }, std::move(version));
+    }
+
+    size_t row_cache_hit_cnt() const {
+        return row_cache_ ? row_cache_->hit_cnt() : 0;
+    }
+
+    size_t row_cache_miss_cnt() const {
+        return row_cache_ ? row_cache_->miss_cnt() : 0;
+    }
+
+    // rewrite the live values of every blob file past blob_gc_garbage_ratio, returns how many files were collected
+    size_t BlobGC() {
+        std::unique_lock<std::mutex> lock(blob_gc_mutex_);
+        auto manifest = current();
+        size_t collected = 0;
+        for (auto& meta : manifest->BlobGCCandidates(options_.blob_gc_garbage_ratio)) {
+            if (CollectBlobFile(*meta)) {
+                ++collected;
+            }
+        }
+        return collected;
+    }
+
+    // rewrite every sst holding an expired value, returns how many compactions ran
+    size_t CompactExpired() {
+        std::unique_lock<std::mutex> lock(version_mutex_);
+        auto new_manifest = std::make_shared<lsm::Manifest>(*current());
+        auto edits = new_manifest->ExpiryCompaction(lsm::NowMicros(), [this]() { return ++sst_id_; });
+        if (edits.empty()) {
+            return 0;
+        }
+        edits.back().SetNextFileId(sst_id_);
+        return InstallVersion(std::move(new_manifest), edits) ? edits.size() : 0;
+    }
+
+    // files handed to the deleter once no version references them
+    const lsm::FileDeleter& file_deleter() {
+        return table_cache_->deleter();
+    }
+private:
+    /*
+    the newest version, pinned by the caller. a reader holds its version until it is done,
+    ssts dropped from newer versions are unlinked only when the last version holding them is released
+    */
+    std::shared_ptr<lsm::Manifest> current() {
+        easykv::common::RWLock::ReadLock r_lock(manifest_lock_);
+        return current_;
+    }
+
+    /*
+    version_mutex_ held, edits are already applied to version. false when they could not be logged:
+    version is dropped and current_ stays, no file leaves it. files the edits wrote stay on disk,
+    a record that reached the log before the failure may still name them
+    */
+    bool InstallVersion(std::shared_ptr<lsm::Manifest> version, const std::vector<lsm::VersionEdit>& edits) {
+        if (!LogEdits(edits)) {
+            return false;
+        }
+        SetCurrent(std::move(version));
+        MaybeRollManifest();
+        return true;
+    }
+
+    // version_mutex_ held. the append and fdatasync block no reader, current_ is untouched
+    bool LogEdits(const std::vector<lsm::VersionEdit>& edits) {
+        if (!manifest_log_->Append(edits)) {
+            std::cout << "append " << edits.size() << " edits to " << current_->log_name() << " failed" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // version_mutex_ held, the edits of version are logged
+    void SetCurrent(std::shared_ptr<lsm::Manifest> version) {
+        version->ReleaseObsolete();
+        easykv::common::RWLock::WriteLock w_lock(manifest_lock_);
+        current_ = std::move(version);
+    }
+
+    // version_mutex_ held
+    void MaybeRollManifest() {
+        if (manifest_log_->record_cnt() >= manifest_roll_records_) {
+            RollManifest();
+        }
+    }
+
+    // expire_at is set for a value that carries a ttl, a merged one included
+    bool GetFromLSM(std::string_view key, lsm::PinnableValue& value, uint64_t* expire_at = nullptr) {
+        // a second round when the blob file was collected after the index was read, gc has repointed the key by then
+        for (int round = 0; round < 2; round++) {
+            lsm::ValueType type;
+            if (!GetRaw(key, value, type) || type == lsm::kTypeDeletion) {
+                return false;
+            }
+            if (type == lsm::kTypeMerge) {
+                return GetMerged(key, value, expire_at);
+            }
+            if (type == lsm::kTypeValueWithTTL) {
+                // never separated into a blob file
+                if (lsm::Expired(value.view(), lsm::NowMicros())) {
+                    return false;
+                }
+                if (expire_at) {
+                    *expire_at = lsm::DecodeExpiry(value.view());
+                }
+                value.RemoveSuffix(lsm::kExpirySize);
+                return true;
+            }
+            if (type != lsm::kTypeBlobIndex) {
+                return true;
+            }
+            std::string blob_index(value.view());
+            if (table_cache_->ReadBlob(blob_index, value)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /*
+    every entry of key folded newest first. the version is taken under memtable_lock_, a flush swaps
+    the version and drops its memtable under the write lock, so no operand is seen twice or missed
+    */
+    bool GetMerged(std::string_view key, lsm::PinnableValue& value, uint64_t* expire_at = nullptr) {
+        if (!options_.merge_operator) {
+            return false;
+        }
+        lsm::MergeContext context;
+        std::shared_ptr<lsm::Manifest> version;
+        bool more = true;
+        {
+            easykv::common::RWLock::ReadLock r_lock(memtable_lock_);
+            version = current();
+            std::string entry;
+            lsm::ValueType type;
+            if (memtable_->Get(key, entry, type)) {
+                more = version->AddToMerge(context, entry, type);
+            }
+            for (auto it = inmemtables_.rbegin(); more && it != inmemtables_.rend(); ++it) {
+                if ((*it)->Get(key, entry, type)) {
+                    more = version->AddToMerge(context, entry, type);
+                }
+            }
+        }
+        if (more) {
+            version->ForEachVersion(key, [&version, &context](lsm::PinnableValue& entry, lsm::ValueType type) {
+                return version->AddToMerge(context, entry.view(), type);
+            });
+        }
+        if (!context.found() || !context.Finish(*options_.merge_operator, key, value.GetSelf())) {
+            return false;
+        }
+        if (expire_at) {
+            *expire_at = context.expire_at();
+        }
+        value.PinSelf();
+        return true;
+    }
+
+    // memtable_lock_ held, operands are folded into a base in memtable_ right away
+    void MergeIntoMemTable(std::string_view key, std::string_view operand) {
+        memtable_->Upsert(key, ++seq_, [this, key, operand](bool found, std::string& value, lsm::ValueType& type) {
+            if (!lsm::MergeInto(*options_.merge_operator, key, found, value, type, operand)) {
+                std::cout << "merge into " << key << " failed" << std::endl;
+            }
+        });
+    }
+
+    // a deletion is a tombstone entry, it shadows older versions until compaction reaches the last level
+    void Write(std::string_view key, std::string_view value, lsm::ValueType type) {
+        if (type == lsm::kTypeMerge && !options_.merge_operator) {
+            std::cout << "merge of " << key << " without a merge operator" << std::endl;
+            return;
+        }
+        bool full = false;
+        {
+            easykv::common::RWLock::ReadLock r_lock(memtable_lock_);
+            if (type == lsm::kTypeMerge) {
+                MergeIntoMemTable(key, value);
+            } else {
+                memtable_->Put(key, value, ++seq_, type);
+            }
+            ChargeMemTable(key.size() + value.size());
+            full = ShouldFlush();
+        }
+        if (row_cache_) {
+            row_cache_->Invalidate(key);
+        }
+        if (full) {
+            {
+                easykv::common::RWLock::WriteLock w_lock(memtable_lock_);
+                if (!ShouldFlush()) {
+                    return;
+                }
+                FreezeMemTable();
+                memtable_ = NewMemTable();
+            }
+            std::unique_lock<std::mutex> lock(to_sst_mutex_);
+            to_sst_cv_.notify_all();
+        }
+    }
+
+    // an ingested file must be newer than every memtable entry in its key range
+    void FlushOverlapping(const std::vector<std::shared_ptr<lsm::FileMetaData> >& metas) {
+        auto overlap = [&metas](lsm::MemeTable& memtable) {
+            auto it = memtable.NewIterator();
+            for (auto& meta : metas) {
+                it->Seek(meta->smallest());
+                if (it->Valid() && it->key() <= meta->largest()) {
                     return true;
                 }
             }
+            return false;
+        };
+        {
+            easykv::common::RWLock::WriteLock w_lock(memtable_lock_);
+            bool flush = memtable_->size() > 0 && overlap(*memtable_);
+            for (auto& inmemtable : inmemtables_) {
+                flush = flush || overlap(*inmemtable);
+            }
+            if (!flush) {
+                return;
+            }
+            if (memtable_->size() > 0) {
+                FreezeMemTable();
+                memtable_ = NewMemTable();
+            }
+        }
+        std::unique_lock<std::mutex> lock(to_sst_mutex_);
+        to_sst_cv_.notify_all();
+        flushed_cv_.wait(lock, [this]() {
+            easykv::common::RWLock::ReadLock r_lock(memtable_lock_);
+            return inmemtables_.empty();
+        });
+    }
+
+    std::shared_ptr<lsm::MemeTable> NewMemTable() {
+        return std::make_shared<lsm::MemeTable>(options_.memtable_rep, options_.memtable_hash_bucket_count);
+    }
+
+    // memtable_lock_ held, a shared budget may ask for an early flush of a memtable past min_flush_size_
+    bool ShouldFlush() {
+        if (memtable_->binary_size() > options_.write_buffer_size) {
+            return true;
+        }
+        return options_.memory_budget && memtable_->binary_size() >= min_flush_size_ &&
+            options_.memory_budget->ShouldFlush();
+    }
+
+    // memtable_lock_ held
+    void ChargeMemTable(size_t bytes) {
+        if (options_.memory_budget) {
+            memtable_charge_ += bytes;
+            options_.memory_budget->Reserve(lsm::MemoryConsumer::kMemTable, bytes);
+        }
+    }
+
+    // memtable_lock_ write held, the charge of memtable_ moves to the immutable memtables
+    void FreezeMemTable() {
+        if (options_.memory_budget) {
+            options_.memory_budget->Freeze(memtable_charge_, memtable_->binary_size());
+            memtable_charge_ = 0;
         }
+        inmemtables_.emplace_back(memtable_);
+        if (freeze_pool_) {
+            freeze_pool_->Enqueue([memtable = memtable_, budget = options_.memory_budget]() {
+                memtable->Freeze(budget.get());
+            });
+        }
+    }
+
+    // newest entry of key, a kTypeBlobIndex value is left encoded
+    bool GetRaw(std::string_view key, lsm::PinnableValue& value, lsm::ValueType& type) {
         {
-            easykv::common::RWLock::ReadLock r_lock(manifest_lock_);
-            return manifest_queue_.back()->Get(key, value);
+            // memtable values change in place, they are copied
+            easykv::common::RWLock::ReadLock r_lock(memtable_lock_);
+            if (GetFromMemTables(key, value.GetSelf(), type)) {
+                value.PinSelf();
+                return true;
+            }
+        }
+        return current()->Get(key, value, type);
+    }
+
+    // memtable_lock_ held
+    bool GetFromMemTables(std::string_view key, std::string& value, lsm::ValueType& type) {
+        if (memtable_->Get(key, value, type)) {
+            return true;
+        }
+        for (auto it = inmemtables_.rbegin(); it != inmemtables_.rend(); ++it) {
+            if ((*it)->Get(key, value, type)) {
+                return true;
+            }
         }
         return false;
     }
 
-    void Put(std::string_view key, std::string_view value) {
-        memtable_->Put(key, value);
-        if (memtable_->binary_size() > memetable_max_size_) {
+    /*
+    memtable_lock_ held, index is still what the newest version of key points at. under_merge is set when it is
+    the base of newer merge operands instead: a repointed index would shadow them, the file is kept for now
+    */
+    bool IsLiveBlob(std::string_view key, const lsm::BlobIndex& index, bool& under_merge) {
+        // memtables never hold a BlobIndex, any other entry but an operand shadows index
+        std::string value;
+        lsm::ValueType type;
+        bool merged = false;
+        if (memtable_->Get(key, value, type)) {
+            if (type != lsm::kTypeMerge) {
+                return false;
+            }
+            merged = true;
+        }
+        for (auto it = inmemtables_.rbegin(); it != inmemtables_.rend(); ++it) {
+            if ((*it)->Get(key, value, type)) {
+                if (type != lsm::kTypeMerge) {
+                    return false;
+                }
+                merged = true;
+            }
+        }
+        bool live = false;
+        current()->ForEachVersion(key, [&](lsm::PinnableValue& entry, lsm::ValueType type) {
+            if (type == lsm::kTypeMerge) {
+                merged = true;
+                return true;
+            }
+            lsm::BlobIndex newest;
+            live = type == lsm::kTypeBlobIndex && newest.Decode(entry.view()) && newest == index;
+            return false;
+        });
+        under_merge = under_merge || (live && merged);
+        return live && !merged;
+    }
+
+    /*
+    live records are copied to a new blob file and repointed by an sst of new BlobIndex entries in level 0.
+    the sst is logged in the edit that drops the old file, so no repointed value lives only in a memtable.
+    the old file goes to the file deleter once no version holds it, shadowed sst entries still pointing
+    at it are dropped by later compactions
+    */
+    bool CollectBlobFile(const lsm::BlobFileMeta& meta) {
+        auto reader = table_cache_->GetBlob(meta.id);
+        if (!reader) {
+            return false;
+        }
+        auto& table_options = table_cache_->options();
+        auto new_id = ++sst_id_;
+        lsm::BlobFileBuilder builder(new_id, table_options);
+        if (!builder.Open(meta.total_bytes - meta.garbage_bytes)) {
+            return false;
+        }
+        struct Moved {
+            std::string key;
+            lsm::BlobIndex from;
+            lsm::BlobIndex to;
+        };
+        std::vector<Moved> moved;
+        bool under_merge = false;
+        bool ok = reader->ForEach([&](std::string_view key, const lsm::BlobIndex& index, std::string_view value) {
+            bool live = false;
+            {
+                easykv::common::RWLock::ReadLock r_lock(memtable_lock_);
+                live = IsLiveBlob(key, index, under_merge);
+            }
+            if (live) {
+                moved.push_back(Moved{std::string(key), index, builder.Add(key, value)});
+            }
+        });
+        ok = builder.Finish() && ok && !under_merge;
+        auto blob_name = lsm::BlobFileName(new_id, table_options.db_path);
+        if (!ok) {
+            unlink(blob_name.c_str());
+            return false;
+        }
+        auto new_meta = builder.meta();
+        // flushes install under version_mutex_ too, a newer version of a key never lands in level 0 before the sst
+        std::unique_lock<std::mutex> lock(version_mutex_);
+        if (current()->blob_files().count(meta.id) == 0) {
+            unlink(blob_name.c_str());
+            return false;
+        }
+        uint64_t largest_seq = 0;
+        {
+            // a key written since the scan keeps its newer value, its copy is garbage from the start.
+            // writes are held off until the seqs are taken: a newer write gets a newer seq
             easykv::common::RWLock::WriteLock w_lock(memtable_lock_);
-            inmemtables_.emplace_back(memtable_);
-            memtable_ = std::make_shared<easykv::lsm::MemeTable>();
+            auto dead = std::remove_if(moved.begin(), moved.end(), [&](const Moved& record) {
+                return !IsLiveBlob(record.key, record.from, under_merge);
+            });
+            for (auto it = dead; it != moved.end(); ++it) {
+                ++new_meta->garbage_count;
+                new_meta->garbage_bytes += it->to.size;
+            }
+            moved.erase(dead, moved.end());
+            largest_seq = seq_ += moved.size();
         }
+        if (under_merge) {
+            unlink(blob_name.c_str());
+            return false;
+        }
+        lsm::VersionEdit edit;
+        if (moved.empty()) {
+            unlink(blob_name.c_str());
+        } else {
+            std::sort(moved.begin(), moved.end(), [](const Moved& lhs, const Moved& rhs) {
+                return lhs.key < rhs.key;
+            });
+            auto id = ++sst_id_;
+            auto path_id = table_options.PathId(0);
+            auto name = lsm::SST::FileName(id, table_options.Path(path_id));
+            lsm::TableBuilder sst_builder(name, table_options);
+            sst_builder.SetSeqRange(largest_seq - moved.size() + 1, largest_seq);
+            bool built = sst_builder.Open();
+            for (size_t i = 0; built && i < moved.size(); i++) {
+                sst_builder.Add(moved[i].key, moved[i].to.Encode(), lsm::kTypeBlobIndex);
+            }
+            auto sst = std::make_shared<lsm::SST>();
+            sst->SetId(id);
+            sst->SetOptions(table_options);
+            sst->SetPathId(path_id);
+            if (!built || !sst_builder.Finish() || !sst->Load()) {
+                std::cout << "blob gc sst " << id << " failed" << std::endl;
+                unlink(name.c_str());
+                unlink(blob_name.c_str());
+                return false;
+            }
+            edit.AddFile(0, table_cache_->Insert(sst));
+            edit.AddBlobFile(new_meta);
+            edit.SetLastSequence(largest_seq);
+        }
+        edit.DeleteBlobFile(meta.id);
+        edit.SetNextFileId(sst_id_);
+        auto new_manifest = std::make_shared<lsm::Manifest>(*current());
+        new_manifest->Apply(edit);
+        return InstallVersion(std::move(new_manifest), {edit});
     }
-private:
+
     void ToSSTLoop() {
+        auto period = std::chrono::milliseconds(options_.ttl_compaction_period_ms);
+        auto next_ttl_compaction = std::chrono::steady_clock::now() + period;
+        bool failed = false;
         while (true) {
             std::unique_lock<std::mutex> lock(to_sst_mutex_);
-            to_sst_cv_.wait(lock);
+            auto ready = [this]() {
+                easykv::common::RWLock::ReadLock r_lock(memtable_lock_);
+                return to_sst_stop_flag_ || inmemtables_.size() > 0;
+            };
+            if (failed) {
+                // the memtable is still there, retry after a pause instead of spinning on it
+                to_sst_cv_.wait_for(lock, flush_retry_interval_, [this]() {
+                    return to_sst_stop_flag_;
+                });
+            } else if (period.count() > 0) {
+                to_sst_cv_.wait_until(lock, next_ttl_compaction, ready);
+            } else {
+                to_sst_cv_.wait(lock, ready);
+            }
+            failed = false;
             while (true) {
                 bool to_sst = false;
                 {
@@ -86,19 +844,30 @@ private:
                         to_sst = true;
                     }
                 }
-                if (to_sst) {
-                    ToSST();
-                } else {
+                if (!to_sst) {
                     break;
                 }
-
+                if (!ToSST()) {
+                    failed = true;
+                    break;
+                }
+            }
+            flushed_cv_.notify_all();
+            // gc writes live values back into memtable_, never after the final flush
+            if (options_.min_blob_size > 0 && !to_sst_stop_flag_) {
+                BlobGC();
+            }
+            if (period.count() > 0 && !to_sst_stop_flag_ && std::chrono::steady_clock::now() >= next_ttl_compaction) {
+                CompactExpired();
+                next_ttl_compaction = std::chrono::steady_clock::now() + period;
             }
             if (to_sst_stop_flag_) {
                 break;
             }
         }
     }
-    void ToSST() {
+    // false when the sst could not be written or logged, the memtable stays immutable until a retry succeeds
+    bool ToSST() {
         // inmemtables_ must > 0
         std::shared_ptr<lsm::MemeTable> inmemtable;
         {
@@ -106,43 +875,140 @@ private:
             inmemtable = *inmemtables_.begin();
         }
         
-        auto sst = std::make_shared<lsm::SST>(*inmemtable, ++sst_id_);
+        std::shared_ptr<lsm::SST> sst;
+        std::shared_ptr<lsm::BlobFileMeta> blob_meta;
+        // a flush goes before compactions, writers stall on it
+        auto flush_options = table_cache_->options();
+        flush_options.write_priority = common::RateLimiter::Priority::kHigh;
+        auto id = ++sst_id_;
+        size_t blob_id = 0;
+        if (options_.min_blob_size > 0) {
+            blob_id = ++sst_id_;
+            sst = lsm::BuildTableWithBlobs(*inmemtable, id, blob_id, options_.min_blob_size, flush_options, blob_meta,
+                flush_options.PathId(0));
+        } else {
+            sst = std::make_shared<lsm::SST>(*inmemtable, id, flush_options, flush_options.PathId(0));
+        }
+        // an output the manifest never got is unreachable, the memtable stays and is flushed again
+        auto drop_output = [&]() {
+            unlink(lsm::SST::FileName(id, flush_options.Path(flush_options.PathId(0))).c_str());
+            if (blob_id != 0) {
+                unlink(lsm::BlobFileName(blob_id, flush_options.db_path).c_str());
+            }
+        };
+        if (!sst || !sst->ready()) {
+            drop_output();
+            return false;
+        }
+        auto meta = table_cache_->Insert(sst);
         
         {
-            easykv::common::RWLock::WriteLock w_lock(manifest_lock_);
-            auto new_manifest = manifest_queue_.back()->InsertAndUpdate(sst);
+            // readers keep using the current version while the next one is compacted
+            std::unique_lock<std::mutex> lock(version_mutex_);
+            std::vector<lsm::VersionEdit> edits(1);
+            edits.back().AddFile(0, meta);
+            if (blob_meta) {
+                edits.back().AddBlobFile(blob_meta);
+            }
+            auto new_manifest = std::make_shared<lsm::Manifest>(*current());
+            new_manifest->Apply(edits.back());
+            TuneRateLimiter(*new_manifest);
             if (new_manifest->CanDoCompaction()) {
-                new_manifest->SizeTieredCompaction(++sst_id_);
+                for (auto& edit : new_manifest->SizeTieredCompaction([this]() { return ++sst_id_; })) {
+                    edits.emplace_back(std::move(edit));
+                }
+            }
+            edits.back().SetNextFileId(sst_id_);
+            edits.back().SetLastSequence(inmemtable->largest_seq());
+            // logged before writers are stopped, only the swap below runs under memtable_lock_
+            if (!LogEdits(edits)) {
+                table_cache_->Erase(id);
+                drop_output();
+                return false;
+            }
+            {
+                // a reader sees the memtable or its sst, never both: merge operands would be applied twice
+                easykv::common::RWLock::WriteLock w_lock(memtable_lock_);
+                SetCurrent(std::move(new_manifest));
+                std::vector<std::shared_ptr<easykv::lsm::MemeTable> > new_inmemtables;
+                new_inmemtables.reserve(inmemtables_.size() - 1);
+                for (auto it = inmemtables_.begin() + 1; it != inmemtables_.end(); ++it) {
+                    new_inmemtables.emplace_back(*it);
+                }
+                inmemtables_ = std::move(new_inmemtables);
             }
-            manifest_queue_.emplace_back(new_manifest);
+            MaybeRollManifest();
+        }
+        if (options_.memory_budget) {
+            options_.memory_budget->Release(lsm::MemoryConsumer::kImmutableMemTable, inmemtable->binary_size());
         }
+        inmemtable->ReleaseFrozen(options_.memory_budget.get());
+        return true;
+    }
 
+    // the debt is what is waiting to be compacted plus the memtables waiting for a flush
+    void TuneRateLimiter(lsm::Manifest& version) {
+        if (!options_.rate_limiter) {
+            return;
+        }
+        size_t debt = version.CompactionDebt();
         {
-            easykv::common::RWLock::WriteLock w_lock(memtable_lock_);
-            std::vector<std::shared_ptr<easykv::lsm::MemeTable> > new_inmemtables;
-            new_inmemtables.reserve(inmemtables_.size() - 1);
-            for (auto it = inmemtables_.begin() + 1; it != inmemtables_.end(); ++it) {
-                new_inmemtables.emplace_back(*it);
+            easykv::common::RWLock::ReadLock r_lock(memtable_lock_);
+            for (auto& inmemtable : inmemtables_) {
+                debt += inmemtable->binary_size();
             }
-            inmemtables_ = std::move(new_inmemtables);
+        }
+        options_.rate_limiter->Tune(static_cast<double>(debt) / (max_debt_buffers_ * options_.write_buffer_size));
+    }
+
+    // a second DB on the same db_path, in this process or another, would corrupt the manifest: the open fails
+    void LockDB() {
+        auto name = common::JoinPath(options_.db_path, "LOCK");
+        lock_fd_ = open(name.c_str(), O_RDWR | O_CREAT, 0644);
+        if (lock_fd_ == -1 || flock(lock_fd_, LOCK_EX | LOCK_NB) != 0) {
+            if (lock_fd_ != -1) {
+                close(lock_fd_);
+                lock_fd_ = -1;
+            }
+            throw std::runtime_error("lock " + name + " failed, the db is already open");
+        }
+    }
+
+    // fold the edit log into a fresh snapshot, version_mutex_ held or single threaded
+    void RollManifest() {
+        if (current_->Save()) {
+            manifest_log_->Reset();
         }
     }
 
 private:
-private:
-    constexpr static size_t memetable_max_size_ = 4096 * 1024 - 1024 * 1024; // <= 4kb(page size)
+    constexpr static size_t manifest_roll_records_ = 1024;
+    constexpr static size_t min_flush_size_ = 64 * 1024;
+    constexpr static size_t max_debt_buffers_ = 4; // write buffers of debt that run an auto tuned limiter at full rate
+    constexpr static std::chrono::milliseconds flush_retry_interval_{100};
+    DBOptions options_;
+    std::shared_ptr<easykv::lsm::TableCache> table_cache_;
+    std::unique_ptr<easykv::lsm::RowCache> row_cache_;
     std::shared_ptr<easykv::lsm::MemeTable> memtable_;
     std::vector<std::shared_ptr<easykv::lsm::MemeTable> > inmemtables_;
-    std::vector<std::shared_ptr<easykv::lsm::Manifest> > manifest_queue_;
-    easykv::common::RWLock manifest_lock_;
+    std::shared_ptr<easykv::lsm::Manifest> current_;
+    std::unique_ptr<easykv::lsm::ManifestLog> manifest_log_; // version_mutex_
+    easykv::common::RWLock manifest_lock_; // guards current_, written with version_mutex_ held as well
+    std::mutex version_mutex_; // one version builder (flush, compaction, blob gc) at a time
     easykv::common::RWLock memtable_lock_;
 
+    std::unique_ptr<cpputil::pool::ThreadPool> freeze_pool_; // packs immutable memtables
     std::thread to_sst_thread_;
     std::mutex to_sst_mutex_;
     std::condition_variable to_sst_cv_;
+    std::condition_variable flushed_cv_; // every immutable memtable is in an sst, to_sst_mutex_
     bool to_sst_stop_flag_ = false;
+    std::mutex blob_gc_mutex_;
 
     std::atomic_size_t sst_id_{0};
+    std::atomic_uint64_t seq_{0};
+    std::atomic_size_t memtable_charge_{0}; // bytes of memtable_ reserved in the memory budget
+    int lock_fd_ = -1;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,619 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "easykv/lsm/format.hpp"
+#include "easykv/lsm/frozen_memtable.hpp"
+#include "easykv/lsm/memtable_rep.hpp"
+#include "easykv/utils/lock.hpp"
+
+namespace easykv {
+namespace lsm {
+
+/*
+ArtRep is an adaptive radix tree: a lookup reads one byte of the key per inner node and compares the
+bytes keys share (the prefix of a node) once, so its depth is bounded by the key length and long common
+prefixes cost no repeated full key compares. inner nodes grow 4 -> 16 -> 48 -> 256 children.
+
+readers take no lock (optimistic lock coupling): every inner node has a version, a reader
+restarts when a node it passed has changed since. writers lock the one or two nodes they change.
+a node is never changed in place where a reader could be misled: a fuller or split node replaces it,
+the old one is marked obsolete and kept until the rep goes away, so no pointer a reader holds dangles.
+a key ending inside the tree sits in the terminal slot of the node it ends at.
+Snapshot and ForEach hold writers off while they walk the tree in key order
+*/
+class ArtRep : public MemTableRep {
+    struct Leaf {
+        Leaf(std::string_view key): key(key) {}
+        const std::string key;
+        std::string value; // changes in place under lock
+        ValueType type = kTypeValue;
+        easykv::common::RWLock lock;
+    };
+
+    enum Kind : uint8_t {
+        kNode4,
+        kNode16,
+        kNode48,
+        kNode256,
+    };
+
+    // version: bit 0 obsolete, bit 1 write locked, a counter above
+    struct Node {
+        Node(Kind kind, std::string_view prefix): kind(kind), prefix(prefix) {}
+        std::atomic_uint64_t version{0};
+        const Kind kind;
+        const std::string prefix; // never changes, a split puts a copy with a shorter one in place
+        std::atomic<uintptr_t> terminal{0};
+        std::atomic_uint16_t count{0};
+    };
+
+    // children sorted by key byte
+    template <size_t N>
+    struct NodeN : Node {
+        NodeN(std::string_view prefix): Node(N == 4 ? kNode4 : kNode16, prefix) {}
+        std::atomic_uint8_t keys[N]{};
+        std::atomic<uintptr_t> children[N]{};
+    };
+
+    struct Node48 : Node {
+        Node48(std::string_view prefix): Node(kNode48, prefix) {}
+        std::atomic_uint8_t index[256]{}; // slot + 1, 0 is empty
+        std::atomic<uintptr_t> children[48]{};
+    };
+
+    struct Node256 : Node {
+        Node256(std::string_view prefix): Node(kNode256, prefix) {}
+        std::atomic<uintptr_t> children[256]{};
+    };
+
+    using Node4 = NodeN<4>;
+    using Node16 = NodeN<16>;
+
+public:
+    // the root never splits or grows, every other node has a parent to be replaced in
+    ArtRep() {
+        root_ = NewNode(kNode256, std::string_view());
+    }
+
+    ~ArtRep() override {
+        Free(root_);
+        for (auto node : retired_) {
+            DeleteNode(node);
+        }
+    }
+
+    bool Get(std::string_view key, std::string& value, ValueType& type) override {
+        while (true) {
+            bool found = false;
+            if (TryGet(key, value, type, found)) {
+                return found;
+            }
+        }
+    }
+
+    void Upsert(std::string_view key, const UpsertFn& fn) override {
+        easykv::common::RWLock::ReadLock lock(walk_lock_);
+        while (!TryUpsert(key, fn)) {}
+    }
+
+    bool LastKey(std::string& key) override {
+        std::unique_lock<std::mutex> lock(last_key_mutex_);
+        if (size_ == 0) {
+            return false;
+        }
+        key = last_key_;
+        return true;
+    }
+
+    std::shared_ptr<const FrozenMemTable> Snapshot() override {
+        std::vector<FrozenMemTable::EntryRef> entries;
+        entries.reserve(size_);
+        easykv::common::RWLock::WriteLock lock(walk_lock_);
+        Walk(root_, [&entries](Leaf* leaf) {
+            entries.push_back(FrozenMemTable::EntryRef{leaf->key, leaf->value, leaf->type});
+            return true;
+        });
+        return std::make_shared<FrozenMemTable>(entries.begin(), entries.end());
+    }
+
+    void ForEach(const ForEachFn& fn) override {
+        easykv::common::RWLock::WriteLock lock(walk_lock_);
+        Walk(root_, [&fn](Leaf* leaf) {
+            return fn(leaf->key, leaf->value, leaf->type);
+        });
+    }
+
+    size_t size() override {
+        return size_;
+    }
+
+    size_t binary_size() override {
+        return binary_size_;
+    }
+
+private:
+    static bool IsLeaf(uintptr_t child) {
+        return child & 1;
+    }
+
+    static Leaf* AsLeaf(uintptr_t child) {
+        return reinterpret_cast<Leaf*>(child & ~uintptr_t(1));
+    }
+
+    static Node* AsNode(uintptr_t child) {
+        return reinterpret_cast<Node*>(child);
+    }
+
+    static uintptr_t Tag(Leaf* leaf) {
+        return reinterpret_cast<uintptr_t>(leaf) | 1;
+    }
+
+    static uintptr_t Tag(Node* node) {
+        return reinterpret_cast<uintptr_t>(node);
+    }
+
+    // false while node is locked or obsolete, the caller restarts
+    static bool ReadLock(Node* node, uint64_t& version) {
+        version = node->version.load(std::memory_order_acquire);
+        return (version & 3) == 0;
+    }
+
+    // node is as it was when version was read, everything read from it in between holds
+    static bool Check(Node* node, uint64_t version) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return node->version.load(std::memory_order_relaxed) == version;
+    }
+
+    static bool Upgrade(Node* node, uint64_t version) {
+        return node->version.compare_exchange_strong(version, version + 2, std::memory_order_acquire);
+    }
+
+    static void Unlock(Node* node) {
+        node->version.fetch_add(2, std::memory_order_release);
+    }
+
+    static void UnlockObsolete(Node* node) {
+        node->version.fetch_add(3, std::memory_order_release);
+    }
+
+    static size_t CommonPrefix(std::string_view a, std::string_view b) {
+        size_t n = std::min(a.size(), b.size());
+        size_t i = 0;
+        while (i < n && a[i] == b[i]) {
+            ++i;
+        }
+        return i;
+    }
+
+    static uintptr_t FindChild(Node* node, uint8_t byte) {
+        switch (node->kind) {
+        case kNode4:
+            return FindChild(static_cast<Node4*>(node), byte);
+        case kNode16:
+            return FindChild(static_cast<Node16*>(node), byte);
+        case kNode48: {
+            auto n = static_cast<Node48*>(node);
+            auto slot = n->index[byte].load(std::memory_order_relaxed);
+            return slot == 0 ? 0 : n->children[(slot - 1) % 48].load(std::memory_order_relaxed);
+        }
+        default:
+            return static_cast<Node256*>(node)->children[byte].load(std::memory_order_relaxed);
+        }
+    }
+
+    template <size_t N>
+    static uintptr_t FindChild(NodeN<N>* node, uint8_t byte) {
+        auto count = std::min<size_t>(node->count.load(std::memory_order_relaxed), N);
+        for (size_t i = 0; i < count; i++) {
+            if (node->keys[i].load(std::memory_order_relaxed) == byte) {
+                return node->children[i].load(std::memory_order_relaxed);
+            }
+        }
+        return 0;
+    }
+
+    static bool IsFull(Node* node) {
+        auto count = node->count.load(std::memory_order_relaxed);
+        switch (node->kind) {
+        case kNode4:
+            return count == 4;
+        case kNode16:
+            return count == 16;
+        case kNode48:
+            return count == 48;
+        default:
+            return false;
+        }
+    }
+
+    // node write locked (or not yet published) and not full, byte absent
+    static void AddChild(Node* node, uint8_t byte, uintptr_t child) {
+        auto count = node->count.load(std::memory_order_relaxed);
+        switch (node->kind) {
+        case kNode4:
+            AddChild(static_cast<Node4*>(node), count, byte, child);
+            break;
+        case kNode16:
+            AddChild(static_cast<Node16*>(node), count, byte, child);
+            break;
+        case kNode48: {
+            auto n = static_cast<Node48*>(node);
+            n->children[count].store(child, std::memory_order_relaxed);
+            n->index[byte].store(count + 1, std::memory_order_relaxed);
+            break;
+        }
+        default:
+            static_cast<Node256*>(node)->children[byte].store(child, std::memory_order_relaxed);
+            break;
+        }
+        node->count.store(count + 1, std::memory_order_relaxed);
+    }
+
+    template <size_t N>
+    static void AddChild(NodeN<N>* node, size_t count, uint8_t byte, uintptr_t child) {
+        size_t i = count;
+        while (i > 0 && node->keys[i - 1].load(std::memory_order_relaxed) > byte) {
+            node->keys[i].store(node->keys[i - 1].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            node->children[i].store(node->children[i - 1].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            --i;
+        }
+        node->keys[i].store(byte, std::memory_order_relaxed);
+        node->children[i].store(child, std::memory_order_relaxed);
+    }
+
+    // node write locked, byte present
+    static void ReplaceChild(Node* node, uint8_t byte, uintptr_t child) {
+        switch (node->kind) {
+        case kNode4:
+        case kNode16: {
+            auto keys = node->kind == kNode4 ? static_cast<Node4*>(node)->keys : static_cast<Node16*>(node)->keys;
+            auto children = node->kind == kNode4 ? static_cast<Node4*>(node)->children : static_cast<Node16*>(node)->children;
+            for (size_t i = 0; i < node->count.load(std::memory_order_relaxed); i++) {
+                if (keys[i].load(std::memory_order_relaxed) == byte) {
+                    children[i].store(child, std::memory_order_relaxed);
+                    return;
+                }
+            }
+            return;
+        }
+        case kNode48: {
+            auto n = static_cast<Node48*>(node);
+            n->children[n->index[byte].load(std::memory_order_relaxed) - 1].store(child, std::memory_order_relaxed);
+            return;
+        }
+        default:
+            static_cast<Node256*>(node)->children[byte].store(child, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    // fn(byte, child) in byte order
+    template <typename Fn>
+    static bool ForEachChild(Node* node, Fn&& fn) {
+        switch (node->kind) {
+        case kNode4:
+        case kNode16: {
+            auto keys = node->kind == kNode4 ? static_cast<Node4*>(node)->keys : static_cast<Node16*>(node)->keys;
+            auto children = node->kind == kNode4 ? static_cast<Node4*>(node)->children : static_cast<Node16*>(node)->children;
+            for (size_t i = 0; i < node->count.load(std::memory_order_relaxed); i++) {
+                if (!fn(keys[i].load(std::memory_order_relaxed), children[i].load(std::memory_order_relaxed))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case kNode48: {
+            auto n = static_cast<Node48*>(node);
+            for (size_t byte = 0; byte < 256; byte++) {
+                auto slot = n->index[byte].load(std::memory_order_relaxed);
+                if (slot != 0 && !fn(byte, n->children[slot - 1].load(std::memory_order_relaxed))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default: {
+            auto n = static_cast<Node256*>(node);
+            for (size_t byte = 0; byte < 256; byte++) {
+                auto child = n->children[byte].load(std::memory_order_relaxed);
+                if (child != 0 && !fn(byte, child)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        }
+    }
+
+    // every inner node counts in binary_size_ from here on, a retired one is only freed with the rep
+    Node* NewNode(Kind kind, std::string_view prefix) {
+        binary_size_ += NodeSize(kind) + prefix.size();
+        switch (kind) {
+        case kNode4:
+            return new Node4(prefix);
+        case kNode16:
+            return new Node16(prefix);
+        case kNode48:
+            return new Node48(prefix);
+        default:
+            return new Node256(prefix);
+        }
+    }
+
+    static size_t NodeSize(Kind kind) {
+        switch (kind) {
+        case kNode4:
+            return sizeof(Node4);
+        case kNode16:
+            return sizeof(Node16);
+        case kNode48:
+            return sizeof(Node48);
+        default:
+            return sizeof(Node256);
+        }
+    }
+
+    static void DeleteNode(Node* node) {
+        switch (node->kind) {
+        case kNode4:
+            delete static_cast<Node4*>(node);
+            break;
+        case kNode16:
+            delete static_cast<Node16*>(node);
+            break;
+        case kNode48:
+            delete static_cast<Node48*>(node);
+            break;
+        default:
+            delete static_cast<Node256*>(node);
+            break;
+        }
+    }
+
+    // node write locked, a copy of kind with prefix holding the same children and terminal
+    Node* Copy(Node* node, Kind kind, std::string_view prefix) {
+        auto copy = NewNode(kind, prefix);
+        copy->terminal.store(node->terminal.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        ForEachChild(node, [copy](uint8_t byte, uintptr_t child) {
+            AddChild(copy, byte, child);
+            return true;
+        });
+        return copy;
+    }
+
+    // a leaf goes to the terminal slot of node when its key ends at depth
+    static void Place(Node* node, Leaf* leaf, size_t depth) {
+        if (leaf->key.size() == depth) {
+            node->terminal.store(Tag(leaf), std::memory_order_relaxed);
+        } else {
+            AddChild(node, leaf->key[depth], Tag(leaf));
+        }
+    }
+
+    void Update(Leaf* leaf, const UpsertFn& fn) {
+        easykv::common::RWLock::WriteLock lock(leaf->lock);
+        binary_size_ -= leaf->value.size();
+        fn(true, leaf->value, leaf->type);
+        binary_size_ += leaf->value.size();
+    }
+
+    Leaf* NewLeaf(std::string_view key, const UpsertFn& fn) {
+        auto leaf = new Leaf(key);
+        fn(false, leaf->value, leaf->type);
+        ++size_;
+        binary_size_ += key.size() + leaf->value.size();
+        std::unique_lock<std::mutex> lock(last_key_mutex_);
+        if (size_ == 1 || last_key_ < key) {
+            last_key_.assign(key);
+        }
+        return leaf;
+    }
+
+    void Retire(Node* node) {
+        std::unique_lock<std::mutex> lock(retired_mutex_);
+        retired_.push_back(node);
+    }
+
+    bool ReadLeaf(Leaf* leaf, std::string_view key, std::string& value, ValueType& type) {
+        if (leaf->key != key) {
+            return false;
+        }
+        easykv::common::RWLock::ReadLock lock(leaf->lock);
+        value = leaf->value;
+        type = leaf->type;
+        return true;
+    }
+
+    // false to restart, found tells whether key is there
+    bool TryGet(std::string_view key, std::string& value, ValueType& type, bool& found) {
+        Node* node = root_;
+        uint64_t version;
+        if (!ReadLock(node, version)) {
+            return false;
+        }
+        size_t depth = 0;
+        while (true) {
+            auto& prefix = node->prefix;
+            if (key.size() - depth < prefix.size() || key.compare(depth, prefix.size(), prefix) != 0) {
+                return Check(node, version);
+            }
+            depth += prefix.size();
+            uintptr_t child = depth == key.size() ? node->terminal.load(std::memory_order_relaxed) :
+                FindChild(node, key[depth]);
+            if (!Check(node, version)) {
+                return false;
+            }
+            if (child == 0) {
+                return true;
+            }
+            if (IsLeaf(child)) {
+                found = ReadLeaf(AsLeaf(child), key, value, type);
+                return true;
+            }
+            auto parent = node;
+            auto parent_version = version;
+            node = AsNode(child);
+            if (!ReadLock(node, version) || !Check(parent, parent_version)) {
+                return false;
+            }
+            ++depth;
+        }
+    }
+
+    // walk_lock_ held shared, false to restart
+    bool TryUpsert(std::string_view key, const UpsertFn& fn) {
+        Node* parent = nullptr;
+        uint64_t parent_version = 0;
+        uint8_t parent_byte = 0;
+        Node* node = root_;
+        uint64_t version;
+        if (!ReadLock(node, version)) {
+            return false;
+        }
+        size_t depth = 0;
+        while (true) {
+            auto& prefix = node->prefix;
+            auto common = CommonPrefix(prefix, key.substr(depth));
+            if (common < prefix.size()) {
+                // key leaves the prefix: a Node4 with the shared part takes the place of node, a copy of node
+                // with the rest of its prefix and the new leaf go below it
+                if (!Upgrade(parent, parent_version)) {
+                    return false;
+                }
+                if (!Upgrade(node, version)) {
+                    Unlock(parent);
+                    return false;
+                }
+                auto split = NewNode(kNode4, std::string_view(prefix).substr(0, common));
+                AddChild(split, prefix[common], Tag(Copy(node, node->kind, std::string_view(prefix).substr(common + 1))));
+                Place(split, NewLeaf(key, fn), depth + common);
+                ReplaceChild(parent, parent_byte, Tag(split));
+                Unlock(parent);
+                UnlockObsolete(node);
+                Retire(node);
+                return true;
+            }
+            depth += prefix.size();
+            if (depth == key.size()) {
+                auto terminal = node->terminal.load(std::memory_order_relaxed);
+                if (!Check(node, version)) {
+                    return false;
+                }
+                if (terminal != 0) {
+                    Update(AsLeaf(terminal), fn);
+                    return true;
+                }
+                if (!Upgrade(node, version)) {
+                    return false;
+                }
+                node->terminal.store(Tag(NewLeaf(key, fn)), std::memory_order_relaxed);
+                Unlock(node);
+                return true;
+            }
+            uint8_t byte = key[depth];
+            auto child = FindChild(node, byte);
+            if (!Check(node, version)) {
+                return false;
+            }
+            if (child == 0) {
+                if (!IsFull(node)) {
+                    if (!Upgrade(node, version)) {
+                        return false;
+                    }
+                    AddChild(node, byte, Tag(NewLeaf(key, fn)));
+                    Unlock(node);
+                    return true;
+                }
+                if (!Upgrade(parent, parent_version)) {
+                    return false;
+                }
+                if (!Upgrade(node, version)) {
+                    Unlock(parent);
+                    return false;
+                }
+                auto grown = Copy(node, static_cast<Kind>(node->kind + 1), prefix);
+                AddChild(grown, byte, Tag(NewLeaf(key, fn)));
+                ReplaceChild(parent, parent_byte, Tag(grown));
+                Unlock(parent);
+                UnlockObsolete(node);
+                Retire(node);
+                return true;
+            }
+            if (IsLeaf(child)) {
+                auto leaf = AsLeaf(child);
+                if (leaf->key == key) {
+                    Update(leaf, fn);
+                    return true;
+                }
+                // two keys below byte: a Node4 holding the bytes they share after it
+                if (!Upgrade(node, version)) {
+                    return false;
+                }
+                auto start = depth + 1;
+                auto common = CommonPrefix(std::string_view(leaf->key).substr(start), key.substr(start));
+                auto split = NewNode(kNode4, key.substr(start, common));
+                Place(split, leaf, start + common);
+                Place(split, NewLeaf(key, fn), start + common);
+                ReplaceChild(node, byte, Tag(split));
+                Unlock(node);
+                return true;
+            }
+            parent = node;
+            parent_version = version;
+            parent_byte = byte;
+            node = AsNode(child);
+            if (!ReadLock(node, version) || !Check(parent, parent_version)) {
+                return false;
+            }
+            ++depth;
+        }
+    }
+
+    // walk_lock_ held for write, fn(leaf) in key order: a key ending at a node sorts before those going on
+    template <typename Fn>
+    static bool Walk(Node* node, Fn&& fn) {
+        auto terminal = node->terminal.load(std::memory_order_relaxed);
+        if (terminal != 0 && !fn(AsLeaf(terminal))) {
+            return false;
+        }
+        return ForEachChild(node, [&fn](uint8_t /* byte */, uintptr_t child) {
+            return IsLeaf(child) ? fn(AsLeaf(child)) : Walk(AsNode(child), fn);
+        });
+    }
+
+    static void Free(Node* node) {
+        if (auto terminal = node->terminal.load(std::memory_order_relaxed)) {
+            delete AsLeaf(terminal);
+        }
+        ForEachChild(node, [](uint8_t /* byte */, uintptr_t child) {
+            if (IsLeaf(child)) {
+                delete AsLeaf(child);
+            } else {
+                Free(AsNode(child));
+            }
+            return true;
+        });
+        DeleteNode(node);
+    }
+
+private:
+    Node* root_ = nullptr;
+    easykv::common::RWLock walk_lock_; // shared by writers, held for write by an ordered walk
+    std::atomic_size_t size_{0};
+    std::atomic_size_t binary_size_{0};
+    std::mutex last_key_mutex_;
+    std::string last_key_;
+    std::mutex retired_mutex_;
+    std::vector<Node*> retired_; // replaced nodes, readers may still pass through them
+};
+
+}
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <unistd.h>
+
+#include "easykv/lsm/format.hpp"
+#include "easykv/lsm/memtable.hpp"
+#include "easykv/lsm/sst.hpp"
+#include "easykv/utils/file.hpp"
+
+namespace easykv {
+namespace lsm {
+
+/*
+BlobFile in file
+|(key_size(8byte) | value_size(8byte) | key | value)...|
+a BlobIndex points at the value of one record, the key is only read back by gc to check liveness
+
+BlobFileMeta in file
+|id(8byte)|file_size(8byte)|total_count(8byte)|total_bytes(8byte)|garbage_count(8byte)|garbage_bytes(8byte)|
+*_bytes count value bytes, garbage grows as compaction drops entries pointing into the file
+*/
+
+// the file behind a BlobFileMeta, shared by the copies garbage accounting makes of the meta
+struct BlobFileHandle {
+    // set once the file left the newest version, runs when the last version holding a copy is released
+    std::function<void()> on_obsolete;
+
+    ~BlobFileHandle() {
+        if (on_obsolete) {
+            on_obsolete();
+        }
+    }
+};
+
+struct BlobFileMeta {
+    constexpr static const size_t binary_size = 6 * sizeof(size_t);
+    size_t id = 0;
+    size_t file_size = 0;
+    size_t total_count = 0;
+    size_t total_bytes = 0;
+    size_t garbage_count = 0;
+    size_t garbage_bytes = 0;
+    std::shared_ptr<BlobFileHandle> handle = std::make_shared<BlobFileHandle>();
+
+    double garbage_ratio() const {
+        return total_bytes == 0 ? 0 : static_cast<double>(garbage_bytes) / total_bytes;
+    }
+
+    size_t Save(char* s) const {
+        size_t index = 0;
+        for (auto field : {id, file_size, total_count, total_bytes, garbage_count, garbage_bytes}) {
+            *reinterpret_cast<size_t*>(s + index) = field;
+            index += sizeof(size_t);
+        }
+        return index;
+    }
+
+    size_t Load(const char* s) {
+        size_t index = 0;
+        for (auto field : {&id, &file_size, &total_count, &total_bytes, &garbage_count, &garbage_bytes}) {
+            *field = *reinterpret_cast<const size_t*>(s + index);
+            index += sizeof(size_t);
+        }
+        return index;
+    }
+};
+
+inline std::string BlobFileName(size_t id, const std::string& dir = "") {
+    return common::JoinPath(dir, std::to_string(id) + ".blob");
+}
+
+class BlobFileBuilder {
+public:
+    BlobFileBuilder(size_t id, const TableOptions& options)
+        : file_(options.use_direct_writes, write_buffer_size_, options.bytes_per_sync), dir_(options.db_path) {
+        file_.SetRateLimiter(options.rate_limiter.get(), options.write_priority);
+        meta_ = std::make_shared<BlobFileMeta>();
+        meta_->id = id;
+    }
+
+    bool Open(size_t expected_size = 0) {
+        ok_ = file_.Open(BlobFileName(meta_->id, dir_), expected_size);
+        return ok_;
+    }
+
+    BlobIndex Add(std::string_view key, std::string_view value) {
+        std::string header;
+        PutFixed64(header, key.size());
+        PutFixed64(header, value.size());
+        ok_ = ok_ && file_.Append(header) && file_.Append(key) && file_.Append(value);
+        BlobIndex index;
+        index.file_id = meta_->id;
+        index.offset = meta_->file_size + header.size() + key.size();
+        index.size = value.size();
+        meta_->file_size += header.size() + key.size() + value.size();
+        ++meta_->total_count;
+        meta_->total_bytes += value.size();
+        return index;
+    }
+
+    // synced like an sst, the manifest may reference it right after
+    bool Finish() {
+        ok_ = file_.Close() && ok_;
+        return ok_;
+    }
+
+    bool empty() const {
+        return meta_->total_count == 0;
+    }
+
+    std::shared_ptr<BlobFileMeta> meta() {
+        return meta_;
+    }
+
+private:
+    constexpr static const size_t write_buffer_size_ = 1024 * 1024;
+    common::WritableFile file_;
+    std::string dir_;
+    std::shared_ptr<BlobFileMeta> meta_;
+    bool ok_ = false;
+};
+
+class BlobFileReader {
+public:
+    bool Open(size_t id, common::ReadMode mode, const std::string& dir = "") {
+        id_ = id;
+        file_ = common::RandomAccessFile::New(mode);
+        return file_->Open(BlobFileName(id, dir));
+    }
+
+    bool Get(const BlobIndex& index, std::string& value) {
+        common::ReadRequest read(index.offset, index.size);
+        if (!Read(index, read)) {
+            return false;
+        }
+        value.assign(read.result);
+        return true;
+    }
+
+    // read.result points into the mapping (kMmap) or into read.buf, no copy is made
+    bool Read(const BlobIndex& index, common::ReadRequest& read) {
+        read.offset = index.offset;
+        read.size = index.size;
+        return index.file_id == id_ && file_->Read(read);
+    }
+
+    // F(key, BlobIndex, value) for every record, gc reads the file once from front to back
+    template <typename F>
+    bool ForEach(F&& f) {
+        common::ReadRequest read(0, file_->size());
+        if (!file_->Read(read)) {
+            return false;
+        }
+        const char* s = read.result.data();
+        size_t index = 0;
+        while (index + 2 * sizeof(size_t) <= read.result.size()) {
+            auto key_size = *reinterpret_cast<const size_t*>(s + index);
+            auto value_size = *reinterpret_cast<const size_t*>(s + index + sizeof(size_t));
+            index += 2 * sizeof(size_t);
+            if (index + key_size + value_size > read.result.size()) {
+                return false;
+            }
+            BlobIndex blob_index;
+            blob_index.file_id = id_;
+            blob_index.offset = index + key_size;
+            blob_index.size = value_size;
+            f(std::string_view(s + index, key_size), blob_index, std::string_view(s + index + key_size, value_size));
+            index += key_size + value_size;
+        }
+        return true;
+    }
+
+private:
+    size_t id_ = 0;
+    std::unique_ptr<common::RandomAccessFile> file_;
+};
+
+/*
+memtable flush with key-value separation: values of at least min_blob_size go to blob file blob_id,
+the sst keeps a BlobIndex in their place. blob_meta stays nullptr when no value was moved.
+the sst goes to path_id, blob files always live in db_path
+*/
+inline std::shared_ptr<SST> BuildTableWithBlobs(MemeTable& memtable, size_t id, size_t blob_id, size_t min_blob_size,
+        const TableOptions& options, std::shared_ptr<BlobFileMeta>& blob_meta, size_t path_id = 0) {
+    TableBuilder builder(SST::FileName(id, options.Path(path_id)), options);
+    builder.SetSeqRange(memtable.smallest_seq(), memtable.largest_seq());
+    BlobFileBuilder blob_builder(blob_id, options);
+    bool ok = builder.Open(memtable.binary_size()) && blob_builder.Open(memtable.binary_size());
+    if (ok) {
+        memtable.ForEach([&](std::string_view key, std::string_view value, ValueType type) {
+            if (type == kTypeValue && value.size() >= min_blob_size) {
+                builder.Add(key, blob_builder.Add(key, value).Encode(), kTypeBlobIndex);
+            } else {
+                builder.Add(key, value, type);
+            }
+            return true;
+        });
+    }
+    ok = blob_builder.Finish() && ok;
+    if (!ok || !builder.Finish()) {
+        std::cout << "write sst " << id << " with blob " << blob_id << " failed" << std::endl;
+        return nullptr;
+    }
+    if (blob_builder.empty()) {
+        unlink(BlobFileName(blob_id, options.db_path).c_str());
+    } else {
+        blob_meta = blob_builder.meta();
+    }
+    auto sst = std::make_shared<SST>();
+    sst->SetId(id);
+    sst->SetOptions(options);
+    sst->SetPathId(path_id);
+    if (!sst->Load()) {
+        return nullptr;
+    }
+    return sst;
+}
+
+}
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "easykv/cache/list.hpp"
+#include "easykv/lsm/memory_budget.hpp"
+
+namespace easykv {
+namespace lsm {
+
+struct DataBlock;
+
+/*
+BlockCache keeps parsed data blocks keyed by (sst id, block offset),
+capacity is in bytes and every block is charged what it really holds,
+shards have their own lru so a hot shard never blocks the others.
+with a MemoryBudget every block is charged to it too, an insert evicts from its shard
+while the budget is exceeded
+*/
+class BlockCache {
+    constexpr static const size_t shard_bits_ = 4;
+    constexpr static const size_t shard_num_ = 1 << shard_bits_;
+
+    struct Key {
+        size_t sst_id;
+        size_t offset;
+        bool operator == (const Key& rhs) const {
+            return sst_id == rhs.sst_id && offset == rhs.offset;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator () (const Key& key) const {
+            return (key.sst_id * 0x9e3779b97f4a7c15ull) ^ (key.offset * 0xc2b2ae3d27d4eb4full);
+        }
+    };
+
+    struct Entry {
+        Key key;
+        std::shared_ptr<DataBlock> block;
+        size_t charge = 0;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        cpputil::list::List<Entry> list;
+        std::unordered_map<Key, cpputil::list::Node<Entry>*, KeyHash> map;
+        size_t usage = 0;
+    };
+
+public:
+    explicit BlockCache(size_t capacity, std::shared_ptr<MemoryBudget> budget = nullptr)
+        : capacity_(capacity), budget_(std::move(budget)) {}
+
+    ~BlockCache() {
+        if (budget_) {
+            budget_->Release(MemoryConsumer::kBlockCache, usage_);
+        }
+    }
+
+    std::shared_ptr<DataBlock> Lookup(size_t sst_id, size_t offset) {
+        Key key{sst_id, offset};
+        auto& shard = GetShard(key);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) {
+            ++miss_cnt_;
+            return nullptr;
+        }
+        ++hit_cnt_;
+        shard.list.InsertFront(shard.list.Extract(it->second));
+        return it->second->value.block;
+    }
+
+    // a block larger than a shard is handed back uncached
+    void Insert(size_t sst_id, size_t offset, std::shared_ptr<DataBlock> block, size_t charge) {
+        Key key{sst_id, offset};
+        auto& shard = GetShard(key);
+        auto shard_capacity = capacity_ / shard_num_;
+        if (charge > shard_capacity) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it != shard.map.end()) {
+            Uncharge(shard, it->second->value.charge);
+            shard.list.Erase(it->second);
+            shard.map.erase(it);
+        }
+        while ((shard.usage + charge > shard_capacity || (budget_ && budget_->exceeded())) && shard.list.size() > 0) {
+            auto node = shard.list.PopBack();
+            Uncharge(shard, node->value.charge);
+            shard.map.erase(node->value.key);
+        }
+        Entry entry{key, std::move(block), charge};
+        shard.map[key] = shard.list.PushFront(std::move(entry));
+        shard.usage += charge;
+        usage_ += charge;
+        if (budget_) {
+            budget_->Reserve(MemoryConsumer::kBlockCache, charge);
+        }
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    size_t usage() const {
+        return usage_;
+    }
+
+    size_t hit_cnt() const {
+        return hit_cnt_;
+    }
+
+    size_t miss_cnt() const {
+        return miss_cnt_;
+    }
+
+private:
+    Shard& GetShard(const Key& key) {
+        return shards_[KeyHash()(key) >> (64 - shard_bits_)];
+    }
+
+    // shard.mutex held
+    void Uncharge(Shard& shard, size_t charge) {
+        shard.usage -= charge;
+        usage_ -= charge;
+        if (budget_) {
+            budget_->Release(MemoryConsumer::kBlockCache, charge);
+        }
+    }
+
+private:
+    size_t capacity_;
+    std::shared_ptr<MemoryBudget> budget_;
+    std::array<Shard, shard_num_> shards_;
+    std::atomic_size_t usage_{0};
+    std::atomic_size_t hit_cnt_{0};
+    std::atomic_size_t miss_cnt_{0};
+};
+
+}
+}
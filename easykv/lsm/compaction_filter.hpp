@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace easykv {
+namespace lsm {
+
+struct CompactionFilterContext {
+    size_t output_level = 0;
+    // nothing lies below the output, a removed key leaves no tombstone
+    bool bottommost = false;
+};
+
+/*
+CompactionFilter sees the newest value of every key a compaction writes and may keep, remove or rewrite it,
+so application garbage (expired leases, orphaned index entries) goes away without a delete through the write path.
+a removed key becomes a tombstone, older versions below stay shadowed.
+values kept in blob files, merge operand lists and tombstones are not passed to it, nor files moved down unchanged
+*/
+class CompactionFilter {
+public:
+    enum class Decision {
+        kKeep,
+        kRemove,
+        kChangeValue, // new_value replaces the value
+    };
+
+    virtual ~CompactionFilter() {}
+
+    // value is what Get returns, a ttl value keeps its expiry when changed
+    virtual Decision Filter(std::string_view key, std::string_view value, std::string& new_value) = 0;
+};
+
+// every compaction gets a filter of its own, state kept in a filter is never shared between compactions
+class CompactionFilterFactory {
+public:
+    virtual ~CompactionFilterFactory() {}
+    virtual std::unique_ptr<CompactionFilter> CreateCompactionFilter(const CompactionFilterContext& context) const = 0;
+};
+
+}
+}
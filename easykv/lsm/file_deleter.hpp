@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace easykv {
+namespace lsm {
+
+/*
+FileDeleter unlinks files no version references any more.
+with rate_bytes_per_sec a background thread deletes them one by one and sleeps size / rate after each,
+so the end of a large compaction does not hit the filesystem with one burst of unlinks.
+files still queued at destruction are deleted right away
+*/
+class FileDeleter {
+public:
+    explicit FileDeleter(size_t rate_bytes_per_sec = 0): rate_bytes_per_sec_(rate_bytes_per_sec) {
+        if (rate_bytes_per_sec_ > 0) {
+            thread_ = std::thread(&FileDeleter::Loop, this);
+        }
+    }
+
+    ~FileDeleter() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stop_ = true;
+            cv_.notify_all();
+        }
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        for (auto& name : queue_) {
+            Delete(name);
+        }
+    }
+
+    void Schedule(std::string name) {
+        if (rate_bytes_per_sec_ == 0) {
+            Delete(name);
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        queue_.emplace_back(std::move(name));
+        cv_.notify_all();
+    }
+
+    size_t pending() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return queue_.size();
+    }
+
+    size_t deleted_cnt() const {
+        return deleted_cnt_;
+    }
+
+    size_t deleted_bytes() const {
+        return deleted_bytes_;
+    }
+
+private:
+    void Loop() {
+        while (true) {
+            std::string name;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() {
+                    return stop_ || !queue_.empty();
+                });
+                if (stop_) {
+                    return;
+                }
+                name = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            auto size = Delete(name);
+            auto pause = std::chrono::microseconds(size * 1000000 / rate_bytes_per_sec_);
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait_for(lock, pause, [this]() {
+                return stop_;
+            });
+        }
+    }
+
+    size_t Delete(const std::string& name) {
+        struct stat stat_buf;
+        size_t size = stat(name.c_str(), &stat_buf) == 0 ? stat_buf.st_size : 0;
+        if (unlink(name.c_str()) == 0) {
+            ++deleted_cnt_;
+            deleted_bytes_ += size;
+        }
+        return size;
+    }
+
+private:
+    size_t rate_bytes_per_sec_;
+    std::deque<std::string> queue_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread thread_;
+    std::atomic_size_t deleted_cnt_{0};
+    std::atomic_size_t deleted_bytes_{0};
+};
+
+}
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace easykv {
+namespace lsm {
+
+/*
+entry type is kept in the high byte of value_size(8byte) of every sst entry,
+value_size & kValueSizeMask is the real size
+*/
+enum ValueType : uint8_t {
+    kTypeValue = 0,
+    kTypeDeletion = 1,
+    kTypeBlobIndex = 2, // value is an encoded BlobIndex
+    kTypeMerge = 3, // value is a list of merge operands, see merge_operator.hpp
+    kTypeValueWithTTL = 4, // value is followed by its expiry time, see AppendExpiry
+};
+
+constexpr static const size_t kValueTypeShift = 56;
+constexpr static const size_t kValueSizeMask = (size_t(1) << kValueTypeShift) - 1;
+
+inline size_t PackValueSize(size_t value_size, ValueType type) {
+    return value_size | (static_cast<size_t>(type) << kValueTypeShift);
+}
+
+inline ValueType UnpackValueType(size_t packed) {
+    return static_cast<ValueType>(packed >> kValueTypeShift);
+}
+
+inline size_t UnpackValueSize(size_t packed) {
+    return packed & kValueSizeMask;
+}
+
+inline void PutFixed64(std::string& dst, size_t value) {
+    dst.append(reinterpret_cast<const char*>(&value), sizeof(size_t));
+}
+
+/*
+a kTypeValueWithTTL value
+|value|expire_at(8byte)|
+expire_at is in microseconds since the epoch, an expired value reads as deleted
+*/
+constexpr static const size_t kExpirySize = sizeof(uint64_t);
+
+inline uint64_t NowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+inline void AppendExpiry(std::string& value, uint64_t expire_at) {
+    value.append(reinterpret_cast<const char*>(&expire_at), kExpirySize);
+}
+
+// 0 when value carries no expiry
+inline uint64_t DecodeExpiry(std::string_view value) {
+    if (value.size() < kExpirySize) {
+        return 0;
+    }
+    return *reinterpret_cast<const uint64_t*>(value.data() + value.size() - kExpirySize);
+}
+
+inline std::string_view StripExpiry(std::string_view value) {
+    return value.substr(0, value.size() < kExpirySize ? 0 : value.size() - kExpirySize);
+}
+
+inline bool Expired(std::string_view value, uint64_t now) {
+    auto expire_at = DecodeExpiry(value);
+    return expire_at != 0 && expire_at <= now;
+}
+
+/*
+BlobIndex in an entry value
+|file_id(8byte)|offset(8byte)|size(8byte)|
+offset/size locate the value inside the blob file
+*/
+struct BlobIndex {
+    constexpr static const size_t binary_size = 3 * sizeof(size_t);
+    size_t file_id = 0;
+    size_t offset = 0;
+    size_t size = 0;
+
+    std::string Encode() const {
+        std::string res;
+        res.reserve(binary_size);
+        PutFixed64(res, file_id);
+        PutFixed64(res, offset);
+        PutFixed64(res, size);
+        return res;
+    }
+
+    bool Decode(std::string_view s) {
+        if (s.size() != binary_size) {
+            return false;
+        }
+        file_id = *reinterpret_cast<const size_t*>(s.data());
+        offset = *reinterpret_cast<const size_t*>(s.data() + sizeof(size_t));
+        size = *reinterpret_cast<const size_t*>(s.data() + 2 * sizeof(size_t));
+        return true;
+    }
+
+    bool operator == (const BlobIndex& rhs) const {
+        return file_id == rhs.file_id && offset == rhs.offset && size == rhs.size;
+    }
+};
+
+}
+}
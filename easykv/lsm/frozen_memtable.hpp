@@ -0,0 +1,146 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "easykv/lsm/format.hpp"
+
+namespace easykv {
+namespace lsm {
+
+/*
+FrozenMemTable is the packed copy of an immutable memtable, built once and never changed, so it is read without locks.
+keys and values live in one arena, entries_ keeps them in key order for scans and the flush,
+eytzinger_ holds entry ids in bfs order of the implicit search tree (root at 1, children of k at 2k and 2k + 1):
+the top levels a Get walks share a few cache lines and the descent has no data dependent branch
+*/
+class FrozenMemTable {
+    struct Entry {
+        size_t offset = 0; // key, then value, in arena_
+        uint32_t key_size = 0;
+        uint32_t value_size = 0;
+        ValueType type = kTypeValue;
+    };
+
+public:
+    struct EntryRef {
+        std::string_view key;
+        std::string_view value;
+        ValueType type;
+    };
+
+    class Iterator {
+    public:
+        Iterator(const FrozenMemTable* table, size_t i): table_(table), i_(i) {}
+
+        Iterator& operator ++() {
+            ++i_;
+            return *this;
+        }
+
+        EntryRef operator *() const {
+            return table_->entry(i_);
+        }
+
+        bool operator ==(const Iterator& rhs) const {
+            return i_ == rhs.i_;
+        }
+
+        bool operator !=(const Iterator& rhs) const {
+            return i_ != rhs.i_;
+        }
+
+    private:
+        const FrozenMemTable* table_;
+        size_t i_;
+    };
+
+    // It yields entries in key order with .key .value .type
+    template <typename It>
+    FrozenMemTable(It begin, It end) {
+        for (auto it = begin; it != end; ++it) {
+            auto& node = *it;
+            entries_.push_back(Entry{arena_.size(), static_cast<uint32_t>(node.key.size()),
+                static_cast<uint32_t>(node.value.size()), node.type});
+            arena_.append(node.key);
+            arena_.append(node.value);
+        }
+        eytzinger_.resize(entries_.size() + 1);
+        uint32_t next = 0;
+        Layout(1, next);
+    }
+
+    bool Get(std::string_view key, std::string& value, ValueType& type) const {
+        auto i = Find(key);
+        if (i == entries_.size() || this->key(i) != key) {
+            return false;
+        }
+        value.assign(this->value(i));
+        type = entries_[i].type;
+        return true;
+    }
+
+    // index of the first entry with key >= target, size() when there is none
+    size_t Find(std::string_view target) const {
+        size_t k = 1;
+        while (k < eytzinger_.size()) {
+            k = 2 * k + (key(eytzinger_[k]) < target);
+        }
+        // the last left turn is the lower bound, the trailing ones are the right turns after it
+        k >>= __builtin_ffsll(~k);
+        return k == 0 ? entries_.size() : eytzinger_[k];
+    }
+
+    std::string_view key(size_t i) const {
+        return std::string_view(arena_.data() + entries_[i].offset, entries_[i].key_size);
+    }
+
+    std::string_view value(size_t i) const {
+        return std::string_view(arena_.data() + entries_[i].offset + entries_[i].key_size, entries_[i].value_size);
+    }
+
+    ValueType type(size_t i) const {
+        return entries_[i].type;
+    }
+
+    EntryRef entry(size_t i) const {
+        return EntryRef{key(i), value(i), type(i)};
+    }
+
+    Iterator begin() const {
+        return Iterator(this, 0);
+    }
+
+    Iterator end() const {
+        return Iterator(this, entries_.size());
+    }
+
+    size_t size() const {
+        return entries_.size();
+    }
+
+    size_t binary_size() const {
+        return arena_.size() + entries_.size() * sizeof(Entry) + eytzinger_.size() * sizeof(uint32_t);
+    }
+
+private:
+    // in-order walk of the implicit tree hands out entry ids in key order
+    void Layout(size_t k, uint32_t& next) {
+        if (k >= eytzinger_.size()) {
+            return;
+        }
+        Layout(2 * k, next);
+        eytzinger_[k] = next++;
+        Layout(2 * k + 1, next);
+    }
+
+private:
+    std::string arena_;
+    std::vector<Entry> entries_;
+    std::vector<uint32_t> eytzinger_; // eytzinger_[0] is unused
+};
+
+}
+}
@@ -0,0 +1,364 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "easykv/lsm/format.hpp"
+#include "easykv/lsm/memtable.hpp"
+#include "easykv/lsm/pinnable_value.hpp"
+#include "easykv/lsm/sst.hpp"
+#include "easykv/lsm/table_cache.hpp"
+#include "easykv/lsm/version_edit.hpp"
+
+namespace easykv {
+namespace lsm {
+
+class Manifest;
+
+/*
+InternalIterator walks one sorted source (memtable, sst, level, db) in key order,
+key/value stay valid until the next move. a merge of sources yields each key once,
+from the newest source that has it
+*/
+class InternalIterator {
+public:
+    virtual ~InternalIterator() {}
+    virtual bool Valid() = 0;
+    virtual void SeekToFirst() = 0;
+    // first entry with key >= target
+    virtual void Seek(std::string_view target) = 0;
+    virtual void Next() = 0;
+    virtual std::string_view key() = 0;
+    virtual std::string_view value() = 0;
+    virtual ValueType type() = 0;
+    // false once a value() handed out was not the real one (a blob or merge that could not be read) or a block
+    // read failed and entries were skipped, it stays false
+    virtual bool ok() {
+        return true;
+    }
+};
+
+// keys are fixed once a node is linked, values change in place and are read through Get.
+// a memtable frozen when the iterator is made is walked in its packed array instead
+class MemTableIterator : public InternalIterator {
+public:
+    explicit MemTableIterator(std::shared_ptr<MemeTable> memtable)
+        : memtable_(std::move(memtable)), it_(memtable_->NewIterator()) {}
+
+    bool Valid() override {
+        return it_->Valid();
+    }
+
+    void SeekToFirst() override {
+        Seek(std::string_view());
+    }
+
+    void Seek(std::string_view target) override {
+        it_->Seek(target);
+    }
+
+    void Next() override {
+        it_->Next();
+    }
+
+    std::string_view key() override {
+        return it_->key();
+    }
+
+    std::string_view value() override {
+        return it_->value();
+    }
+
+    ValueType type() override {
+        return it_->type();
+    }
+
+private:
+    std::shared_ptr<MemeTable> memtable_;
+    std::unique_ptr<MemTableRep::Iterator> it_;
+};
+
+class TableIterator : public InternalIterator {
+public:
+    explicit TableIterator(std::shared_ptr<SST> sst, bool fill_cache = true)
+        : sst_(std::move(sst)), it_(sst_.get(), false, fill_cache) {}
+
+    bool Valid() override {
+        return !!it_;
+    }
+
+    void SeekToFirst() override {
+        it_.Seek(std::string_view());
+    }
+
+    void Seek(std::string_view target) override {
+        it_.Seek(target);
+    }
+
+    void Next() override {
+        ++it_;
+    }
+
+    std::string_view key() override {
+        return (*it_).key;
+    }
+
+    std::string_view value() override {
+        return (*it_).value;
+    }
+
+    ValueType type() override {
+        return (*it_).type;
+    }
+
+    bool ok() override {
+        return it_.status_ok();
+    }
+
+private:
+    std::shared_ptr<SST> sst_;
+    SST::Iterator it_;
+};
+
+// files of a level > 0 are sorted and disjoint, only the current one is open
+class LevelIterator : public InternalIterator {
+public:
+    LevelIterator(std::vector<std::shared_ptr<FileMetaData> > files, std::shared_ptr<TableCache> table_cache)
+        : files_(std::move(files)), table_cache_(std::move(table_cache)) {}
+
+    bool Valid() override {
+        return it_ && it_->Valid();
+    }
+
+    void SeekToFirst() override {
+        OpenFile(0);
+        if (it_) {
+            it_->SeekToFirst();
+        }
+        SkipEmptyFiles();
+    }
+
+    void Seek(std::string_view target) override {
+        auto it = std::lower_bound(files_.begin(), files_.end(), target, [](const std::shared_ptr<FileMetaData>& meta, std::string_view key) {
+            return meta->largest() < key;
+        });
+        OpenFile(it - files_.begin());
+        if (it_) {
+            it_->Seek(target);
+        }
+        SkipEmptyFiles();
+    }
+
+    void Next() override {
+        it_->Next();
+        SkipEmptyFiles();
+    }
+
+    std::string_view key() override {
+        return it_->key();
+    }
+
+    std::string_view value() override {
+        return it_->value();
+    }
+
+    ValueType type() override {
+        return it_->type();
+    }
+
+    bool ok() override {
+        return ok_ && (!it_ || it_->ok());
+    }
+
+private:
+    void OpenFile(size_t i) {
+        file_index_ = i;
+        ok_ = ok_ && (!it_ || it_->ok()); // the file left behind may have been cut short
+        it_ = nullptr;
+        if (i >= files_.size()) {
+            return;
+        }
+        auto sst = table_cache_->Get(*files_[i]);
+        if (!sst) {
+            std::cout << "iterator open sst " << files_[i]->id << " failed" << std::endl;
+            ok_ = false;
+            return;
+        }
+        it_ = std::make_unique<TableIterator>(std::move(sst));
+    }
+
+    void SkipEmptyFiles() {
+        while (!Valid() && file_index_ + 1 < files_.size()) {
+            OpenFile(file_index_ + 1);
+            if (it_) {
+                it_->SeekToFirst();
+            }
+        }
+    }
+
+private:
+    std::vector<std::shared_ptr<FileMetaData> > files_;
+    std::shared_ptr<TableCache> table_cache_;
+    size_t file_index_ = 0;
+    std::unique_ptr<TableIterator> it_;
+    bool ok_ = true;
+};
+
+// children are ordered newest first, a key in several children is taken from the first one
+class MergingIterator : public InternalIterator {
+public:
+    explicit MergingIterator(std::vector<std::unique_ptr<InternalIterator> > children): children_(std::move(children)) {}
+
+    bool Valid() override {
+        return current_ != nullptr;
+    }
+
+    void SeekToFirst() override {
+        for (auto& child : children_) {
+            child->SeekToFirst();
+        }
+        FindSmallest();
+    }
+
+    void Seek(std::string_view target) override {
+        for (auto& child : children_) {
+            child->Seek(target);
+        }
+        FindSmallest();
+    }
+
+    void Next() override {
+        std::string key(current_->key());
+        for (auto& child : children_) {
+            if (child->Valid() && child->key() == key) {
+                child->Next();
+            }
+        }
+        FindSmallest();
+    }
+
+    std::string_view key() override {
+        return current_->key();
+    }
+
+    std::string_view value() override {
+        return current_->value();
+    }
+
+    ValueType type() override {
+        return current_->type();
+    }
+
+    bool ok() override {
+        return std::all_of(children_.begin(), children_.end(), [](const std::unique_ptr<InternalIterator>& child) {
+            return child->ok();
+        });
+    }
+
+private:
+    void FindSmallest() {
+        current_ = nullptr;
+        for (auto& child : children_) {
+            if (child->Valid() && (current_ == nullptr || child->key() < current_->key())) {
+                current_ = child.get();
+            }
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<InternalIterator> > children_;
+    InternalIterator* current_ = nullptr;
+};
+
+/*
+what a DB hands out: tombstones and expired values are skipped and blob values are read from their blob file.
+a merge entry is folded by resolve_merge, which reads the key's older entries as of the call.
+version is the one it was made from, its ssts and blob files stay on disk until the iterator is gone
+*/
+class DBIterator : public InternalIterator {
+public:
+    using ResolveMerge = std::function<bool(std::string_view key, PinnableValue& value)>;
+
+    DBIterator(std::unique_ptr<InternalIterator> it, std::shared_ptr<TableCache> table_cache, ResolveMerge resolve_merge = nullptr,
+            std::shared_ptr<Manifest> version = nullptr)
+        : it_(std::move(it)), table_cache_(std::move(table_cache)), resolve_merge_(std::move(resolve_merge)),
+          version_(std::move(version)) {}
+
+    bool Valid() override {
+        return it_->Valid();
+    }
+
+    void SeekToFirst() override {
+        it_->SeekToFirst();
+        SkipDeleted();
+    }
+
+    void Seek(std::string_view target) override {
+        it_->Seek(target);
+        SkipDeleted();
+    }
+
+    void Next() override {
+        it_->Next();
+        SkipDeleted();
+    }
+
+    std::string_view key() override {
+        return it_->key();
+    }
+
+    // a blob that can not be read or a merge that can not be folded is an empty value and clears ok()
+    std::string_view value() override {
+        if (it_->type() == kTypeMerge && resolve_merge_) {
+            if (!resolve_merge_(it_->key(), blob_value_)) {
+                blob_value_.Reset();
+                ok_ = false;
+            }
+            return blob_value_.view();
+        }
+        if (it_->type() == kTypeValueWithTTL) {
+            return StripExpiry(it_->value());
+        }
+        if (it_->type() != kTypeBlobIndex) {
+            return it_->value();
+        }
+        if (!table_cache_->ReadBlob(it_->value(), blob_value_)) {
+            blob_value_.Reset();
+            ok_ = false;
+        }
+        return blob_value_.view();
+    }
+
+    ValueType type() override {
+        return kTypeValue;
+    }
+
+    bool ok() override {
+        return ok_ && it_->ok();
+    }
+
+private:
+    void SkipDeleted() {
+        while (it_->Valid() && (it_->type() == kTypeDeletion ||
+                (it_->type() == kTypeValueWithTTL && Expired(it_->value(), NowMicros())))) {
+            it_->Next();
+        }
+    }
+
+private:
+    std::unique_ptr<InternalIterator> it_;
+    std::shared_ptr<TableCache> table_cache_;
+    ResolveMerge resolve_merge_;
+    std::shared_ptr<Manifest> version_;
+    PinnableValue blob_value_; // blob or merged value
+    bool ok_ = true;
+};
+
+}
+}
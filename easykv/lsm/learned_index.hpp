@@ -0,0 +1,269 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "easykv/lsm/format.hpp"
+
+namespace easykv {
+namespace lsm {
+
+/*
+LearnedIndex in file, after TableProperties in the properties block
+|skip(8byte)|error(8byte)|entry_count(8byte)|segment_cnt(8byte)|(x(8byte) + rank(8byte) + slope(8byte double))...|
+|block_cnt(8byte)|first_rank(8byte)...|
+
+a piecewise linear model of key -> rank of the entry in the sst. x of a key is the 8 bytes after the skip bytes
+every key shares, big endian. a segment predicts rank + slope * (x - segment x) for the keys from its x on,
+the prediction is within error of the rank for every key of the file
+*/
+class LearnedIndex {
+    struct Segment {
+        uint64_t x = 0;
+        uint64_t rank = 0;
+        double slope = 0;
+    };
+
+public:
+    // data is the model, smallest_key the first key of the sst (it holds the shared bytes). false if malformed
+    bool Load(std::string_view data, std::string_view smallest_key) {
+        segments_.clear();
+        first_ranks_.clear();
+        size_t index = 0;
+        auto get = [&data, &index](uint64_t& field) {
+            if (data.size() - index < sizeof(uint64_t)) {
+                return false;
+            }
+            memcpy(&field, data.data() + index, sizeof(uint64_t));
+            index += sizeof(uint64_t);
+            return true;
+        };
+        uint64_t skip, segment_cnt, block_cnt;
+        if (!get(skip) || !get(error_) || !get(entry_count_) || !get(segment_cnt) || skip > smallest_key.size()) {
+            return false;
+        }
+        shared_.assign(smallest_key.substr(0, skip));
+        for (uint64_t i = 0; i < segment_cnt; i++) {
+            Segment segment;
+            uint64_t slope;
+            if (!get(segment.x) || !get(segment.rank) || !get(slope)) {
+                return false;
+            }
+            memcpy(&segment.slope, &slope, sizeof(double));
+            segments_.push_back(segment);
+        }
+        if (!get(block_cnt) || block_cnt > (data.size() - index) / sizeof(uint64_t)) {
+            return false;
+        }
+        first_ranks_.resize(block_cnt);
+        for (auto& rank : first_ranks_) {
+            if (!get(rank)) {
+                return false;
+            }
+        }
+        return !segments_.empty() && !first_ranks_.empty() && first_ranks_[0] == 0;
+    }
+
+    bool empty() const {
+        return segments_.empty();
+    }
+
+    void Clear() {
+        segments_.clear();
+        first_ranks_.clear();
+    }
+
+    /*
+    [first, last] holds the rank of the first entry >= target when the model is right about target,
+    which it is for every key of the file
+    */
+    void Predict(std::string_view target, size_t& first, size_t& last) const {
+        auto head = target.substr(0, shared_.size());
+        if (head != shared_) {
+            first = last = head < shared_ ? 0 : entry_count_;
+            return;
+        }
+        auto rank = Predict(X(target, shared_.size()));
+        first = rank > error_ ? rank - error_ : 0;
+        last = std::min<size_t>(rank + error_ + 1, entry_count_);
+    }
+
+    // data block holding the entry of rank, the last one past the end
+    size_t BlockOf(size_t rank) const {
+        return std::upper_bound(first_ranks_.begin(), first_ranks_.end(), rank) - first_ranks_.begin() - 1;
+    }
+
+    size_t FirstRank(size_t block) const {
+        return first_ranks_[block];
+    }
+
+    size_t block_count() const {
+        return first_ranks_.size();
+    }
+
+    size_t binary_size() const {
+        return shared_.capacity() + segments_.capacity() * sizeof(Segment) + first_ranks_.capacity() * sizeof(uint64_t);
+    }
+
+    // 8 bytes of key after skip, zero padded
+    static uint64_t X(std::string_view key, size_t skip) {
+        uint64_t x = 0;
+        if (key.size() > skip) {
+            memcpy(&x, key.data() + skip, std::min<size_t>(key.size() - skip, sizeof(uint64_t)));
+        }
+        return __builtin_bswap64(x);
+    }
+
+private:
+    size_t Predict(uint64_t x) const {
+        auto it = std::upper_bound(segments_.begin(), segments_.end(), x, [](uint64_t x, const Segment& segment) {
+            return x < segment.x;
+        });
+        if (it == segments_.begin()) {
+            return 0;
+        }
+        --it;
+        auto rank = std::min(it->rank + it->slope * static_cast<double>(x - it->x), static_cast<double>(entry_count_ - 1));
+        return static_cast<size_t>(std::llround(rank));
+    }
+
+    friend class LearnedIndexBuilder;
+
+private:
+    std::string shared_;
+    uint64_t error_ = 0;
+    uint64_t entry_count_ = 0;
+    std::vector<Segment> segments_;
+    std::vector<uint64_t> first_ranks_; // rank of the first entry of each data block
+};
+
+/*
+LearnedIndexBuilder sees the keys of an sst in order. the bytes all keys share are only known at the end,
+so each key keeps the length it shares with the first key and the 8 bytes after: enough for its x at the end.
+segments are fit greedily, a segment takes keys while one slope keeps all of them within the error
+*/
+class LearnedIndexBuilder {
+    struct Point {
+        uint32_t shared = 0;
+        char tail[sizeof(uint64_t)] = {};
+    };
+
+public:
+    // the next key starts a data block
+    void StartBlock() {
+        first_ranks_.push_back(points_.size());
+    }
+
+    void Add(std::string_view key) {
+        if (points_.empty()) {
+            first_key_.assign(key);
+        }
+        Point point;
+        size_t n = std::min(first_key_.size(), key.size());
+        while (point.shared < n && first_key_[point.shared] == key[point.shared]) {
+            ++point.shared;
+        }
+        memcpy(point.tail, key.data() + point.shared, std::min<size_t>(key.size() - point.shared, sizeof(uint64_t)));
+        points_.push_back(point);
+    }
+
+    /*
+    the model, empty when none keeps every key within max_error of its rank. segments are fit to max_error - 1,
+    the rest is left for rounding the prediction, so max_error below 2 never builds one
+    */
+    std::string Finish(size_t max_error) {
+        if (points_.empty() || max_error < 2) {
+            return std::string();
+        }
+        // keys are in order, the last one shares the least with the first
+        size_t skip = points_.back().shared;
+        std::vector<uint64_t> xs;
+        xs.reserve(points_.size());
+        for (auto& point : points_) {
+            char bytes[sizeof(uint64_t) * 2];
+            size_t from_first = std::min<size_t>(point.shared - skip, sizeof(uint64_t));
+            memcpy(bytes, first_key_.data() + skip, from_first);
+            memcpy(bytes + from_first, point.tail, sizeof(uint64_t));
+            uint64_t x;
+            memcpy(&x, bytes, sizeof(uint64_t));
+            xs.push_back(__builtin_bswap64(x));
+        }
+
+        LearnedIndex model;
+        model.entry_count_ = xs.size();
+        Fit(xs, max_error - 1, model.segments_);
+        uint64_t error = 0;
+        for (size_t i = 0; i < xs.size(); i++) {
+            auto rank = model.Predict(xs[i]);
+            error = std::max<uint64_t>(error, rank > i ? rank - i : i - rank);
+        }
+        if (error > max_error) {
+            return std::string();
+        }
+        std::string data;
+        PutFixed64(data, skip);
+        PutFixed64(data, error);
+        PutFixed64(data, xs.size());
+        PutFixed64(data, model.segments_.size());
+        for (auto& segment : model.segments_) {
+            uint64_t slope;
+            memcpy(&slope, &segment.slope, sizeof(double));
+            PutFixed64(data, segment.x);
+            PutFixed64(data, segment.rank);
+            PutFixed64(data, slope);
+        }
+        PutFixed64(data, first_ranks_.size());
+        for (auto rank : first_ranks_) {
+            PutFixed64(data, rank);
+        }
+        return data;
+    }
+
+private:
+    // shrinking cone: the slopes keeping every point of the segment within error narrow down point by point
+    static void Fit(const std::vector<uint64_t>& xs, double error, std::vector<LearnedIndex::Segment>& segments) {
+        size_t start = 0;
+        double low = 0;
+        double high = std::numeric_limits<double>::infinity();
+        auto close = [&]() {
+            double slope = std::isinf(high) ? 0 : (low + high) / 2;
+            segments.push_back(LearnedIndex::Segment{xs[start], start, slope});
+        };
+        for (size_t i = 1; i < xs.size(); i++) {
+            double dy = i - start;
+            if (xs[i] == xs[start]) {
+                if (dy <= error) {
+                    continue;
+                }
+            } else {
+                double dx = static_cast<double>(xs[i] - xs[start]);
+                double l = std::max(low, (dy - error) / dx);
+                double h = std::min(high, (dy + error) / dx);
+                if (l <= h) {
+                    low = l;
+                    high = h;
+                    continue;
+                }
+            }
+            close();
+            start = i;
+            low = 0;
+            high = std::numeric_limits<double>::infinity();
+        }
+        close();
+    }
+
+private:
+    std::string first_key_;
+    std::vector<Point> points_;
+    std::vector<uint64_t> first_ranks_;
+};
+
+}
+}
@@ -3,23 +3,41 @@
 #include <algorithm>
 #include <atomic>
 #include <cstddef>
+#include <functional>
+#include <iterator>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <string>
 #include <string_view>
+#include <unordered_set>
 #include <vector>
 
+#include <unistd.h>
+
+#include "easykv/lsm/blob_file.hpp"
+#include "easykv/lsm/compaction_filter.hpp"
+#include "easykv/lsm/iterator.hpp"
 #include "easykv/lsm/skiplist.hpp"
 #include "easykv/lsm/sst.hpp"
 #include "easykv/lsm/memtable.hpp"
+#include "easykv/lsm/merge_operator.hpp"
+#include "easykv/lsm/prefix_index.hpp"
+#include "easykv/lsm/table_cache.hpp"
+#include "easykv/lsm/version_edit.hpp"
 
 namespace easykv {
 namespace lsm {
 
 /*
 ManiFest in file
-|version(size_t)|levels(size_t)|(id_0,id_1,-1)|(id_2,id_3,-1)|...
+|version(size_t)|last_sequence(size_t)|levels(size_t)|(FileMetaData_0,FileMetaData_1,-1)|(FileMetaData_2,-1)|...
+|blob_files(size_t)|BlobFileMeta...|
+
+ManiFest = snapshot("manifest") + VersionEdit log("manifest.log") replayed on open,
+levels are copy-on-write so installing an edit only copies the touched levels,
+ssts are opened lazily through the TableCache
 */
 
 class Manifest {
@@ -31,64 +49,112 @@ class Manifest {
 
         size_t Load(char* s, size_t& max_sst_id_) {
             size_t index = 0;
-            size_t sst_id;
             while (true) {
-                sst_id = *reinterpret_cast<size_t*>(s + index);
-                index += sizeof(size_t);
-                if (sst_id != -1) {
-                    auto sst_ptr = std::make_shared<SST>();
-                    std::cout << "level " << level_ << "add sst " << sst_id << std::endl;
-                    sst_ptr->SetId(sst_id);
-                    sst_ptr->Load();
-                    ssts_.emplace_back(sst_ptr);
-                    if (sst_id > max_sst_id_) {
-                        max_sst_id_ = sst_id;
-                    }
-                    // std::cout << "level " << level_ << " add sst " << sst_id << std::endl;
-                } else {
+                if (*reinterpret_cast<size_t*>(s + index) == size_t(-1)) {
+                    index += sizeof(size_t);
                     break;
                 }
+                auto meta = std::make_shared<FileMetaData>();
+                index += meta->Load(s + index);
+                if (meta->id > max_sst_id_) {
+                    max_sst_id_ = meta->id;
+                }
+                files_.emplace_back(std::move(meta));
             }
+            BuildSearchIndex();
             return index;
         }
 
         size_t Save(char* s) {
             size_t index = 0;
-            for (auto sst_ptr : ssts_) {
-                *reinterpret_cast<size_t*>(s + index) = sst_ptr->id();
-                index += sizeof(size_t);
+            for (auto& meta : files_) {
+                index += meta->Save(s + index);
             }
             *reinterpret_cast<size_t*>(s + index) = -1;
             index += sizeof(size_t);
             return index;
         }
 
-        bool Get(std::string_view key, std::string& value) {
+        bool Get(std::string_view key, PinnableValue& value, ValueType& type, TableCache& table_cache) {
             if (level_ == 0) {
-                for (auto it = ssts_.rbegin(); it != ssts_.rend(); ++it) {
-                    if ((*it)->Get(key, value)) {
+                for (auto it = files_.rbegin(); it != files_.rend(); ++it) {
+                    if (!(*it)->Overlap(key)) {
+                        continue;
+                    }
+                    auto sst_ptr = table_cache.Get(**it);
+                    if (sst_ptr && sst_ptr->Get(key, value, type)) {
                         return true;
                     }
                 }
             } else {
-                size_t l = 0, r = ssts_.size();
-                while (l < r) {
-                    size_t mid = (l + r) >> 1;
-                    if (ssts_[mid]->key() > key) {
-                        r = mid;
-                    } else {
-                        l = mid + 1;
+                auto r = search_index_.UpperBound(key);
+                if (r != 0 && files_[r - 1]->Overlap(key)) {
+                    auto sst_ptr = table_cache.Get(*files_[r - 1]);
+                    return sst_ptr && sst_ptr->Get(key, value, type);
+                }
+            }
+            return false;
+        }
+
+        // every entry of key in the level newest first, until fn returns false. false when fn stopped
+        template <typename Fn>
+        bool ForEach(std::string_view key, Fn& fn, TableCache& table_cache) {
+            auto visit = [&key, &fn, &table_cache](const FileMetaData& meta) {
+                auto sst_ptr = table_cache.Get(meta);
+                PinnableValue value;
+                ValueType type;
+                return !(sst_ptr && sst_ptr->Get(key, value, type)) || fn(value, type);
+            };
+            if (level_ == 0) {
+                for (auto it = files_.rbegin(); it != files_.rend(); ++it) {
+                    if ((*it)->Overlap(key) && !visit(**it)) {
+                        return false;
                     }
                 }
-                if (r != 0) {
-                    return ssts_[r - 1]->Get(key, value);
+                return true;
+            }
+            auto r = search_index_.UpperBound(key);
+            return r == 0 || !files_[r - 1]->Overlap(key) || visit(*files_[r - 1]);
+        }
+
+        void Insert(std::shared_ptr<FileMetaData> meta) {
+            files_.emplace_back(std::move(meta));
+        }
+
+        // level > 0 is ordered by key and has no overlap. BuildSearchIndex once the files are in place
+        void InsertOrdered(std::shared_ptr<FileMetaData> meta) {
+            auto it = std::upper_bound(files_.begin(), files_.end(), meta, [](const std::shared_ptr<FileMetaData>& lhs, const std::shared_ptr<FileMetaData>& rhs) {
+                return lhs->smallest() < rhs->smallest();
+            });
+            files_.insert(it, std::move(meta));
+        }
+
+        bool Delete(size_t id) {
+            for (auto it = files_.begin(); it != files_.end(); ++it) {
+                if ((*it)->id == id) {
+                    files_.erase(it);
+                    return true;
                 }
             }
             return false;
         }
 
-        void Insert(std::shared_ptr<SST> sst) {
-            ssts_.emplace_back(std::move(sst));
+        std::shared_ptr<FileMetaData> Find(size_t id) const {
+            for (auto& meta : files_) {
+                if (meta->id == id) {
+                    return meta;
+                }
+            }
+            return nullptr;
+        }
+
+        bool Contains(size_t id) const {
+            for (auto& meta : files_) {
+                if (meta->id == id) {
+                    return true;
+                }
+            }
+            return false;
         }
 
         size_t level() {
@@ -96,92 +162,227 @@ class Manifest {
         }
 
         size_t size() const {
-            return ssts_.size();
+            return files_.size();
         }
 
         size_t binary_size() {
             size_t res = 0;
-            for (auto& sst_ptr : ssts_) {
-                res += sst_ptr->binary_size();
+            for (auto& meta : files_) {
+                res += meta->file_size;
             }
             return res;
         }
 
-        std::vector<std::shared_ptr<SST> >& ssts() {
-            return ssts_;
+        // bytes this level takes in the manifest snapshot
+        size_t meta_binary_size() const {
+            size_t res = sizeof(size_t);
+            for (auto& meta : files_) {
+                res += meta->binary_size();
+            }
+            return res;
+        }
+
+        std::vector<std::shared_ptr<FileMetaData> >& files() {
+            return files_;
+        }
+
+        // smallest keys of a level > 0, rebuilt after its files change. level 0 files overlap and are all probed
+        void BuildSearchIndex() {
+            if (level_ == 0) {
+                return;
+            }
+            std::vector<std::string_view> keys;
+            keys.reserve(files_.size());
+            for (auto& meta : files_) {
+                keys.emplace_back(meta->smallest());
+            }
+            search_index_.Build(std::move(keys));
         }
 
     private:
         size_t level_;
-        std::vector<std::shared_ptr<SST> > ssts_;
+        std::vector<std::shared_ptr<FileMetaData> > files_;
+        PrefixIndex search_index_; // keys point into the FileMetaData of files_
     };
 public:
-    Manifest() {
-        auto fd = open(name_, O_RDWR);
+    Manifest(): Manifest(std::make_shared<TableCache>()) {}
+
+    explicit Manifest(std::shared_ptr<TableCache> table_cache): table_cache_(std::move(table_cache)) {
+        name_ = common::JoinPath(table_cache_->options().db_path, "manifest");
+        log_name_ = name_ + ".log";
+        auto fd = open(name_.c_str(), O_RDWR);
         if (fd != -1) {
             struct stat stat_buf;
-            stat(name_, &stat_buf);
+            stat(name_.c_str(), &stat_buf);
             auto file_size = stat_buf.st_size;
             auto data = (char*)mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
             size_t index = 0;
             version_ = *reinterpret_cast<size_t*>(data);
             index += sizeof(size_t);
+            last_sequence_ = *reinterpret_cast<size_t*>(data + index);
+            index += sizeof(size_t);
             auto size = *reinterpret_cast<size_t*>(data + index);
             index += sizeof(size_t);
             levels_.reserve(size);
             for (size_t i = 0; i < size; i++) {
-                Level level(i);
-                index += level.Load(data + index, max_sst_id_);
+                auto level = std::make_shared<Level>(i);
+                index += level->Load(data + index, max_sst_id_);
                 levels_.emplace_back(std::move(level));
             }
+            if (index + sizeof(size_t) <= static_cast<size_t>(file_size)) {
+                auto blob_cnt = *reinterpret_cast<size_t*>(data + index);
+                index += sizeof(size_t);
+                for (size_t i = 0; i < blob_cnt; i++) {
+                    auto meta = std::make_shared<BlobFileMeta>();
+                    index += meta->Load(data + index);
+                    max_sst_id_ = std::max(max_sst_id_, meta->id);
+                    blob_files_.emplace(meta->id, std::move(meta));
+                }
+            }
+            munmap(data, file_size);
             close(fd);
         } else {
             version_ = 1;
-            levels_.emplace_back(0);
+            levels_.emplace_back(std::make_shared<Level>(0));
         }
+        Recover();
     }
 
-    size_t Save() {
-        auto fd = open(name_, O_RDWR);
-        if (fd == -1) {
-            fd = open(name_, O_RDWR | O_CREAT, 0700);
-        }
-        // std::cout << "manifest save " << " fd " << fd << std::endl;
-        auto file_size = binary_size();
-        lseek(fd, file_size - 1, SEEK_SET);
-        write(fd, "1", 1);
-
-        auto data = (char*)mmap(NULL, file_size, PROT_WRITE, MAP_SHARED, fd, 0);
+    // snapshot is written aside and renamed, a crash never leaves a half written manifest
+    bool Save() {
+        std::string buf(binary_size(), '\0');
+        char* data = buf.data();
         size_t index = 0;
         *reinterpret_cast<size_t*>(data) = version_;
         index += sizeof(size_t);
+        *reinterpret_cast<size_t*>(data + index) = last_sequence_;
+        index += sizeof(size_t);
         *reinterpret_cast<size_t*>(data + index) = levels_.size();
         index += sizeof(size_t);
         for (auto& level : levels_) {
-            index += level.Save(data + index);
+            index += level->Save(data + index);
+        }
+        *reinterpret_cast<size_t*>(data + index) = blob_files_.size();
+        index += sizeof(size_t);
+        for (auto& [id, meta] : blob_files_) {
+            index += meta->Save(data + index);
+        }
+
+        auto tmp_name = std::string(name_) + ".tmp";
+        auto fd = open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0700);
+        if (fd == -1) {
+            return false;
+        }
+        size_t written = 0;
+        while (written < index) {
+            auto n = write(fd, data + written, index - written);
+            if (n <= 0) {
+                close(fd);
+                return false;
+            }
+            written += n;
         }
-        return index;
+        fsync(fd);
+        close(fd);
+        return rename(tmp_name.c_str(), name_.c_str()) == 0;
     }
 
     size_t binary_size() {
-        size_t res = 2 * sizeof(size_t);
+        size_t res = 3 * sizeof(size_t);
         for (auto& level : levels_) {
-            res += (level.size() + 1) * sizeof(size_t);
+            res += level->meta_binary_size();
         }
+        res += sizeof(size_t) + BlobFileMeta::binary_size * blob_files_.size();
         return res;
     }
 
     Manifest(const Manifest& manifest) {
         version_ = manifest.version_ + 1;
-        levels_ = manifest.levels_; // copy
+        levels_ = manifest.levels_; // copy level pointers only
+        max_sst_id_ = manifest.max_sst_id_;
+        last_sequence_ = manifest.last_sequence_;
+        table_cache_ = manifest.table_cache_;
+        blob_files_ = manifest.blob_files_;
+        name_ = manifest.name_;
+        log_name_ = manifest.log_name_;
     }
 
+    // blob values are read from their blob file, a tombstone or an expired value reads as not found
     bool Get(std::string_view key, std::string& value) {
+        PinnableValue pinned;
+        if (!Get(key, pinned)) {
+            return false;
+        }
+        value.assign(pinned.view());
+        return true;
+    }
+
+    bool Get(std::string_view key, PinnableValue& value) {
+        ValueType type;
+        if (!Get(key, value, type) || type == kTypeDeletion) {
+            return false;
+        }
+        if (type == kTypeBlobIndex) {
+            std::string blob_index(value.view());
+            return table_cache_->ReadBlob(blob_index, value);
+        }
+        if (type == kTypeValueWithTTL) {
+            if (Expired(value.view(), NowMicros())) {
+                return false;
+            }
+            value.RemoveSuffix(kExpirySize);
+        }
+        if (type == kTypeMerge && table_cache_->options().merge_operator) {
+            MergeContext context;
+            ForEachVersion(key, [this, &context](PinnableValue& entry, ValueType type) {
+                return AddToMerge(context, entry.view(), type);
+            });
+            if (!context.found() || !context.Finish(*table_cache_->options().merge_operator, key, value.GetSelf())) {
+                return false;
+            }
+            value.PinSelf();
+        }
+        return true;
+    }
+
+    // every entry of key newest first, fn(PinnableValue&, ValueType) returns false to stop
+    template <typename Fn>
+    void ForEachVersion(std::string_view key, Fn&& fn) {
+        for (size_t i = 0; i < levels_.size(); i++) {
+            if (!levels_[i]->ForEach(key, fn, *table_cache_)) {
+                return;
+            }
+        }
+    }
+
+    // a blob base is read before it joins the chain, false once the chain has ended
+    bool AddToMerge(MergeContext& context, std::string_view entry, ValueType type) {
+        if (type != kTypeBlobIndex) {
+            return context.Add(entry, type);
+        }
+        PinnableValue blob;
+        if (!table_cache_->ReadBlob(entry, blob)) {
+            blob.Reset();
+        }
+        return context.Add(blob.view(), kTypeValue);
+    }
+
+    bool Get(std::string_view key, std::string& value, ValueType& type) {
+        PinnableValue pinned;
+        if (!Get(key, pinned, type)) {
+            return false;
+        }
+        value.assign(pinned.view());
+        return true;
+    }
+
+    // the raw newest entry, a kTypeBlobIndex value is left encoded
+    bool Get(std::string_view key, PinnableValue& value, ValueType& type) {
         easykv::common::RWLock::ReadLock r_lock(memtable_rw_lock_);
         ++count_;
         for (size_t i = 0; i < levels_.size(); i++) {
             // std::cout << "Find in level " << i << std::endl;
-            if (levels_[i].Get(key, value)) {
+            if (levels_[i]->Get(key, value, type, *table_cache_)) {
                 return true;
             }
         }
@@ -190,24 +391,201 @@ public:
     }
 
     void Insert(std::shared_ptr<SST> sst) {
-        levels_.begin()->Insert(sst);
+        MutableLevel(0).Insert(table_cache_->Insert(std::move(sst)));
     }
 
     std::shared_ptr<Manifest> InsertAndUpdate(std::shared_ptr<SST> sst) {
-        if (sst->id() > max_sst_id_) {
-            max_sst_id_ = sst->id();
-        }
+        VersionEdit edit;
+        edit.AddFile(0, table_cache_->Insert(std::move(sst)));
         auto res = std::make_shared<Manifest>(*this);
-        res->Insert(sst);
+        res->Apply(edit);
         return res;
     }
+
+    // idempotent, so replaying edits already folded into the snapshot is harmless
+    void Apply(const VersionEdit& edit) {
+        std::unordered_set<size_t> moved; // deleted and added again by a trivial move, the file stays
+        for (auto& [level, meta] : edit.added_files()) {
+            moved.insert(meta->id);
+        }
+        std::unordered_set<size_t> changed; // levels whose search index is rebuilt once at the end
+        for (auto& [level, id] : edit.deleted_files()) {
+            if (level >= levels_.size()) {
+                continue;
+            }
+            auto meta = levels_[level]->Find(id);
+            if (meta) {
+                if (moved.count(id) == 0) {
+                    obsolete_.emplace_back(meta);
+                }
+                MutableLevel(level).Delete(id);
+                changed.insert(level);
+            }
+        }
+        for (auto& [level, meta] : edit.added_files()) {
+            while (levels_.size() <= level) {
+                levels_.emplace_back(std::make_shared<Level>(levels_.size()));
+            }
+            if (levels_[level]->Contains(meta->id)) {
+                continue;
+            }
+            if (level == 0) {
+                MutableLevel(level).Insert(meta);
+            } else {
+                MutableLevel(level).InsertOrdered(meta);
+                changed.insert(level);
+            }
+        }
+        for (auto level : changed) {
+            levels_[level]->BuildSearchIndex(); // made mutable above
+        }
+        for (auto& meta : edit.added_blob_files()) {
+            blob_files_.emplace(meta->id, meta);
+        }
+        for (auto& garbage : edit.blob_garbages()) {
+            auto it = blob_files_.find(garbage.id);
+            if (it == blob_files_.end()) {
+                continue; // already collected
+            }
+            auto meta = std::make_shared<BlobFileMeta>(*it->second); // shared with older versions
+            meta->garbage_count += garbage.count;
+            meta->garbage_bytes += garbage.bytes;
+            it->second = std::move(meta);
+        }
+        for (auto id : edit.deleted_blob_files()) {
+            auto it = blob_files_.find(id);
+            if (it != blob_files_.end()) {
+                obsolete_blobs_.emplace_back(it->second);
+                blob_files_.erase(it);
+            }
+        }
+        if (edit.next_file_id() > max_sst_id_) {
+            max_sst_id_ = edit.next_file_id();
+        }
+        if (edit.last_sequence() > last_sequence_) {
+            last_sequence_ = edit.last_sequence();
+        }
+    }
     
+    /*
+    ssts and blob files the applied edits dropped go to the deleter once no version holds them. called when this
+    version is installed, a version that is dropped instead (its edits were never logged) marks nothing
+    */
+    void ReleaseObsolete() {
+        for (auto& meta : obsolete_) {
+            table_cache_->MarkObsolete(*meta);
+        }
+        for (auto& meta : obsolete_blobs_) {
+            table_cache_->MarkObsolete(*meta);
+        }
+        obsolete_.clear();
+        obsolete_blobs_.clear();
+    }
+
     size_t max_sst_id() {
         return max_sst_id_;
     }
 
+    // newest seq already persisted in an sst
+    uint64_t last_sequence() const {
+        return last_sequence_;
+    }
+
+    const std::string& log_name() const {
+        return log_name_;
+    }
+
+    // largest key of any sst, false when there is none
+    bool LargestKey(std::string& key) const {
+        bool found = false;
+        for (auto& level : levels_) {
+            for (auto& meta : level->files()) {
+                if (!found || meta->largest() > key) {
+                    key = meta->largest();
+                    found = true;
+                }
+            }
+        }
+        return found;
+    }
+
+    // an sst past LargestKey shadows nothing, it may go straight to this level
+    size_t last_level() const {
+        return std::max<size_t>(levels_.size(), 2) - 1;
+    }
+
+    /*
+    deepest level an ingested file can go to: no level above holds its keys, so it stays the newest
+    version of them, and no file of the level overlaps it. level 0 when level 0 overlaps it
+    */
+    size_t IngestLevel(const FileMetaData& meta) const {
+        size_t res = 0;
+        for (size_t level = 0; level <= last_level(); level++) {
+            if (level < levels_.size()) {
+                auto& files = levels_[level]->files();
+                if (std::any_of(files.begin(), files.end(), [&meta](const std::shared_ptr<FileMetaData>& file) {
+                        return Overlap(meta, *file);
+                    })) {
+                    break;
+                }
+            }
+            res = level;
+        }
+        return res;
+    }
+
+    // ssts referenced by this version over all levels
+    size_t file_cnt() const {
+        size_t cnt = 0;
+        for (auto& level : levels_) {
+            cnt += level->size();
+        }
+        return cnt;
+    }
+
+    std::shared_ptr<TableCache> table_cache() {
+        return table_cache_;
+    }
+
+    const std::map<size_t, std::shared_ptr<BlobFileMeta> >& blob_files() const {
+        return blob_files_;
+    }
+
+    // level 0 files newest first, then one iterator per deeper level
+    void AddIterators(std::vector<std::unique_ptr<InternalIterator> >& iterators) {
+        auto& files = levels_[0]->files();
+        for (auto it = files.rbegin(); it != files.rend(); ++it) {
+            auto sst = table_cache_->Get(**it);
+            if (!sst) {
+                std::cout << "iterator open sst " << (*it)->id << " failed" << std::endl;
+                continue;
+            }
+            iterators.emplace_back(std::make_unique<TableIterator>(std::move(sst)));
+        }
+        for (size_t i = 1; i < levels_.size(); i++) {
+            if (!levels_[i]->files().empty()) {
+                iterators.emplace_back(std::make_unique<LevelIterator>(levels_[i]->files(), table_cache_));
+            }
+        }
+    }
+
+    // blob files worth rewriting, most garbage first
+    std::vector<std::shared_ptr<BlobFileMeta> > BlobGCCandidates(double garbage_ratio) const {
+        std::vector<std::shared_ptr<BlobFileMeta> > res;
+        for (auto& [id, meta] : blob_files_) {
+            if (meta->garbage_ratio() >= garbage_ratio) {
+                res.emplace_back(meta);
+            }
+        }
+        std::sort(res.begin(), res.end(), [](const std::shared_ptr<BlobFileMeta>& lhs, const std::shared_ptr<BlobFileMeta>& rhs) {
+            return lhs->garbage_ratio() > rhs->garbage_ratio();
+        });
+        return res;
+    }
+
     struct SizeTieredCompactionStruct {
-        SizeTieredCompactionStruct(SST& sst, size_t value): it(sst.begin()), second_value(value) {}
+        // inputs are read once, keep them out of the block cache
+        SizeTieredCompactionStruct(SST& sst, size_t value): it(&sst, false, false), second_value(value) {}
         bool operator < (const SizeTieredCompactionStruct& rhs) const {
             if ((*const_cast<SizeTieredCompactionStruct*>(this)->it).key == (*const_cast<SizeTieredCompactionStruct&>(rhs).it).key) {
                 return second_value > rhs.second_value;
@@ -218,103 +596,440 @@ public:
         size_t second_value;
     };
 
-    void SizeTieredCompaction(size_t level, int id) {
+    /*
+    files of level that overlap neither another input nor level + 1 are moved down by the edit alone.
+    the merged output spans the key range of the remaining inputs, a file inside that range is merged too,
+    so the output and the moved files stay disjoint in level + 1
+    */
+    std::vector<std::shared_ptr<FileMetaData> > TrivialMoves(size_t level) {
+        auto& files = levels_[level]->files();
+        auto path_id = table_cache_->options().PathId(level + 1);
+        std::vector<bool> movable(files.size(), false);
+        for (size_t i = 0; i < files.size(); i++) {
+            // a move across data directories would copy the file anyway
+            movable[i] = files[i]->path_id == path_id;
+            for (size_t j = 0; j < files.size() && movable[i]; j++) {
+                movable[i] = i == j || !Overlap(*files[i], *files[j]);
+            }
+            if (level + 1 < levels_.size()) {
+                for (auto& meta : levels_[level + 1]->files()) {
+                    movable[i] = movable[i] && !Overlap(*files[i], *meta);
+                }
+            }
+        }
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            std::string_view min_key;
+            std::string_view max_key;
+            bool merged = false;
+            auto extend = [&](const FileMetaData& meta) {
+                if (!merged || meta.smallest() < min_key) {
+                    min_key = meta.smallest();
+                }
+                if (!merged || meta.largest() > max_key) {
+                    max_key = meta.largest();
+                }
+                merged = true;
+            };
+            for (size_t i = 0; i < files.size(); i++) {
+                if (!movable[i]) {
+                    extend(*files[i]);
+                }
+            }
+            if (!merged) {
+                break;
+            }
+            if (level + 1 < levels_.size()) {
+                for (auto& meta : levels_[level + 1]->files()) {
+                    if (!(meta->largest() < min_key || meta->smallest() > max_key)) {
+                        extend(*meta);
+                    }
+                }
+            }
+            for (size_t i = 0; i < files.size(); i++) {
+                if (movable[i] && !(files[i]->largest() < min_key || files[i]->smallest() > max_key)) {
+                    movable[i] = false;
+                    changed = true;
+                }
+            }
+        }
+        std::vector<std::shared_ptr<FileMetaData> > res;
+        for (size_t i = 0; i < files.size(); i++) {
+            if (movable[i]) {
+                res.emplace_back(files[i]);
+            }
+        }
+        return res;
+    }
+
+    VersionEdit SizeTieredCompaction(size_t level, size_t id) {
+        auto moves = TrivialMoves(level);
+        auto is_moved = [&moves](const FileMetaData& meta) {
+            return std::any_of(moves.begin(), moves.end(), [&meta](const std::shared_ptr<FileMetaData>& moved) {
+                return moved->id == meta.id;
+            });
+        };
         std::priority_queue<SizeTieredCompactionStruct> queue;
         // std::priority_queue<SizeTieredCompactionStruct, 
         //     std::vector<SizeTieredCompactionStruct>, 
         //         std::greater<SizeTieredCompactionStruct> > queue; // 小根堆
+        std::vector<std::shared_ptr<SST> > inputs; // keep inputs open while merging
+        uint64_t smallest_seq = -1;
+        uint64_t largest_seq = 0;
+        auto add_seq_range = [&smallest_seq, &largest_seq](const FileMetaData& meta) {
+            smallest_seq = std::min(smallest_seq, meta.properties.smallest_seq);
+            largest_seq = std::max(largest_seq, meta.properties.largest_seq);
+        };
         size_t value = 0;
+        size_t input_size = 0;
         std::string_view min_key;
         std::string_view max_key;
-        for (auto it = levels_[level].ssts().rbegin(); it != levels_[level].ssts().rend(); ++it) {
-            SizeTieredCompactionStruct data(**it, value++);
+        for (auto it = levels_[level]->files().rbegin(); it != levels_[level]->files().rend(); ++it) {
+            if (is_moved(**it)) {
+                continue;
+            }
+            inputs.emplace_back(table_cache_->Get(**it));
+            if (!inputs.back()) {
+                std::cout << "compaction input " << (*it)->id << " open failed" << std::endl;
+                return VersionEdit(); // nothing is written yet, the next round retries
+            }
+            SizeTieredCompactionStruct data(*inputs.back(), value++);
+            if (!data.it.status_ok()) {
+                return VersionEdit();
+            }
             queue.push(std::move(data));
-            if (min_key.empty()) {
-                min_key = (*(*it)->begin()).key;
-            } else if ((*(*it)->begin()).key < min_key) {
-                min_key = (*(*it)->begin()).key;
+            add_seq_range(**it);
+            input_size += (*it)->file_size;
+            if (min_key.empty() || (*it)->smallest() < min_key) {
+                min_key = (*it)->smallest();
             }
-            // std::cout << (*(*it)->rbegin()).key << " " << (*(*it)->begin()).key << std::endl;
-            if (max_key.empty()) {
-                max_key = (*(*it)->rbegin()).key;
-            } else if ((*(*it)->rbegin()).key > max_key) {
-                max_key = (*(*it)->rbegin()).key;
+            if (max_key.empty() || (*it)->largest() > max_key) {
+                max_key = (*it)->largest();
             }
         }
         if (level + 1 == levels_.size()) {
-            levels_.emplace_back(Level(level + 1));
-        }
-        std::cout << min_key << " min max " << max_key << " " << levels_[level + 1].ssts().size() << std::endl;
-        int insert_l = -1, insert_r = levels_[level + 1].ssts().size();
-        for (auto i = 0; i < levels_[level + 1].ssts().size(); i++) {
-            auto& sst_ptr = levels_[level + 1].ssts()[i];
-        // for (auto it = levels_[level + 1].ssts().rbegin(); it != levels_[level + 1].ssts().rend(); ++it) {
-            if ((*(sst_ptr->rbegin())).key < min_key) {
-                insert_l = std::max(insert_l, i);
-            } else if ((*(sst_ptr->begin())).key > max_key) {
-                insert_r = std::min(insert_r, i);
-            } else {
-                SizeTieredCompactionStruct data(*sst_ptr, value++);
-                queue.push(std::move(data));
+            levels_.emplace_back(std::make_shared<Level>(level + 1));
+        }
+        VersionEdit edit;
+        for (auto& meta : moves) {
+            edit.DeleteFile(level, meta->id);
+            edit.AddFile(level + 1, meta);
+        }
+        if (inputs.empty()) {
+            Apply(edit); // append-only ingest, nothing is rewritten
+            return edit;
+        }
+        for (auto& meta : levels_[level + 1]->files()) {
+            // only overlapping files of the next level are opened
+            if (meta->largest() < min_key || meta->smallest() > max_key) {
+                continue;
+            }
+            inputs.emplace_back(table_cache_->Get(*meta));
+            if (!inputs.back()) {
+                std::cout << "compaction input " << meta->id << " open failed" << std::endl;
+                return VersionEdit();
+            }
+            SizeTieredCompactionStruct data(*inputs.back(), value++);
+            if (!data.it.status_ok()) {
+                return VersionEdit();
             }
+            queue.push(std::move(data));
+            add_seq_range(*meta);
+            input_size += meta->file_size;
+            edit.DeleteFile(level + 1, meta->id);
         }
-        std::cout << insert_l << " insert lr " << insert_r << " " << std::endl;
-        
 
-        std::vector<EntryView> entrys;
-        while (!queue.empty()) {
+        // nothing below the output can be shadowed, tombstones have done their job
+        bool drop_tombstones = NothingBelow(level + 1);
+        auto now = NowMicros();
+        auto filter = NewCompactionFilter(level + 1, drop_tombstones);
+        // the output is streamed to disk, the newest version of a key wins
+        auto& options = table_cache_->options();
+        auto path_id = options.PathId(level + 1);
+        TableBuilder builder(SST::FileName(id, options.Path(path_id)), options);
+        builder.SetSeqRange(smallest_seq, largest_seq);
+        bool ok = builder.Open(input_size);
+        std::string last_key;
+        bool has_last_key = false;
+        // merge operands of last_key are folded with the older entries below them, a chain that reaches
+        // nothing older stays a kTypeMerge entry unless nothing below the output can hold the key
+        MergeContext merge;
+        bool merging = false;
+        auto finish_merge = [&]() {
+            if (!merging) {
+                return;
+            }
+            merging = false;
+            std::string value;
+            if (merge.ended() || drop_tombstones) {
+                ValueType type;
+                ok = ok && merge.Finish(*options.merge_operator, last_key, value, &type);
+                if (ok) {
+                    AddFiltered(builder, filter.get(), last_key, value, type, now, drop_tombstones);
+                }
+            } else {
+                ok = ok && merge.Encode(*options.merge_operator, last_key, value);
+                if (ok) {
+                    builder.Add(last_key, value, kTypeMerge);
+                }
+            }
+        };
+        auto add_blob_garbage = [&edit](std::string_view value) {
+            BlobIndex blob_index;
+            if (blob_index.Decode(value)) {
+                edit.AddBlobGarbage(blob_index.file_id, blob_index.size);
+            }
+        };
+        while (ok && !queue.empty()) {
             auto data = queue.top();
             queue.pop();
-            if (entrys.empty() || entrys.back().key != (*data.it).key) {
-                // std::cout << "emplace " << (*data.it).key << " " << (*data.it).value << std::endl;
-                entrys.emplace_back((*data.it).key, (*data.it).value);
+            auto& entry = *data.it;
+            if (!has_last_key || last_key != entry.key) {
+                finish_merge();
+                last_key.assign(entry.key);
+                has_last_key = true;
+                if (entry.type == kTypeMerge && options.merge_operator) {
+                    merge.Clear();
+                    merge.Add(entry.value, kTypeMerge);
+                    merging = true;
+                } else {
+                    AddFiltered(builder, filter.get(), entry.key, entry.value, entry.type, now, drop_tombstones);
+                }
+            } else if (merging && !merge.ended()) {
+                if (entry.type == kTypeBlobIndex) {
+                    // the base is inlined into the merged value, its blob record becomes garbage
+                    PinnableValue blob;
+                    ok = table_cache_->ReadBlob(entry.value, blob);
+                    merge.Add(blob.view(), kTypeValue);
+                    add_blob_garbage(entry.value);
+                } else {
+                    merge.Add(entry.value, entry.type);
+                }
+            } else if (entry.type == kTypeBlobIndex) {
+                // a shadowed version is dropped, its blob value becomes garbage
+                add_blob_garbage(entry.value);
             }
             if (!(++data.it)) {
+                // an input cut short by a failed block read would lose its remaining keys
+                ok = ok && data.it.status_ok();
                 continue;
             } else {
-                queue.push(data);
+                queue.push(std::move(data));
             }
         }
+        finish_merge();
 
-        auto new_sst_ptr = std::make_shared<SST>(entrys, id);
-        if (id > max_sst_id_) {
-            max_sst_id_ = id;
+        auto new_sst_ptr = std::make_shared<SST>();
+        new_sst_ptr->SetId(id);
+        new_sst_ptr->SetOptions(options);
+        new_sst_ptr->SetPathId(path_id);
+        if (!ok || !builder.Finish() || !new_sst_ptr->Load()) {
+            std::cout << "compaction output " << id << " failed" << std::endl;
+            unlink(SST::FileName(id, options.Path(path_id)).c_str());
+            return VersionEdit(); // inputs stay live, garbage counted so far is dropped too
         }
-        
-        std::vector<std::shared_ptr<SST>> new_ssts;
-        for (int i = 0; i <= insert_l; i++) {
-            new_ssts.emplace_back(levels_[level + 1].ssts()[i]);
+        for (auto& meta : levels_[level]->files()) {
+            if (!is_moved(*meta)) {
+                edit.DeleteFile(level, meta->id);
+            }
         }
-        new_ssts.emplace_back(new_sst_ptr);
-        for (int i = insert_r; i < levels_[level + 1].ssts().size(); i++) {
-            new_ssts.emplace_back(levels_[level + 1].ssts()[i]);
+        if (builder.properties().entry_count > 0) {
+            edit.AddFile(level + 1, table_cache_->Insert(new_sst_ptr));
+        } else {
+            unlink(SST::FileName(id, options.Path(path_id)).c_str()); // every input key was deleted
         }
-        levels_[level].ssts().clear();
-        levels_[level + 1].ssts() = std::move(new_ssts);
+        Apply(edit);
+        return edit;
     }
 
-    void SizeTieredCompaction(int id) {
+    // every compacted level gets its own output id from new_id
+    std::vector<VersionEdit> SizeTieredCompaction(const std::function<size_t()>& new_id) {
+        std::vector<VersionEdit> edits;
         for (int i = 0; i < levels_.size() && i < max_level_size_; i++) {
-            if (levels_[i].binary_size() > level_max_binary_size_[i]) {
-                SizeTieredCompaction(i, id);
+            if (levels_[i]->binary_size() > level_max_binary_size_[i]) {
+                edits.emplace_back(SizeTieredCompaction(i, new_id()));
             } else {
                 break;
             }
         }
+        return edits;
+    }
+
+    std::vector<VersionEdit> SizeTieredCompaction(int id) {
+        size_t next_id = id;
+        return SizeTieredCompaction([&next_id]() {
+            return next_id++;
+        });
     }
 
     bool CanDoCompaction() {
-        return levels_[0].binary_size() > level_max_binary_size_[0];
+        return levels_[0]->binary_size() > level_max_binary_size_[0];
+    }
+
+    // bytes levels hold past their size limit
+    size_t CompactionDebt() {
+        size_t debt = 0;
+        for (size_t i = 0; i < levels_.size() && i < max_level_size_; i++) {
+            auto size = levels_[i]->binary_size();
+            debt += size > level_max_binary_size_[i] ? size - level_max_binary_size_[i] : 0;
+        }
+        return debt;
+    }
+
+    /*
+    ttl compaction: every sst holding a value expired by now is rewritten without it, so the space comes
+    back without deletes. level 0 is compacted into level 1, a deeper file is rewritten in place
+    */
+    std::vector<VersionEdit> ExpiryCompaction(uint64_t now, const std::function<size_t()>& new_id) {
+        auto expired = [now](const std::shared_ptr<FileMetaData>& meta) {
+            return meta->properties.earliest_expiry != 0 && meta->properties.earliest_expiry <= now;
+        };
+        std::vector<VersionEdit> edits;
+        auto& level0 = levels_[0]->files();
+        if (std::any_of(level0.begin(), level0.end(), expired)) {
+            edits.emplace_back(SizeTieredCompaction(0, new_id()));
+        }
+        for (size_t level = 1; level < levels_.size(); level++) {
+            std::vector<std::shared_ptr<FileMetaData> > files;
+            std::copy_if(levels_[level]->files().begin(), levels_[level]->files().end(), std::back_inserter(files), expired);
+            for (auto& meta : files) {
+                auto edit = RewriteExpired(level, *meta, new_id(), now);
+                if (!edit.deleted_files().empty()) {
+                    edits.emplace_back(std::move(edit));
+                }
+            }
+        }
+        return edits;
     }
+
+    /*
+    one file of level > 0 without its values expired by now. the output keeps the key and seq range
+    of the input, so the level stays disjoint and the file stays where it is
+    */
+    VersionEdit RewriteExpired(size_t level, const FileMetaData& meta, size_t id, uint64_t now) {
+        auto sst = table_cache_->Get(meta);
+        if (!sst) {
+            return VersionEdit();
+        }
+        bool drop_tombstones = NothingBelow(level);
+        auto filter = NewCompactionFilter(level, drop_tombstones);
+        auto& options = table_cache_->options();
+        TableBuilder builder(SST::FileName(id, options.Path(meta.path_id)), options);
+        builder.SetSeqRange(meta.properties.smallest_seq, meta.properties.largest_seq);
+        bool ok = builder.Open(meta.file_size);
+        SST::Iterator it(sst.get(), false, false);
+        for (; ok && !!it; ++it) {
+            auto& entry = *it;
+            AddFiltered(builder, filter.get(), entry.key, entry.value, entry.type, now, drop_tombstones);
+        }
+        ok = ok && it.status_ok();
+        auto new_sst_ptr = std::make_shared<SST>();
+        new_sst_ptr->SetId(id);
+        new_sst_ptr->SetOptions(options);
+        new_sst_ptr->SetPathId(meta.path_id);
+        if (!ok || !builder.Finish() || !new_sst_ptr->Load()) {
+            std::cout << "expiry compaction output " << id << " failed" << std::endl;
+            unlink(SST::FileName(id, options.Path(meta.path_id)).c_str());
+            return VersionEdit();
+        }
+        VersionEdit edit;
+        edit.DeleteFile(level, meta.id);
+        if (builder.properties().entry_count > 0) {
+            edit.AddFile(level, table_cache_->Insert(new_sst_ptr));
+        } else {
+            unlink(SST::FileName(id, options.Path(meta.path_id)).c_str());
+        }
+        Apply(edit);
+        return edit;
+    }
+private:
+    std::unique_ptr<CompactionFilter> NewCompactionFilter(size_t output_level, bool bottommost) {
+        auto& factory = table_cache_->options().compaction_filter_factory;
+        if (!factory) {
+            return nullptr;
+        }
+        CompactionFilterContext context;
+        context.output_level = output_level;
+        context.bottommost = bottommost;
+        return factory->CreateCompactionFilter(context);
+    }
+
+    /*
+    the newest entry of a key on its way into a compaction output. an expired value or one the filter
+    removes becomes a tombstone, so older versions below stay shadowed, and tombstones go once nothing is below
+    */
+    static void AddFiltered(TableBuilder& builder, CompactionFilter* filter, std::string_view key, std::string_view value,
+            ValueType type, uint64_t now, bool drop_tombstones) {
+        if (type == kTypeValueWithTTL && Expired(value, now)) {
+            type = kTypeDeletion;
+        } else if (filter && (type == kTypeValue || type == kTypeValueWithTTL)) {
+            std::string new_value;
+            auto decision = filter->Filter(key, type == kTypeValue ? value : StripExpiry(value), new_value);
+            if (decision == CompactionFilter::Decision::kRemove) {
+                type = kTypeDeletion;
+            } else if (decision == CompactionFilter::Decision::kChangeValue) {
+                if (type == kTypeValueWithTTL) {
+                    AppendExpiry(new_value, DecodeExpiry(value));
+                }
+                builder.Add(key, new_value, type);
+                return;
+            }
+        }
+        if (type == kTypeDeletion) {
+            if (!drop_tombstones) {
+                builder.Add(key, std::string_view(), kTypeDeletion);
+            }
+            return;
+        }
+        builder.Add(key, value, type);
+    }
+
+    // no level below level holds a file
+    bool NothingBelow(size_t level) const {
+        for (size_t i = level + 1; i < levels_.size(); i++) {
+            if (!levels_[i]->files().empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool Overlap(const FileMetaData& lhs, const FileMetaData& rhs) {
+        return !(lhs.largest() < rhs.smallest() || lhs.smallest() > rhs.largest());
+    }
+
+    Level& MutableLevel(size_t level) {
+        if (levels_[level].use_count() > 1) {
+            levels_[level] = std::make_shared<Level>(*levels_[level]);
+        }
+        return *levels_[level];
+    }
+
+    // replay edits appended after the last snapshot, no sst is opened here
+    void Recover() {
+        ManifestLog log(log_name_);
+        log.Replay([this](const VersionEdit& edit) {
+            Apply(edit);
+        });
+        ReleaseObsolete();
+    }
+
 private:
     constexpr static const size_t max_level_size_ = 5;
     constexpr static const size_t level_max_binary_size_[] = {1024, 10 * 1024 * 1024, 100 * 1024 * 1024, 1000 * 1024 * 1024, 10000ll * 1024 * 1024};
-    constexpr static const char* name_ = "manifest";
+    std::string name_;
+    std::string log_name_;
     std::atomic_size_t count_{0};
     size_t version_;
-    std::vector<Level> levels_;
+    std::vector<std::shared_ptr<Level> > levels_;
+    std::shared_ptr<TableCache> table_cache_;
+    std::map<size_t, std::shared_ptr<BlobFileMeta> > blob_files_;
+    std::vector<std::shared_ptr<FileMetaData> > obsolete_; // dropped by Apply, not marked until ReleaseObsolete
+    std::vector<std::shared_ptr<BlobFileMeta> > obsolete_blobs_;
     easykv::common::RWLock memtable_rw_lock_;
     size_t max_sst_id_ = 0;
+    uint64_t last_sequence_ = 0;
 };
 
 }
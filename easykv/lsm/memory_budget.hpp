@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace easykv {
+namespace lsm {
+
+enum class MemoryConsumer {
+    kMemTable = 0,
+    kImmutableMemTable = 1,
+    kBlockCache = 2,
+    kTableIndex = 3, // index and properties of every open sst
+    kCount = 4,
+};
+
+/*
+MemoryBudget is one byte budget shared by every consumer of one or more DBs,
+consumers Reserve what they hold and Release it when they drop it.
+memtables (mutable and immutable) may take write_buffer_ratio of the capacity before a flush is forced,
+the block cache gives back blocks while the whole budget is exceeded
+*/
+class MemoryBudget {
+public:
+    explicit MemoryBudget(size_t capacity, double write_buffer_ratio = 0.5)
+        : capacity_(capacity), write_buffer_limit_(static_cast<size_t>(capacity * write_buffer_ratio)) {}
+
+    void Reserve(MemoryConsumer consumer, size_t bytes) {
+        usages_[static_cast<size_t>(consumer)] += bytes;
+        usage_ += bytes;
+    }
+
+    void Release(MemoryConsumer consumer, size_t bytes) {
+        usages_[static_cast<size_t>(consumer)] -= bytes;
+        usage_ -= bytes;
+    }
+
+    // a memtable is handed over to the flush thread, its bytes are immutable from now on
+    void Freeze(size_t mutable_bytes, size_t immutable_bytes) {
+        Release(MemoryConsumer::kMemTable, mutable_bytes);
+        Reserve(MemoryConsumer::kImmutableMemTable, immutable_bytes);
+    }
+
+    // the mutable memtables are switched when they pass 7/8 of the write buffer share,
+    // or half of it once the whole budget is gone
+    bool ShouldFlush() const {
+        auto mutable_usage = usage(MemoryConsumer::kMemTable);
+        if (mutable_usage > write_buffer_limit_ / 8 * 7) {
+            return true;
+        }
+        return exceeded() && mutable_usage >= write_buffer_limit_ / 2;
+    }
+
+    bool exceeded() const {
+        return usage_ > capacity_;
+    }
+
+    size_t usage(MemoryConsumer consumer) const {
+        return usages_[static_cast<size_t>(consumer)];
+    }
+
+    size_t usage() const {
+        return usage_;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    size_t write_buffer_limit() const {
+        return write_buffer_limit_;
+    }
+
+private:
+    size_t capacity_;
+    size_t write_buffer_limit_;
+    std::array<std::atomic_size_t, static_cast<size_t>(MemoryConsumer::kCount)> usages_{};
+    std::atomic_size_t usage_{0};
+};
+
+}
+}
@@ -1,43 +1,161 @@
 #pragma once
-#include "easykv/lsm/skiplist.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "easykv/lsm/art_rep.hpp"
+#include "easykv/lsm/frozen_memtable.hpp"
+#include "easykv/lsm/memory_budget.hpp"
+#include "easykv/lsm/memtable_rep.hpp"
 
 namespace easykv {
 namespace lsm {
 
+inline std::unique_ptr<MemTableRep> NewMemTableRep(MemTableRepType type, size_t hash_bucket_count = 1 << 14) {
+    switch (type) {
+    case MemTableRepType::kHashLinkList:
+        return std::make_unique<HashLinkListRep>(hash_bucket_count);
+    case MemTableRepType::kVector:
+        return std::make_unique<VectorRep>();
+    case MemTableRepType::kArt:
+        return std::make_unique<ArtRep>();
+    default:
+        return std::make_unique<SkipListRep>();
+    }
+}
+
+/*
+a memtable is written through its MemTableRep until it becomes immutable. Freeze then packs it into a
+FrozenMemTable, which serves Get, scans and the flush from then on. the rep is kept for iterators
+opened before, so a frozen memtable holds its entries twice until it is flushed
+*/
 class MemeTable {
 public:
-    using Iterator = ConcurrentSkipList::Iterator;
+    explicit MemeTable(MemTableRepType rep_type = MemTableRepType::kSkipList, size_t hash_bucket_count = 1 << 14)
+        : rep_(NewMemTableRep(rep_type, hash_bucket_count)) {}
 
     bool Get(std::string_view key, std::string& value) {
-        return skip_list_.Get(key, value);
+        ValueType type;
+        return Get(key, value, type);
+    }
+
+    bool Get(std::string_view key, std::string& value, ValueType& type) {
+        if (auto frozen = frozen_table()) {
+            return frozen->Get(key, value, type);
+        }
+        return rep_->Get(key, value, type);
     }
 
-    void Put(std::string_view key, std::string_view value) {
-        skip_list_.Put(key, value);
+    // no write may follow, the memtable is immutable. the packed copy is charged to budget until ReleaseFrozen
+    void Freeze(MemoryBudget* budget = nullptr) {
+        std::lock_guard<std::mutex> lock(freeze_mutex_);
+        if (frozen_table() || released_) {
+            return;
+        }
+        auto frozen = rep_->Snapshot();
+        if (budget) {
+            frozen_charge_ = frozen->binary_size();
+            budget->Reserve(MemoryConsumer::kImmutableMemTable, frozen_charge_);
+        }
+        std::atomic_store(&frozen_, std::move(frozen));
     }
 
-    void Delete(std::string_view key) {
-        skip_list_.Delete(key);
+    // the memtable is flushed: its packed copy leaves budget, a Freeze still queued packs nothing
+    void ReleaseFrozen(MemoryBudget* budget) {
+        std::lock_guard<std::mutex> lock(freeze_mutex_);
+        released_ = true;
+        if (budget) {
+            budget->Release(MemoryConsumer::kImmutableMemTable, frozen_charge_);
+        }
+        frozen_charge_ = 0;
     }
-    
+
+    // nullptr until Freeze
+    std::shared_ptr<const FrozenMemTable> frozen_table() const {
+        return std::atomic_load(&frozen_);
+    }
+
+    void Put(std::string_view key, std::string_view value, uint64_t seq = 0, ValueType type = kTypeValue) {
+        rep_->Put(key, value, type);
+        UpdateSeq(seq);
+    }
+
+    // fn(found, value, type) rewrites the entry of key in place, see MemTableRep::Upsert
+    void Upsert(std::string_view key, uint64_t seq, const MemTableRep::UpsertFn& fn) {
+        rep_->Upsert(key, fn);
+        UpdateSeq(seq);
+    }
+
+    bool LastKey(std::string& key) {
+        if (auto frozen = frozen_table()) {
+            if (frozen->size() == 0) {
+                return false;
+            }
+            key = frozen->key(frozen->size() - 1);
+            return true;
+        }
+        return rep_->LastKey(key);
+    }
+
+    // fn(key, value, type) for every entry in key order, linear over the packed array once frozen
+    void ForEach(const MemTableRep::ForEachFn& fn) {
+        if (auto frozen = frozen_table()) {
+            for (auto it = frozen->begin(); it != frozen->end(); ++it) {
+                auto entry = *it;
+                if (!fn(entry.key, entry.value, entry.type)) {
+                    return;
+                }
+            }
+            return;
+        }
+        rep_->ForEach(fn);
+    }
+
+    // unpositioned, Seek first
+    std::unique_ptr<MemTableRep::Iterator> NewIterator() {
+        if (auto frozen = frozen_table()) {
+            return std::make_unique<FrozenMemTableIterator>(std::move(frozen));
+        }
+        return rep_->NewIterator();
+    }
+
     size_t binary_size() {
-        return skip_list_.binary_size();
+        return rep_->binary_size();
     }
 
     size_t size() {
-        return skip_list_.size();
+        return rep_->size();
     }
 
-    Iterator begin() {
-        return skip_list_.begin();
+    // seq range of the writes absorbed, becomes the seq range of the flushed sst
+    uint64_t smallest_seq() const {
+        return smallest_seq_;
     }
 
-    Iterator end() {
-        return skip_list_.end();
+    uint64_t largest_seq() const {
+        return largest_seq_;
+    }
+private:
+    void UpdateSeq(uint64_t seq) {
+        if (seq == 0) {
+            return;
+        }
+        uint64_t expected = 0;
+        smallest_seq_.compare_exchange_strong(expected, seq);
+        expected = smallest_seq_;
+        while (seq < expected && !smallest_seq_.compare_exchange_weak(expected, seq)) {}
+        expected = largest_seq_;
+        while (seq > expected && !largest_seq_.compare_exchange_weak(expected, seq)) {}
     }
 private:
-    ConcurrentSkipList skip_list_;
-    bool lock_ = false;
+    std::unique_ptr<MemTableRep> rep_;
+    std::shared_ptr<const FrozenMemTable> frozen_; // std::atomic_load/atomic_store only
+    std::mutex freeze_mutex_;
+    size_t frozen_charge_ = 0; // freeze_mutex_
+    bool released_ = false; // freeze_mutex_
+    std::atomic_uint64_t smallest_seq_{0};
+    std::atomic_uint64_t largest_seq_{0};
 };
 
 }
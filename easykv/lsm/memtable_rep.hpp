@@ -0,0 +1,456 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "easykv/lsm/format.hpp"
+#include "easykv/lsm/frozen_memtable.hpp"
+#include "easykv/lsm/skiplist.hpp"
+#include "easykv/utils/lock.hpp"
+
+namespace easykv {
+namespace lsm {
+
+enum class MemTableRepType {
+    kSkipList,
+    kHashLinkList,
+    kVector,
+    kArt,
+};
+
+/*
+MemTableRep keeps the entries of a memtable, one per key. the skiplist is sorted all the time,
+the others only sort when they are scanned or flushed and are cheaper to write into:
+a hash of sorted linked lists serves point Gets in O(1), a vector takes bulk loads append only.
+ArtRep (art_rep.hpp) stays sorted too and suits long keys sharing long prefixes
+*/
+class MemTableRep {
+public:
+    // fn(found, value, type) rewrites the entry of key in place or fills a new one (found false, value empty)
+    using UpsertFn = std::function<void(bool, std::string&, ValueType&)>;
+    // fn(key, value, type) returns false to stop
+    using ForEachFn = std::function<bool(std::string_view, std::string_view, ValueType)>;
+
+    // walks the entries in key order, key() and value() stay valid until the next Seek/Next
+    class Iterator {
+    public:
+        virtual ~Iterator() {}
+        virtual bool Valid() = 0;
+        virtual void Seek(std::string_view target) = 0;
+        virtual void Next() = 0;
+        virtual std::string_view key() = 0;
+        virtual std::string_view value() = 0;
+        virtual ValueType type() = 0;
+    };
+
+    virtual ~MemTableRep() {}
+
+    virtual bool Get(std::string_view key, std::string& value, ValueType& type) = 0;
+
+    virtual void Upsert(std::string_view key, const UpsertFn& fn) = 0;
+
+    virtual void Put(std::string_view key, std::string_view value, ValueType type) {
+        Upsert(key, [value, type](bool /* found */, std::string& entry_value, ValueType& entry_type) {
+            entry_value.assign(value);
+            entry_type = type;
+        });
+    }
+
+    // largest key, false when empty
+    virtual bool LastKey(std::string& key) = 0;
+
+    // the entries as of now in key order, packed for lock free reads
+    virtual std::shared_ptr<const FrozenMemTable> Snapshot() = 0;
+
+    // a rep not sorted all the time walks a snapshot
+    virtual void ForEach(const ForEachFn& fn);
+
+    virtual std::unique_ptr<Iterator> NewIterator();
+
+    virtual size_t size() = 0;
+
+    virtual size_t binary_size() = 0;
+};
+
+class FrozenMemTableIterator : public MemTableRep::Iterator {
+public:
+    explicit FrozenMemTableIterator(std::shared_ptr<const FrozenMemTable> table): table_(std::move(table)) {}
+
+    bool Valid() override {
+        return index_ < table_->size();
+    }
+
+    void Seek(std::string_view target) override {
+        index_ = table_->Find(target);
+    }
+
+    void Next() override {
+        ++index_;
+    }
+
+    std::string_view key() override {
+        return table_->key(index_);
+    }
+
+    std::string_view value() override {
+        return table_->value(index_);
+    }
+
+    ValueType type() override {
+        return table_->type(index_);
+    }
+
+private:
+    std::shared_ptr<const FrozenMemTable> table_;
+    size_t index_ = 0;
+};
+
+inline void MemTableRep::ForEach(const ForEachFn& fn) {
+    auto snapshot = Snapshot();
+    for (auto it = snapshot->begin(); it != snapshot->end(); ++it) {
+        auto entry = *it;
+        if (!fn(entry.key, entry.value, entry.type)) {
+            return;
+        }
+    }
+}
+
+inline std::unique_ptr<MemTableRep::Iterator> MemTableRep::NewIterator() {
+    return std::make_unique<FrozenMemTableIterator>(Snapshot());
+}
+
+class SkipListRep : public MemTableRep {
+public:
+    // nodes are walked without a copy of the table, values are copied under the node lock as they are reached
+    class Iterator : public MemTableRep::Iterator {
+    public:
+        explicit Iterator(ConcurrentSkipList* skip_list): skip_list_(skip_list) {}
+
+        bool Valid() override {
+            return node_ != nullptr;
+        }
+
+        void Seek(std::string_view target) override {
+            node_ = skip_list_->Seek(target);
+            Load();
+        }
+
+        void Next() override {
+            node_ = skip_list_->Next(node_);
+            Load();
+        }
+
+        std::string_view key() override {
+            return key_;
+        }
+
+        std::string_view value() override {
+            return value_;
+        }
+
+        ValueType type() override {
+            return type_;
+        }
+
+    private:
+        void Load() {
+            if (node_ == nullptr) {
+                return;
+            }
+            key_ = node_->key;
+            skip_list_->Get(key_, value_, type_);
+        }
+
+    private:
+        ConcurrentSkipList* skip_list_;
+        Node* node_ = nullptr;
+        std::string key_;
+        std::string value_;
+        ValueType type_ = kTypeValue;
+    };
+
+    bool Get(std::string_view key, std::string& value, ValueType& type) override {
+        return skip_list_.Get(key, value, type);
+    }
+
+    void Upsert(std::string_view key, const UpsertFn& fn) override {
+        skip_list_.Upsert(key, fn);
+    }
+
+    void Put(std::string_view key, std::string_view value, ValueType type) override {
+        skip_list_.Put(key, value, type);
+    }
+
+    bool LastKey(std::string& key) override {
+        return skip_list_.LastKey(key);
+    }
+
+    std::shared_ptr<const FrozenMemTable> Snapshot() override {
+        return std::make_shared<FrozenMemTable>(skip_list_.begin(), skip_list_.end());
+    }
+
+    void ForEach(const ForEachFn& fn) override {
+        for (auto it = skip_list_.begin(); it != skip_list_.end(); ++it) {
+            auto& node = *it;
+            if (!fn(std::string_view(node.key), std::string_view(node.value), node.type)) {
+                return;
+            }
+        }
+    }
+
+    std::unique_ptr<MemTableRep::Iterator> NewIterator() override {
+        return std::make_unique<Iterator>(&skip_list_);
+    }
+
+    size_t size() override {
+        return skip_list_.size();
+    }
+
+    size_t binary_size() override {
+        return skip_list_.binary_size();
+    }
+
+private:
+    ConcurrentSkipList skip_list_;
+};
+
+// an entry of the reps that sort late, owned copies so a snapshot outlives writes in place
+struct MemTableEntry {
+    std::string key;
+    std::string value;
+    ValueType type = kTypeValue;
+};
+
+/*
+HashLinkListRep hashes keys into a fixed number of buckets, each a sorted linked list under a lock of its own,
+so writers of different buckets never meet and a Get reads one short list. key order is only
+established by Snapshot, which copies every bucket and sorts
+*/
+class HashLinkListRep : public MemTableRep {
+    struct ListNode {
+        MemTableEntry entry;
+        ListNode* next = nullptr;
+    };
+
+    struct Bucket {
+        easykv::common::RWLock lock;
+        ListNode* head = nullptr;
+    };
+
+public:
+    explicit HashLinkListRep(size_t bucket_count = 1 << 14)
+        : bucket_count_(std::max<size_t>(bucket_count, 1)), buckets_(new Bucket[bucket_count_]) {}
+
+    ~HashLinkListRep() override {
+        for (size_t i = 0; i < bucket_count_; i++) {
+            for (auto p = buckets_[i].head; p != nullptr;) {
+                auto next = p->next;
+                delete p;
+                p = next;
+            }
+        }
+    }
+
+    bool Get(std::string_view key, std::string& value, ValueType& type) override {
+        auto& bucket = GetBucket(key);
+        easykv::common::RWLock::ReadLock lock(bucket.lock);
+        auto p = bucket.head;
+        while (p != nullptr && p->entry.key < key) {
+            p = p->next;
+        }
+        if (p == nullptr || p->entry.key != key) {
+            return false;
+        }
+        value = p->entry.value;
+        type = p->entry.type;
+        return true;
+    }
+
+    void Upsert(std::string_view key, const UpsertFn& fn) override {
+        auto& bucket = GetBucket(key);
+        easykv::common::RWLock::WriteLock lock(bucket.lock);
+        auto link = &bucket.head;
+        while (*link != nullptr && (*link)->entry.key < key) {
+            link = &(*link)->next;
+        }
+        if (*link != nullptr && (*link)->entry.key == key) {
+            auto& entry = (*link)->entry;
+            binary_size_ -= entry.value.size();
+            fn(true, entry.value, entry.type);
+            binary_size_ += entry.value.size();
+            return;
+        }
+        auto node = new ListNode();
+        node->entry.key.assign(key);
+        fn(false, node->entry.value, node->entry.type);
+        node->next = *link;
+        *link = node;
+        ++size_;
+        binary_size_ += key.size() + node->entry.value.size();
+        std::unique_lock<std::mutex> last_lock(last_key_mutex_);
+        if (size_ == 1 || last_key_ < key) {
+            last_key_.assign(key);
+        }
+    }
+
+    bool LastKey(std::string& key) override {
+        std::unique_lock<std::mutex> lock(last_key_mutex_);
+        if (size_ == 0) {
+            return false;
+        }
+        key = last_key_;
+        return true;
+    }
+
+    std::shared_ptr<const FrozenMemTable> Snapshot() override {
+        std::vector<MemTableEntry> entries;
+        entries.reserve(size_);
+        for (size_t i = 0; i < bucket_count_; i++) {
+            easykv::common::RWLock::ReadLock lock(buckets_[i].lock);
+            for (auto p = buckets_[i].head; p != nullptr; p = p->next) {
+                entries.push_back(p->entry);
+            }
+        }
+        std::sort(entries.begin(), entries.end(), [](const MemTableEntry& lhs, const MemTableEntry& rhs) {
+            return lhs.key < rhs.key;
+        });
+        return std::make_shared<FrozenMemTable>(entries.begin(), entries.end());
+    }
+
+    size_t size() override {
+        return size_;
+    }
+
+    size_t binary_size() override {
+        return binary_size_;
+    }
+
+private:
+    Bucket& GetBucket(std::string_view key) {
+        return buckets_[std::hash<std::string_view>()(key) % bucket_count_];
+    }
+
+private:
+    size_t bucket_count_;
+    std::unique_ptr<Bucket[]> buckets_;
+    std::atomic_size_t size_{0};
+    std::atomic_size_t binary_size_{0};
+    std::mutex last_key_mutex_;
+    std::string last_key_;
+};
+
+/*
+VectorRep appends every write, a Put never searches. Get and Upsert scan back to the newest entry of a key,
+so it suits a bulk load that is written once and flushed, not point reads.
+Snapshot stable sorts and keeps the newest entry of each key, size() counts every write
+*/
+class VectorRep : public MemTableRep {
+public:
+    bool Get(std::string_view key, std::string& value, ValueType& type) override {
+        easykv::common::RWLock::ReadLock lock(lock_);
+        auto entry = Find(key);
+        if (entry == nullptr) {
+            return false;
+        }
+        value = entry->value;
+        type = entry->type;
+        return true;
+    }
+
+    void Upsert(std::string_view key, const UpsertFn& fn) override {
+        easykv::common::RWLock::WriteLock lock(lock_);
+        if (auto entry = Find(key)) {
+            binary_size_ -= entry->value.size();
+            fn(true, entry->value, entry->type);
+            binary_size_ += entry->value.size();
+            return;
+        }
+        MemTableEntry entry;
+        entry.key.assign(key);
+        fn(false, entry.value, entry.type);
+        Append(std::move(entry));
+    }
+
+    void Put(std::string_view key, std::string_view value, ValueType type) override {
+        easykv::common::RWLock::WriteLock lock(lock_);
+        Append(MemTableEntry{std::string(key), std::string(value), type});
+    }
+
+    bool LastKey(std::string& key) override {
+        easykv::common::RWLock::ReadLock lock(lock_);
+        if (entries_.empty()) {
+            return false;
+        }
+        key = last_key_;
+        return true;
+    }
+
+    std::shared_ptr<const FrozenMemTable> Snapshot() override {
+        std::vector<MemTableEntry> entries;
+        {
+            easykv::common::RWLock::ReadLock lock(lock_);
+            entries = entries_;
+        }
+        std::stable_sort(entries.begin(), entries.end(), [](const MemTableEntry& lhs, const MemTableEntry& rhs) {
+            return lhs.key < rhs.key;
+        });
+        // the last of equal keys is the newest
+        size_t n = 0;
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (i + 1 < entries.size() && entries[i + 1].key == entries[i].key) {
+                continue;
+            }
+            if (n != i) {
+                entries[n] = std::move(entries[i]);
+            }
+            ++n;
+        }
+        entries.resize(n);
+        return std::make_shared<FrozenMemTable>(entries.begin(), entries.end());
+    }
+
+    size_t size() override {
+        return size_;
+    }
+
+    size_t binary_size() override {
+        return binary_size_;
+    }
+
+private:
+    // lock_ held, newest entry of key
+    MemTableEntry* Find(std::string_view key) {
+        for (auto it = entries_.rbegin(); it != entries_.rend(); ++it) {
+            if (it->key == key) {
+                return &*it;
+            }
+        }
+        return nullptr;
+    }
+
+    // lock_ held for write
+    void Append(MemTableEntry&& entry) {
+        if (entries_.empty() || last_key_ < entry.key) {
+            last_key_ = entry.key;
+        }
+        binary_size_ += entry.key.size() + entry.value.size();
+        entries_.emplace_back(std::move(entry));
+        ++size_;
+    }
+
+private:
+    easykv::common::RWLock lock_;
+    std::vector<MemTableEntry> entries_; // write order
+    std::string last_key_;
+    std::atomic_size_t size_{0};
+    std::atomic_size_t binary_size_{0};
+};
+
+}
+}
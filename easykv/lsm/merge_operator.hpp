@@ -0,0 +1,277 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "easykv/lsm/format.hpp"
+
+namespace easykv {
+namespace lsm {
+
+/*
+MergeOperator folds read-modify-write operands (counter increments, list appends) into a value,
+DB::Merge stores the operand blindly and the fold happens on Get, in the memtable and in compaction
+*/
+class MergeOperator {
+public:
+    virtual ~MergeOperator() {}
+
+    // base is nullptr when nothing is below the operands (never written or deleted), operands are oldest first
+    virtual bool FullMerge(std::string_view key, const std::string_view* base,
+        const std::vector<std::string_view>& operands, std::string& result) const = 0;
+
+    // folds two adjacent operands into one, false keeps both
+    virtual bool PartialMerge(std::string_view /* key */, std::string_view /* older */, std::string_view /* newer */,
+            std::string& /* result */) const {
+        return false;
+    }
+};
+
+// values and operands are 8 byte unsigned integers, merge adds them
+class UInt64AddOperator : public MergeOperator {
+public:
+    static std::string Encode(uint64_t value) {
+        return std::string(reinterpret_cast<const char*>(&value), sizeof(uint64_t));
+    }
+
+    // anything not 8 bytes long counts as 0
+    static uint64_t Decode(std::string_view s) {
+        uint64_t value = 0;
+        if (s.size() == sizeof(uint64_t)) {
+            memcpy(&value, s.data(), sizeof(uint64_t));
+        }
+        return value;
+    }
+
+    bool FullMerge(std::string_view /* key */, const std::string_view* base,
+            const std::vector<std::string_view>& operands, std::string& result) const override {
+        uint64_t sum = base ? Decode(*base) : 0;
+        for (auto operand : operands) {
+            sum += Decode(operand);
+        }
+        result = Encode(sum);
+        return true;
+    }
+
+    bool PartialMerge(std::string_view /* key */, std::string_view older, std::string_view newer, std::string& result) const override {
+        result = Encode(Decode(older) + Decode(newer));
+        return true;
+    }
+};
+
+// operands are appended to the value, delimiter in between
+class StringAppendOperator : public MergeOperator {
+public:
+    explicit StringAppendOperator(char delimiter = ','): delimiter_(delimiter) {}
+
+    bool FullMerge(std::string_view /* key */, const std::string_view* base,
+            const std::vector<std::string_view>& operands, std::string& result) const override {
+        result.clear();
+        if (base) {
+            result.assign(*base);
+        }
+        for (auto operand : operands) {
+            if (!result.empty() || base) {
+                result.push_back(delimiter_);
+            }
+            result.append(operand);
+        }
+        return true;
+    }
+
+private:
+    char delimiter_;
+};
+
+/*
+the value of a kTypeMerge entry is its operand list, oldest first
+|operand_size(8byte)|operand|operand_size(8byte)|operand|...
+*/
+inline void AppendOperand(std::string& list, std::string_view operand) {
+    PutFixed64(list, operand.size());
+    list.append(operand);
+}
+
+inline bool DecodeOperands(std::string_view list, std::vector<std::string_view>& operands) {
+    while (!list.empty()) {
+        if (list.size() < sizeof(size_t)) {
+            return false;
+        }
+        auto size = *reinterpret_cast<const size_t*>(list.data());
+        list.remove_prefix(sizeof(size_t));
+        if (size > list.size()) {
+            return false;
+        }
+        operands.emplace_back(list.substr(0, size));
+        list.remove_prefix(size);
+    }
+    return true;
+}
+
+/*
+folds operand into the newest entry of key where it is kept (memtable), found is false without one.
+a value or a deletion is a base and the result is a value, otherwise the operand joins the list,
+partial merged with the newest operand when the operator can. the result keeps the expiry of a ttl base,
+an expired one is a deletion
+*/
+inline bool MergeInto(const MergeOperator& op, std::string_view key, bool found, std::string& value, ValueType& type,
+        std::string_view operand) {
+    uint64_t expire_at = 0;
+    if (found && type == kTypeValueWithTTL) {
+        expire_at = Expired(value, NowMicros()) ? 0 : DecodeExpiry(value);
+        value.resize(StripExpiry(value).size());
+        type = expire_at == 0 ? kTypeDeletion : kTypeValue;
+    }
+    if (found && (type == kTypeValue || type == kTypeDeletion)) {
+        std::string_view base(value);
+        std::string result;
+        if (!op.FullMerge(key, type == kTypeValue ? &base : nullptr, {operand}, result)) {
+            return false;
+        }
+        value = std::move(result);
+        type = kTypeValue;
+        if (expire_at != 0) {
+            AppendExpiry(value, expire_at);
+            type = kTypeValueWithTTL;
+        }
+        return true;
+    }
+    if (!found || type != kTypeMerge) {
+        value.clear();
+    }
+    std::vector<std::string_view> operands;
+    std::string merged;
+    if (DecodeOperands(value, operands) && operands.size() == 1 && op.PartialMerge(key, operands[0], operand, merged)) {
+        value.clear();
+        AppendOperand(value, merged);
+    } else {
+        AppendOperand(value, operand);
+    }
+    type = kTypeMerge;
+    return true;
+}
+
+/*
+MergeContext collects the entries of one key newest first, from memtables, levels or compaction inputs,
+until a value or a deletion ends the chain. a kTypeBlobIndex base is handed in already read,
+a ttl base expired when the context was made counts as a deletion
+*/
+class MergeContext {
+public:
+    // false once the chain has ended, older entries are shadowed
+    bool Add(std::string_view value, ValueType type) {
+        if (type == kTypeMerge) {
+            lists_.emplace_back(value);
+            return true;
+        }
+        ended_ = true;
+        if (type == kTypeValueWithTTL) {
+            if (Expired(value, now_)) {
+                return false;
+            }
+            expire_at_ = DecodeExpiry(value);
+            value = StripExpiry(value);
+        }
+        if (type != kTypeDeletion) {
+            base_.assign(value);
+            has_base_ = true;
+        }
+        return false;
+    }
+
+    bool ended() const {
+        return ended_;
+    }
+
+    // false when the newest entry was a deletion
+    bool found() const {
+        return !lists_.empty() || has_base_;
+    }
+
+    // expire_at of a ttl base, 0 without one
+    uint64_t expire_at() const {
+        return expire_at_;
+    }
+
+    /*
+    the value of key, an unended chain is taken as having nothing below.
+    with type the result is stored as an entry: a ttl base passes its expiry on to it
+    */
+    bool Finish(const MergeOperator& op, std::string_view key, std::string& result, ValueType* type = nullptr) const {
+        std::vector<std::string_view> operands;
+        if (!Operands(operands)) {
+            return false;
+        }
+        std::string_view base(base_);
+        if (!op.FullMerge(key, has_base_ ? &base : nullptr, operands, result)) {
+            return false;
+        }
+        if (type) {
+            *type = expire_at_ != 0 ? kTypeValueWithTTL : kTypeValue;
+            if (expire_at_ != 0) {
+                AppendExpiry(result, expire_at_);
+            }
+        }
+        return true;
+    }
+
+    // an unended chain as one kTypeMerge value, adjacent operands partial merged where the operator can
+    bool Encode(const MergeOperator& op, std::string_view key, std::string& list) const {
+        std::vector<std::string_view> operands;
+        if (!Operands(operands)) {
+            return false;
+        }
+        list.clear();
+        std::string acc;
+        bool has_acc = false;
+        for (auto operand : operands) {
+            std::string merged;
+            if (has_acc && op.PartialMerge(key, acc, operand, merged)) {
+                acc = std::move(merged);
+                continue;
+            }
+            if (has_acc) {
+                AppendOperand(list, acc);
+            }
+            acc.assign(operand);
+            has_acc = true;
+        }
+        if (has_acc) {
+            AppendOperand(list, acc);
+        }
+        return true;
+    }
+
+    void Clear() {
+        lists_.clear();
+        base_.clear();
+        has_base_ = false;
+        ended_ = false;
+        expire_at_ = 0;
+    }
+
+private:
+    bool Operands(std::vector<std::string_view>& operands) const {
+        for (auto it = lists_.rbegin(); it != lists_.rend(); ++it) {
+            if (!DecodeOperands(*it, operands)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::vector<std::string> lists_; // operand lists, newest first
+    std::string base_;
+    bool has_base_ = false;
+    bool ended_ = false;
+    uint64_t expire_at_ = 0;
+    uint64_t now_ = NowMicros();
+};
+
+}
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace easykv {
+namespace lsm {
+
+/*
+PinnableValue is the result of a Get that avoids the copy out of an sst:
+a value found in a data block points into the block and holds a ref on it (the block
+holds the mmap or the read buffer), the block stays alive until the value is reset or destroyed.
+memtable nodes are updated in place, their values are copied into the value's own buffer
+*/
+class PinnableValue {
+public:
+    PinnableValue() = default;
+    PinnableValue(const PinnableValue&) = delete;
+    PinnableValue& operator = (const PinnableValue&) = delete;
+
+    PinnableValue(PinnableValue&& rhs) noexcept {
+        *this = std::move(rhs);
+    }
+
+    PinnableValue& operator = (PinnableValue&& rhs) noexcept {
+        holder_ = std::move(rhs.holder_);
+        self_ = std::move(rhs.self_);
+        data_ = holder_ ? rhs.data_ : std::string_view(self_);
+        rhs.Reset();
+        return *this;
+    }
+
+    // value lives in memory owned by holder
+    void Pin(std::string_view value, std::shared_ptr<const void> holder) {
+        self_.clear();
+        holder_ = std::move(holder);
+        data_ = value;
+    }
+
+    // buffer to copy a value into, PinSelf() makes it the result
+    std::string& GetSelf() {
+        return self_;
+    }
+
+    void PinSelf() {
+        holder_.reset();
+        data_ = self_;
+    }
+
+    void PinSelf(std::string_view value) {
+        self_.assign(value);
+        PinSelf();
+    }
+
+    // drops the last n bytes of the result, e.g. the expiry of a kTypeValueWithTTL value
+    void RemoveSuffix(size_t n) {
+        data_.remove_suffix(std::min(n, data_.size()));
+    }
+
+    void Reset() {
+        holder_.reset();
+        self_.clear();
+        data_ = std::string_view();
+    }
+
+    bool pinned() const {
+        return holder_ != nullptr;
+    }
+
+    std::string_view view() const {
+        return data_;
+    }
+
+    const char* data() const {
+        return data_.data();
+    }
+
+    size_t size() const {
+        return data_.size();
+    }
+
+    std::string ToString() const {
+        return std::string(data_);
+    }
+
+private:
+    std::shared_ptr<const void> holder_;
+    std::string self_;
+    std::string_view data_;
+};
+
+}
+}
@@ -0,0 +1,148 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+namespace easykv {
+namespace lsm {
+
+/*
+PrefixIndex searches a sorted run of keys (entries of a data block, data blocks of an sst, files of a level)
+without touching the keys themselves on most probes. the bytes every key shares are skipped, the next
+8 bytes of each key are kept inline as a big endian integer, so comparing two of them compares the keys
+there. they are laid out in eytzinger order (root at 1, children of k at 2k and 2k + 1): the descent
+has no data dependent branch and the levels below are prefetched a cache line at a time.
+a key is only read when its 8 bytes tie with the target's, or inside the window of a hinted search
+*/
+class PrefixIndex {
+public:
+    // keys in order, they must stay valid as long as the index is searched
+    void Build(std::vector<std::string_view> keys) {
+        keys_ = std::move(keys);
+        skip_ = keys_.empty() ? 0 : CommonPrefix(keys_.front(), keys_.back());
+        prefixes_.assign(keys_.size() + 1, 0);
+        ids_.assign(keys_.size() + 1, 0);
+        uint32_t next = 0;
+        Layout(1, next);
+    }
+
+    // first i with keys[i] >= target, size() when there is none
+    size_t LowerBound(std::string_view target) const {
+        return Search<false>(target);
+    }
+
+    // first i with keys[i] > target, size() when there is none
+    size_t UpperBound(std::string_view target) const {
+        return Search<true>(target);
+    }
+
+    /*
+    the same bounds, searched for in [begin, end] first: a hint, e.g. from a LearnedIndex.
+    the window is binary searched over the keys themselves, it is a few entries wide, so the prefixes
+    would save next to nothing there. the hint is checked against the keys around it, a wrong one costs
+    the full search. hit tells which of the two it was
+    */
+    size_t LowerBound(std::string_view target, size_t begin, size_t end, bool* hit = nullptr) const {
+        end = std::min(end, keys_.size());
+        begin = std::min(begin, end);
+        bool in_window = (begin == 0 || keys_[begin - 1] < target) && (end == keys_.size() || target <= keys_[end]);
+        if (hit) {
+            *hit = in_window;
+        }
+        if (in_window) {
+            return std::lower_bound(keys_.begin() + begin, keys_.begin() + end, target) - keys_.begin();
+        }
+        return LowerBound(target);
+    }
+
+    size_t UpperBound(std::string_view target, size_t begin, size_t end, bool* hit = nullptr) const {
+        end = std::min(end, keys_.size());
+        begin = std::min(begin, end);
+        bool in_window = (begin == 0 || keys_[begin - 1] <= target) && (end == keys_.size() || target < keys_[end]);
+        if (hit) {
+            *hit = in_window;
+        }
+        if (in_window) {
+            return std::upper_bound(keys_.begin() + begin, keys_.begin() + end, target) - keys_.begin();
+        }
+        return UpperBound(target);
+    }
+
+    size_t size() const {
+        return keys_.size();
+    }
+
+    size_t binary_size() const {
+        return keys_.capacity() * sizeof(std::string_view) + prefixes_.capacity() * sizeof(uint64_t) +
+            ids_.capacity() * sizeof(uint32_t);
+    }
+
+private:
+    static size_t CommonPrefix(std::string_view a, std::string_view b) {
+        size_t n = std::min(a.size(), b.size());
+        size_t i = 0;
+        while (i < n && a[i] == b[i]) {
+            ++i;
+        }
+        return i;
+    }
+
+    // 8 bytes after the skipped ones, zero padded: a tie of a short key with a longer one goes to the full compare
+    uint64_t Prefix(std::string_view key) const {
+        uint64_t prefix = 0;
+        if (key.size() > skip_) {
+            memcpy(&prefix, key.data() + skip_, std::min<size_t>(key.size() - skip_, sizeof(uint64_t)));
+        }
+        return __builtin_bswap64(prefix);
+    }
+
+    void Layout(size_t k, uint32_t& next) {
+        if (k >= prefixes_.size()) {
+            return;
+        }
+        Layout(2 * k, next);
+        prefixes_[k] = Prefix(keys_[next]);
+        ids_[k] = next++;
+        Layout(2 * k + 1, next);
+    }
+
+    // kUpper: the descent goes right past keys equal to target too
+    template <bool kUpper>
+    size_t Search(std::string_view target) const {
+        if (keys_.empty()) {
+            return 0;
+        }
+        // every key starts with the skipped bytes, a target that does not is before or after all of them
+        auto shared = keys_.front().substr(0, skip_);
+        auto head = target.substr(0, skip_);
+        if (head != shared) {
+            return head < shared ? 0 : keys_.size();
+        }
+        auto prefix = Prefix(target);
+        size_t k = 1;
+        while (k < prefixes_.size()) {
+            // the 16 descendants 4 levels down share two cache lines
+            if (16 * k < prefixes_.size()) {
+                __builtin_prefetch(prefixes_.data() + 16 * k);
+            }
+            auto p = prefixes_[k];
+            bool right = p < prefix || (p == prefix && (kUpper ? keys_[ids_[k]] <= target : keys_[ids_[k]] < target));
+            k = 2 * k + right;
+        }
+        // the last left turn is the bound, the trailing ones are the right turns after it
+        k >>= __builtin_ffsll(~k);
+        return k == 0 ? keys_.size() : ids_[k];
+    }
+
+private:
+    std::vector<std::string_view> keys_;
+    size_t skip_ = 0;
+    std::vector<uint64_t> prefixes_; // eytzinger order, [0] unused
+    std::vector<uint32_t> ids_; // position in keys_ of each eytzinger slot
+};
+
+}
+}
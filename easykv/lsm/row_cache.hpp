@@ -0,0 +1,125 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "easykv/cache/concurrent_cache.hpp"
+#include "easykv/lsm/format.hpp"
+#include "easykv/lsm/pinnable_value.hpp"
+
+namespace easykv {
+namespace lsm {
+
+/*
+RowCache keeps whole key -> value pairs in front of the memtables and the ssts,
+admission is TinyLFU: new rows go through the window lru and only win a place in
+the main lru when the cm sketch has seen them more often than the victim.
+the cache is keyed by the key hash, the row keeps its key so a collision is a miss.
+
+writers Invalidate after the write is visible, which bumps the epoch of the key's stripe,
+a reader takes the epoch before it reads the lsm and Fill drops the row if the epoch moved.
+a row of a ttl value is a miss once its expire_at has passed
+*/
+class RowCache {
+    constexpr static const size_t stripe_bits_ = 6;
+    constexpr static const size_t stripe_num_ = 1 << stripe_bits_;
+
+    struct Row {
+        uint64_t hash = 0;
+        uint64_t generation = 0;
+        uint64_t expire_at = 0;
+        std::string key;
+        std::string value;
+
+        explicit operator uint64_t() const {
+            return hash;
+        }
+    };
+
+public:
+    explicit RowCache(size_t capacity): cache_(capacity) {}
+
+    static uint64_t Hash(std::string_view key) {
+        return std::hash<std::string_view>()(key);
+    }
+
+    uint64_t epoch(std::string_view key) {
+        return Stripe(Hash(key)).load(std::memory_order_acquire);
+    }
+
+    // a cached row is never changed, value pins it
+    bool Get(std::string_view key, PinnableValue& value) {
+        auto hash = Hash(key);
+        auto row = cache_.Get(hash);
+        if (row && (row->generation != generation_.load(std::memory_order_acquire) ||
+                (row->expire_at != 0 && row->expire_at <= NowMicros()))) {
+            cache_.Erase(hash); // Put would keep the stale row
+            row = nullptr;
+        }
+        if (!row || row->key != key) {
+            ++miss_cnt_;
+            return false;
+        }
+        ++hit_cnt_;
+        std::string_view result(row->value);
+        value.Pin(result, std::move(row));
+        return true;
+    }
+
+    // epoch is what epoch(key) returned before value was read
+    void Fill(std::string_view key, std::string_view value, uint64_t epoch, uint64_t expire_at = 0) {
+        Row row{Hash(key), generation_.load(std::memory_order_acquire), expire_at, std::string(key), std::string(value)};
+        auto& stripe = Stripe(row.hash);
+        if (stripe.load(std::memory_order_acquire) != epoch) {
+            return;
+        }
+        cache_.Put(row);
+        if (stripe.load(std::memory_order_acquire) != epoch) {
+            // a write raced with the put, its Invalidate may have run before the row was in
+            cache_.Erase(row.hash);
+        }
+    }
+
+    void Invalidate(std::string_view key) {
+        auto hash = Hash(key);
+        Stripe(hash).fetch_add(1, std::memory_order_acq_rel);
+        cache_.Erase(hash);
+    }
+
+    // every row is stale, e.g. an ingested file replaced a key range. rows are dropped as they are met
+    void InvalidateAll() {
+        generation_.fetch_add(1, std::memory_order_acq_rel);
+        for (auto& stripe : epochs_) {
+            stripe.fetch_add(1, std::memory_order_acq_rel);
+        }
+    }
+
+    size_t hit_cnt() const {
+        return hit_cnt_;
+    }
+
+    size_t miss_cnt() const {
+        return miss_cnt_;
+    }
+
+private:
+    std::atomic_uint64_t& Stripe(uint64_t hash) {
+        return epochs_[hash & (stripe_num_ - 1)];
+    }
+
+private:
+    cpputil::cache::Concurrent2LRUCache<uint64_t, Row> cache_;
+    std::array<std::atomic_uint64_t, stripe_num_> epochs_{};
+    std::atomic_uint64_t generation_{0};
+    std::atomic_size_t hit_cnt_{0};
+    std::atomic_size_t miss_cnt_{0};
+};
+
+}
+}
@@ -8,6 +8,7 @@
 
 #include <iostream>
 
+#include "easykv/lsm/format.hpp"
 #include "easykv/utils/lock.hpp"
 #include "easykv/utils/global_random.h"
 
@@ -24,6 +25,7 @@ struct Node {
     std::vector<Node*> nexts;
     std::string key;
     std::string value;
+    ValueType type = kTypeValue;
     easykv::common::RWLock rw_lock;
 };
 
@@ -78,6 +80,11 @@ public:
     }
 
     bool Get(std::string_view key, std::string& value) {
+        ValueType type;
+        return Get(key, value, type);
+    }
+
+    bool Get(std::string_view key, std::string& value, ValueType& type) {
         easykv::common::RWLock::ReadLock lock(delete_rw_lock_);
 
         auto p = head_;
@@ -94,6 +101,7 @@ public:
             }
             if (p->nexts[level] && p->nexts[level]->key == key) {
                 value = p->nexts[level]->value;
+                type = p->nexts[level]->type;
                 return true;
             }
         }
@@ -101,9 +109,23 @@ public:
     }
     
     // 一写多读
-    void Put(std::string_view key, std::string_view value) {
-        // // std::cout << "put " << key << " " << value << std::endl;
+    void Put(std::string_view key, std::string_view value, ValueType type = kTypeValue) {
+        Upsert(key, [value, type](bool /* found */, std::string& node_value, ValueType& node_type) {
+            node_value.assign(value);
+            node_type = type;
+        });
+    }
+
+    /*
+    fn(found, value, type) rewrites the entry of key in place, under the lock readers of the node take,
+    or fills a new one when key is absent (found false, value empty)
+    */
+    template <typename Fn>
+    void Upsert(std::string_view key, Fn&& fn) {
         easykv::common::RWLock::ReadLock lock(delete_rw_lock_);
+        if (Append(key, fn)) {
+            return;
+        }
 
         {
             auto p = head_;
@@ -119,18 +141,20 @@ public:
                     last = p;
                 }
                 if (p->nexts[level] && p->nexts[level]->key == key) {
-                    binary_size_ += value.size();
-                    binary_size_ -= p->nexts[level]->value.size();
-                    p->nexts[level]->value = value; // string_view ->(copy) string
+                    auto node = p->nexts[level];
+                    binary_size_ -= node->value.size();
+                    fn(true, node->value, node->type);
+                    binary_size_ += node->value.size();
                     return;
                 }
             }
         }
         auto new_level = RandLevel();
-        auto node = new Node(key, value, new_level);
+        auto node = new Node(key, std::string_view(), new_level);
+        fn(false, node->value, node->type);
         easykv::common::RWLock::WriteLock(node->rw_lock);
         ++size_;
-        binary_size_ += key.size() + value.size();
+        binary_size_ += key.size() + node->value.size();
         if (new_level > head_->nexts.size()) {
             easykv::common::RWLock::WriteLock _lock(head_->rw_lock);
             head_->nexts.resize(new_level, nullptr);
@@ -156,6 +180,45 @@ public:
         }
     }
 
+    // largest key, false when empty
+    bool LastKey(std::string& key) {
+        easykv::common::RWLock::ReadLock lock(delete_rw_lock_);
+        std::unique_lock<std::mutex> tail_lock(tail_mutex_);
+        auto last = Tail(0);
+        if (last == head_) {
+            return false;
+        }
+        key = last->key;
+        return true;
+    }
+
+    // first node with key >= target, links are read under the locks Put takes to change them
+    Node* Seek(std::string_view target) {
+        easykv::common::RWLock::ReadLock lock(delete_rw_lock_);
+
+        auto p = head_;
+        Node* last = nullptr;
+        std::vector<easykv::common::RWLock::ReadLock> level_locks;
+        level_locks.reserve(head_->nexts.size());
+        for (int level = head_->nexts.size() - 1; level >= 0; level--) {
+            while (p->nexts[level] && p->nexts[level]->key < target) {
+                p = p->nexts[level];
+            }
+            if (p != last) {
+                level_locks.emplace_back(easykv::common::RWLock::ReadLock(p->rw_lock));
+                last = p;
+            }
+        }
+        return p->nexts[0];
+    }
+
+    // node stays valid as long as no Delete runs, only values change in place
+    Node* Next(Node* node) {
+        easykv::common::RWLock::ReadLock lock(delete_rw_lock_);
+        easykv::common::RWLock::ReadLock node_lock(node->rw_lock);
+        return node->nexts[0];
+    }
+
     void Delete(std::string_view key) {
         easykv::common::RWLock::WriteLock lock(delete_rw_lock_);
         Node* delete_node = nullptr;
@@ -177,6 +240,7 @@ public:
         if (!delete_node) {
             return;
         }
+        tails_.clear(); // may point at delete_node, found again from head_ by the next append
         --size_;
         binary_size_ -= delete_node->key.size() + delete_node->value.size();
         delete delete_node;
@@ -192,6 +256,60 @@ public:
     }
 
 private:
+    /*
+    time ordered keys land after the last node of every level, tails_ remembers those nodes
+    so an append links the new node without a search from head_. a Put in the middle may link
+    after a remembered tail at an upper level, the tail is then walked forward before it is used.
+    levels are linked bottom up, a reader reaching the node at any level finds it complete
+    */
+    template <typename Fn>
+    bool Append(std::string_view key, Fn& fn) {
+        std::unique_lock<std::mutex> tail_lock(tail_mutex_);
+        auto last = Tail(0);
+        if (last != head_ && key <= last->key) {
+            return false;
+        }
+        auto new_level = RandLevel();
+        auto node = new Node(key, std::string_view(), new_level);
+        fn(false, node->value, node->type);
+        ++size_;
+        binary_size_ += key.size() + node->value.size();
+        if (new_level > head_->nexts.size()) {
+            easykv::common::RWLock::WriteLock _lock(head_->rw_lock);
+            head_->nexts.resize(new_level, nullptr);
+        }
+        for (size_t level = 0; level < new_level; level++) {
+            auto p = Tail(level);
+            while (true) {
+                easykv::common::RWLock::WriteLock w_lock(p->rw_lock);
+                if (p->nexts[level] == nullptr) {
+                    p->nexts[level] = node;
+                    break;
+                }
+                p = p->nexts[level];
+            }
+            tails_[level] = node;
+        }
+        return true;
+    }
+
+    // tail_mutex_ held, last node of level or head_
+    Node* Tail(size_t level) {
+        while (tails_.size() < head_->nexts.size()) {
+            tails_.emplace_back(head_);
+        }
+        auto p = tails_[level];
+        while (true) {
+            easykv::common::RWLock::ReadLock r_lock(p->rw_lock);
+            if (p->nexts[level] == nullptr) {
+                break;
+            }
+            p = p->nexts[level];
+        }
+        tails_[level] = p;
+        return p;
+    }
+
     size_t RandLevel() {
         size_t level = 1;
         while ((cpputil::common::GlobalRand() & 3) == 0) {
@@ -205,6 +323,8 @@ private:
     std::mutex lock_;
     easykv::common::RWLock delete_rw_lock_;
     Node* head_;
+    std::mutex tail_mutex_;
+    std::vector<Node*> tails_; // last node of each level, head_ while a level is empty
 };
 
 
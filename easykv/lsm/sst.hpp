@@ -1,20 +1,31 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <string_view>
-#include <sys/mman.h>
+#include <utility>
 #include <unistd.h>
 #include <vector>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <linux/mman.h>
 
 #include "easykv/utils/bloom_filter.hpp"
+#include "easykv/utils/file.hpp"
+#include "easykv/lsm/block_cache.hpp"
+#include "easykv/lsm/compaction_filter.hpp"
+#include "easykv/lsm/format.hpp"
+#include "easykv/lsm/learned_index.hpp"
+#include "easykv/lsm/memory_budget.hpp"
 #include "easykv/lsm/memtable.hpp"
+#include "easykv/lsm/merge_operator.hpp"
+#include "easykv/lsm/pinnable_value.hpp"
+#include "easykv/lsm/prefix_index.hpp"
 
 namespace easykv {
 namespace lsm {
@@ -24,33 +35,166 @@ struct EntryIndex {
     std::string_view key;
     std::string_view value;
     size_t offset;
+    ValueType type = kTypeValue;
     size_t binary_size() {
         return key.size() + value.size() + 2 * sizeof(size_t);
     }
     size_t Load(char* s, size_t index) {
         offset = index;
+        auto packed_value_size = *reinterpret_cast<size_t*>(s + sizeof(size_t));
+        type = UnpackValueType(packed_value_size);
         key = std::string_view(s + 2 * sizeof(size_t), *reinterpret_cast<size_t*>(s));
-        value = std::string_view(s + 2 * sizeof(size_t) + key.size(), *reinterpret_cast<size_t*>(s + sizeof(size_t)));
+        value = std::string_view(s + 2 * sizeof(size_t) + key.size(), UnpackValueSize(packed_value_size));
         return binary_size();
     }
 };
 /*
-IndexBlock in file [size(8byte) | cnt(8byte) | (offset(8byte) + key_size(8byte) + key(key_size byte)), ...]
-DataBlock in file [(size(8byte) | bloom_filter | cnt(8byte) | (key_size(8byte) + value_size(8byte) + key(key_size byte) + value(value_size byte)), ...]
-SST in file [IndexBlock | (DataBlock...)]
+IndexBlock in file [size(8byte) | cnt(8byte) | (offset(8byte) + block_size(8byte) + key_size(8byte) + first_key(key_size byte)), ...]
+DataBlock in file [(size(8byte) | bloom_filter | cnt(8byte) | (key_size(8byte) + type(1byte) value_size(7byte) + key(key_size byte) + value(value_size byte)), ...
+    | hash index, only with TableOptions::data_block_hash_ratio: (bucket(1byte))... | bucket_cnt(8byte)]
+PropertiesBlock in file [TableProperties | LearnedIndex, only with TableOptions::learned_index_max_error]
+Footer in file [index_offset(8byte) | index_size(8byte) | properties_offset(8byte) | properties_size(8byte) | magic(8byte)]
+SST in file [(DataBlock...) | IndexBlock | PropertiesBlock | Footer]
 
 DataBlcok 和 IndexBlock 都以文件形式访问，Memtable 边序列化边构建 DataBlock
+DataBlock is cut at TableOptions::block_size, index/properties/footer are read on open,
+data blocks are read one by one through RandomAccessFile and kept in the BlockCache
 */
 
+/*
+TableProperties in file
+|smallest_key_size(8byte)|smallest_key|largest_key_size(8byte)|largest_key|entry_count(8byte)|raw_key_size(8byte)|
+raw_value_size(8byte)|data_size(8byte)|tombstone_count(8byte)|smallest_seq(8byte)|largest_seq(8byte)|
+earliest_expiry(8byte)|
+
+raw_*_size is the user bytes, data_size is the bytes data blocks take in the file,
+earliest_expiry is the first expire_at of a kTypeValueWithTTL entry, 0 without one
+*/
+struct TableProperties {
+    std::string smallest_key;
+    std::string largest_key;
+    size_t entry_count = 0;
+    size_t raw_key_size = 0;
+    size_t raw_value_size = 0;
+    size_t data_size = 0;
+    size_t tombstone_count = 0;
+    uint64_t smallest_seq = 0;
+    uint64_t largest_seq = 0;
+    uint64_t earliest_expiry = 0;
+
+    // entries come in key order
+    void Add(std::string_view key, std::string_view value, ValueType type) {
+        if (entry_count == 0) {
+            smallest_key = key;
+        }
+        largest_key = key;
+        ++entry_count;
+        raw_key_size += key.size();
+        raw_value_size += value.size();
+        if (type == kTypeDeletion) {
+            ++tombstone_count;
+        }
+        if (type == kTypeValueWithTTL) {
+            auto expire_at = DecodeExpiry(value);
+            if (earliest_expiry == 0 || expire_at < earliest_expiry) {
+                earliest_expiry = expire_at;
+            }
+        }
+    }
+
+    size_t binary_size() const {
+        return 10 * sizeof(size_t) + smallest_key.size() + largest_key.size();
+    }
+
+    size_t Save(char* s) const {
+        size_t index = 0;
+        *reinterpret_cast<size_t*>(s + index) = smallest_key.size();
+        index += sizeof(size_t);
+        memcpy(s + index, smallest_key.data(), smallest_key.size());
+        index += smallest_key.size();
+        *reinterpret_cast<size_t*>(s + index) = largest_key.size();
+        index += sizeof(size_t);
+        memcpy(s + index, largest_key.data(), largest_key.size());
+        index += largest_key.size();
+        for (auto field : {entry_count, raw_key_size, raw_value_size, data_size, tombstone_count,
+                static_cast<size_t>(smallest_seq), static_cast<size_t>(largest_seq), static_cast<size_t>(earliest_expiry)}) {
+            *reinterpret_cast<size_t*>(s + index) = field;
+            index += sizeof(size_t);
+        }
+        return index;
+    }
+
+    size_t Load(const char* s) {
+        size_t index = 0;
+        auto smallest_size = *reinterpret_cast<const size_t*>(s + index);
+        index += sizeof(size_t);
+        smallest_key.assign(s + index, smallest_size);
+        index += smallest_size;
+        auto largest_size = *reinterpret_cast<const size_t*>(s + index);
+        index += sizeof(size_t);
+        largest_key.assign(s + index, largest_size);
+        index += largest_size;
+        for (auto field : {&entry_count, &raw_key_size, &raw_value_size, &data_size, &tombstone_count,
+                reinterpret_cast<size_t*>(&smallest_seq), reinterpret_cast<size_t*>(&largest_seq),
+                reinterpret_cast<size_t*>(&earliest_expiry)}) {
+            *field = *reinterpret_cast<const size_t*>(s + index);
+            index += sizeof(size_t);
+        }
+        return index;
+    }
+};
+
+struct Footer {
+    constexpr static const size_t binary_size = 5 * sizeof(size_t);
+    constexpr static const size_t magic = 0x3174737379736165ull; // "easysst1"
+    size_t index_offset = 0;
+    size_t index_size = 0;
+    size_t properties_offset = 0;
+    size_t properties_size = 0;
+
+    size_t Save(char* s) const {
+        size_t index = 0;
+        for (auto field : {index_offset, index_size, properties_offset, properties_size, magic}) {
+            *reinterpret_cast<size_t*>(s + index) = field;
+            index += sizeof(size_t);
+        }
+        return index;
+    }
+
+    bool Load(const char* s) {
+        index_offset = *reinterpret_cast<const size_t*>(s);
+        index_size = *reinterpret_cast<const size_t*>(s + sizeof(size_t));
+        properties_offset = *reinterpret_cast<const size_t*>(s + 2 * sizeof(size_t));
+        properties_size = *reinterpret_cast<const size_t*>(s + 3 * sizeof(size_t));
+        return *reinterpret_cast<const size_t*>(s + 4 * sizeof(size_t)) == magic;
+    }
+};
+
+/*
+a bucket of the data block hash index holds the position of the one entry hashed to it,
+kHashEmpty when there is none, kHashCollision when there are more and the block is searched
+*/
+constexpr static const uint8_t kHashEmpty = 255;
+constexpr static const uint8_t kHashCollision = 254;
+constexpr static const size_t kMaxHashEntries = 254;
+
+// FNV-1a, the hash index is in the file and must not change with the build
+inline uint64_t DataBlockHash(std::string_view key) {
+    uint64_t hash = 14695981039346656037ull;
+    for (auto c : key) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
 class DataBlockIndex {
 public:
     void SetOffset(size_t offset) {
         offset_ = offset;
     }
-    size_t Load(char* s, int32_t offset = -1) {
-        if (offset_ != -1) {
-            offset_ = offset;
-        }
+    size_t Load(char* s, size_t offset) {
+        offset_ = offset;
         size_t index = offset_;
         cached_binary_size_ = *reinterpret_cast<size_t*>(s + index);
         // std::cout << " data block load size " << cached_binary_size_ << std::endl;
@@ -68,6 +212,23 @@ public:
             index += entry_index.Load(s + index, index);
             data_index_.emplace_back(std::move(entry_index));
         }
+        // a hash index fills the rest of the block exactly, anything else is not one
+        auto end = offset_ + cached_binary_size_;
+        buckets_ = nullptr;
+        bucket_cnt_ = 0;
+        if (end >= index + sizeof(size_t)) {
+            auto bucket_cnt = *reinterpret_cast<size_t*>(s + end - sizeof(size_t));
+            if (bucket_cnt > 0 && bucket_cnt == end - sizeof(size_t) - index && size_ <= kMaxHashEntries) {
+                buckets_ = reinterpret_cast<const uint8_t*>(s + index);
+                bucket_cnt_ = bucket_cnt;
+            }
+        }
+        std::vector<std::string_view> keys;
+        keys.reserve(size_);
+        for (auto& entry : data_index_) {
+            keys.emplace_back(entry.key);
+        }
+        search_index_.Build(std::move(keys));
         return index;
     }
     size_t binary_size() {
@@ -81,90 +242,185 @@ public:
         return cached_binary_size_;
     }
     bool Get(std::string_view key, std::string& value) {
-        if (!bloom_filter_.Check(key.data(), key.size())) {
+        ValueType type;
+        return Get(key, value, type);
+    }
+
+    bool Get(std::string_view key, std::string& value, ValueType& type) {
+        auto entry = Find(key);
+        if (entry == nullptr) {
             return false;
         }
-        {
-            size_t l = 0, r = data_index_.size();
-            while (l < r) {
-                size_t mid = (l + r) >> 1;
-                if (data_index_[mid].key < key) {
-                    l = mid + 1;
-                } else {
-                    r = mid;
-                }
+        value = entry->value; // copy
+        type = entry->type;
+        return true;
+    };
+
+    /*
+    the entry points into the block data, nullptr if key is not in the block. [begin, end] is a hint of its position,
+    hit is set when the hinted search ran and tells if the hint held
+    */
+    const EntryIndex* Find(std::string_view key, size_t begin = 0, size_t end = -1, bool* hit = nullptr) {
+        if (!bloom_filter_.Check(key.data(), key.size())) {
+            return nullptr;
+        }
+        if (bucket_cnt_ > 0) {
+            auto bucket = buckets_[DataBlockHash(key) % bucket_cnt_];
+            if (bucket == kHashEmpty) {
+                return nullptr;
             }
-            if (r == data_index_.size() || data_index_[r].key != key) {
-                return false;
-            } else {
-                value = data_index_[r].value; // copy
-                return true;
+            if (bucket != kHashCollision) {
+                return bucket < data_index_.size() && data_index_[bucket].key == key ? &data_index_[bucket] : nullptr;
             }
         }
-        return false;
-    };
+        auto i = end == size_t(-1) ? LowerBound(key) : search_index_.LowerBound(key, begin, end, hit);
+        if (i == data_index_.size() || data_index_[i].key != key) {
+            return nullptr;
+        }
+        return &data_index_[i];
+    }
+
+    // index of the first entry with key >= target
+    size_t LowerBound(std::string_view target) const {
+        return search_index_.LowerBound(target);
+    }
 
     std::vector<EntryIndex>& data_index() {
         return data_index_;
     }
+
+    const PrefixIndex& search_index() const {
+        return search_index_;
+    }
+
+    // 0 without a hash index
+    size_t hash_bucket_cnt() const {
+        return bucket_cnt_;
+    }
 private:
     size_t offset_;
     std::vector<EntryIndex> data_index_;
+    PrefixIndex search_index_;
+    const uint8_t* buckets_ = nullptr; // points into the block data
+    size_t bucket_cnt_ = 0;
     easykv::common::BloomFilter bloom_filter_;
     size_t cached_binary_size_ = -1;
     size_t size_;
 };
 
-class DataBlockIndexIndex {
-public:
-    DataBlockIndex& Get() {
-        return data_block_index_;
+// a parsed data block, its entries point into read.result
+struct DataBlock {
+    std::shared_ptr<common::RandomAccessFile> file; // keeps the mapping alive for kMmap
+    common::ReadRequest read;
+    DataBlockIndex index;
+
+    size_t charge() {
+        return sizeof(DataBlock) + read.buf.capacity() + index.data_index().capacity() * sizeof(EntryIndex) +
+            index.search_index().binary_size();
+    }
+};
+
+struct TableOptions {
+    // a data block is cut once its entries pass block_size bytes
+    size_t block_size = 4096;
+    common::ReadMode read_mode = common::ReadMode::kMmap;
+    // nullptr: every read parses its block again
+    std::shared_ptr<BlockCache> block_cache;
+    // writes bypass the page cache, a finished sst is then read from disk
+    bool use_direct_writes = false;
+    // writeback of a new sst is started every bytes_per_sync bytes, 0 leaves it to the kernel
+    size_t bytes_per_sync = 1024 * 1024;
+    // index and properties of an open sst are charged to it
+    std::shared_ptr<MemoryBudget> memory_budget;
+    // directory of the sst and blob files, empty is the working directory
+    std::string db_path;
+    // level i is written to level_paths[min(i, size - 1)], empty keeps every level in db_path
+    std::vector<std::string> level_paths;
+    // folds kTypeMerge entries in compaction, nullptr keeps the newest entry of a key only
+    std::shared_ptr<MergeOperator> merge_operator;
+    // a filter per compaction decides on the newest value of every key, nullptr keeps them all
+    std::shared_ptr<CompactionFilterFactory> compaction_filter_factory;
+    // shared by the background writers, nullptr writes at full speed
+    std::shared_ptr<common::RateLimiter> rate_limiter;
+    // kHigh for flushes, compactions and blob gc stay kLow
+    common::RateLimiter::Priority write_priority = common::RateLimiter::Priority::kLow;
+    // > 0 appends a hash index of entries / data_block_hash_ratio one byte buckets to each data block,
+    // a point lookup then finds its entry without a search. readers not using it skip it
+    double data_block_hash_ratio = 0;
+    // >= 2 fits a LearnedIndex of key -> position into each new sst, kept when it is off by at most this many entries.
+    // 1 leaves no room for rounding the model and builds none
+    size_t learned_index_max_error = 0;
+
+    // path id 0 is db_path, i is level_paths[i - 1]. the id of a file is kept in its FileMetaData
+    size_t PathId(size_t level) const {
+        return level_paths.empty() ? 0 : std::min(level, level_paths.size() - 1) + 1;
+    }
+
+    const std::string& Path(size_t path_id) const {
+        return path_id == 0 || path_id > level_paths.size() ? db_path : level_paths[path_id - 1];
     }
+};
 
-    size_t Load(char* s, char* data) {
+class DataBlockIndexIndex {
+public:
+    size_t Load(char* s) {
         offset_ = *reinterpret_cast<size_t*>(s);
-        key_ = std::string_view(s + 2 * sizeof(size_t), *reinterpret_cast<size_t*>(s + sizeof(size_t)));
-        // std::cout << " key " << key_ << " offset " << offset_ << std::endl;
-        data_block_index_.Load(data, offset_);
-        return 2 * sizeof(size_t) + key_.size();
+        size_ = *reinterpret_cast<size_t*>(s + sizeof(size_t));
+        key_ = std::string_view(s + 3 * sizeof(size_t), *reinterpret_cast<size_t*>(s + 2 * sizeof(size_t)));
+        return 3 * sizeof(size_t) + key_.size();
     }
 
     const std::string_view key() const {
         return key_;
     }
+
+    size_t offset() const {
+        return offset_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
 private:
     size_t offset_;
+    size_t size_;
     std::string_view key_;
-    DataBlockIndex data_block_index_;
-    bool data_block_loaded_ = false;
 };
 
 struct EntryView {
     EntryView(std::string& k, std::string& v): key(k), value(v) {
         
     }
-    EntryView(std::string_view k, std::string_view v): key(k), value(v) {
+    EntryView(std::string_view k, std::string_view v, ValueType t = kTypeValue): key(k), value(v), type(t) {
         
     }
     std::string_view key;
     std::string_view value;
+    ValueType type = kTypeValue;
 };
 
 class IndexBlockIndex {
 public:
+    // s is the index block
     size_t Load(char* s) {
         size_t index = 0;
         binary_size_ = *reinterpret_cast<size_t*>(s);
         index += sizeof(size_t);
         size_ = *reinterpret_cast<size_t*>(s + index);
         index += sizeof(size_t);
+        data_block_indexs_.clear();
         data_block_indexs_.reserve(size_);
-        // std::cout << " binary size " << binary_size_ << " size " << size_ << std::endl;
         for (size_t i = 0; i < size_; i++) {
             DataBlockIndexIndex data_block_index_index;
-            index += data_block_index_index.Load(s + index, s);
+            index += data_block_index_index.Load(s + index);
             data_block_indexs_.emplace_back(std::move(data_block_index_index));
         }
+        std::vector<std::string_view> keys;
+        keys.reserve(size_);
+        for (auto& data_block_index : data_block_indexs_) {
+            keys.emplace_back(data_block_index.key());
+        }
+        search_index_.Build(std::move(keys));
         return index;
     }
     
@@ -172,24 +428,14 @@ public:
         return data_block_indexs_.size();
     }
 
-    bool Get(std::string_view key, std::string& value) {
-        // 1.find data_block
-        // 2.search data_block
-        {
-            size_t l = 0, r = data_block_indexs_.size();
-            while (l < r) {
-                size_t mid = (l + r) >> 1;
-                if (data_block_indexs_[mid].key() > key) {
-                    r = mid;
-                } else {
-                    l = mid + 1;
-                }
-            }
-            if (r != 0) {
-                return data_block_indexs_[r - 1].Get().Get(key, value);
-            }
-        }
-        return false;
+    // the only data block key can be in, -1 if it is before the first one
+    size_t Find(std::string_view key) {
+        return search_index_.UpperBound(key) - 1;
+    }
+
+    // the same, the block is looked for in [first, last] first. hit tells if it was there
+    size_t Find(std::string_view key, size_t first, size_t last, bool* hit = nullptr) {
+        return search_index_.UpperBound(key, first + 1, last + 1, hit) - 1;
     }
 
     const std::string_view key() const {
@@ -199,10 +445,192 @@ public:
     std::vector<DataBlockIndexIndex>& data_block_index() {
         return data_block_indexs_;
     }
+    size_t search_index_size() const {
+        return search_index_.binary_size();
+    }
 private:
     size_t binary_size_;
     size_t size_{0};
     std::vector<DataBlockIndexIndex> data_block_indexs_;
+    PrefixIndex search_index_;
+};
+
+// entries of one data block are buffered until the block is cut, the bloom filter needs them all
+class DataBlockBuilder {
+public:
+    void Add(std::string_view key, std::string_view value, ValueType type) {
+        if (cnt_ == 0) {
+            first_key_ = key;
+        }
+        PutFixed64(entries_, key.size());
+        PutFixed64(entries_, PackValueSize(value.size(), type));
+        key_offsets_.emplace_back(entries_.size());
+        entries_.append(key);
+        entries_.append(value);
+        ++cnt_;
+    }
+
+    bool empty() const {
+        return cnt_ == 0;
+    }
+
+    size_t entries_size() const {
+        return entries_.size();
+    }
+
+    const std::string& first_key() const {
+        return first_key_;
+    }
+
+    /*
+    appends |size|bloom_filter|cnt|entries|hash index| to dst and resets the builder, returns the block size.
+    the hash index has cnt / hash_ratio buckets, none when hash_ratio is 0 or the block holds more than kMaxHashEntries
+    */
+    size_t Finish(std::string& dst, double hash_ratio = 0) {
+        common::BloomFilter bloom_filter;
+        bloom_filter.Init(cnt_, 0.01);
+        std::string buckets;
+        if (hash_ratio > 0 && cnt_ <= kMaxHashEntries) {
+            buckets.assign(std::max<size_t>(cnt_ / hash_ratio, 1), static_cast<char>(kHashEmpty));
+        }
+        for (size_t i = 0; i < key_offsets_.size(); i++) {
+            auto key_offset = key_offsets_[i];
+            auto key_size = *reinterpret_cast<size_t*>(entries_.data() + key_offset - 2 * sizeof(size_t));
+            bloom_filter.Insert(entries_.data() + key_offset, key_size);
+            if (!buckets.empty()) {
+                auto& bucket = buckets[DataBlockHash(std::string_view(entries_.data() + key_offset, key_size)) % buckets.size()];
+                bucket = static_cast<uint8_t>(bucket) == kHashEmpty ? static_cast<char>(i) : static_cast<char>(kHashCollision);
+            }
+        }
+        if (!buckets.empty()) {
+            PutFixed64(buckets, buckets.size());
+        }
+        size_t size = 2 * sizeof(size_t) + bloom_filter.binary_size() + entries_.size() + buckets.size();
+        auto offset = dst.size();
+        dst.resize(offset + size);
+        char* s = dst.data() + offset;
+        size_t index = 0;
+        *reinterpret_cast<size_t*>(s) = size;
+        index += sizeof(size_t);
+        index += bloom_filter.Save(s + index);
+        *reinterpret_cast<size_t*>(s + index) = cnt_;
+        index += sizeof(size_t);
+        memcpy(s + index, entries_.data(), entries_.size());
+        memcpy(s + index + entries_.size(), buckets.data(), buckets.size());
+        entries_.clear();
+        key_offsets_.clear();
+        first_key_.clear();
+        cnt_ = 0;
+        return size;
+    }
+
+private:
+    std::string entries_;
+    std::vector<size_t> key_offsets_;
+    std::string first_key_;
+    size_t cnt_ = 0;
+};
+
+/*
+TableBuilder streams entries in key order into an sst file,
+only the current data block and the index are kept in memory
+*/
+class TableBuilder {
+public:
+    TableBuilder(std::string name, const TableOptions& options)
+        : name_(std::move(name)), options_(options), file_(options.use_direct_writes, write_buffer_size_, options.bytes_per_sync) {
+        file_.SetRateLimiter(options.rate_limiter.get(), options.write_priority);
+    }
+
+    void SetSeqRange(uint64_t smallest_seq, uint64_t largest_seq) {
+        properties_.smallest_seq = smallest_seq;
+        properties_.largest_seq = largest_seq;
+    }
+
+    // expected_size only preallocates
+    bool Open(size_t expected_size = 0) {
+        ok_ = file_.Open(name_, expected_size);
+        return ok_;
+    }
+
+    void Add(std::string_view key, std::string_view value, ValueType type = kTypeValue) {
+        properties_.Add(key, value, type);
+        if (options_.learned_index_max_error > 0) {
+            if (block_builder_.empty()) {
+                learned_index_.StartBlock();
+            }
+            learned_index_.Add(key);
+        }
+        block_builder_.Add(key, value, type);
+        if (block_builder_.entries_size() >= options_.block_size) {
+            FinishBlock();
+        }
+    }
+
+    // the file is synced before Finish returns, the manifest may reference it right after
+    bool Finish() {
+        if (!block_builder_.empty()) {
+            FinishBlock();
+        }
+        properties_.data_size = offset_;
+        Footer footer;
+        footer.index_offset = offset_;
+        footer.index_size = 2 * sizeof(size_t) + index_entries_.size();
+        footer.properties_offset = footer.index_offset + footer.index_size;
+        auto learned_index = options_.learned_index_max_error > 0 ?
+            learned_index_.Finish(options_.learned_index_max_error) : std::string();
+        footer.properties_size = properties_.binary_size() + learned_index.size();
+        std::string buf;
+        PutFixed64(buf, footer.index_size);
+        PutFixed64(buf, block_cnt_);
+        buf.append(index_entries_);
+        buf.resize(footer.index_size + footer.properties_size + Footer::binary_size);
+        auto properties_size = properties_.Save(buf.data() + footer.index_size);
+        memcpy(buf.data() + footer.index_size + properties_size, learned_index.data(), learned_index.size());
+        footer.Save(buf.data() + footer.index_size + footer.properties_size);
+        ok_ = ok_ && file_.Append(buf);
+        ok_ = file_.Close() && ok_;
+        file_size_ = footer.properties_offset + footer.properties_size + Footer::binary_size;
+        return ok_;
+    }
+
+    const TableProperties& properties() const {
+        return properties_;
+    }
+
+    size_t file_size() const {
+        return file_size_;
+    }
+
+private:
+    void FinishBlock() {
+        PutFixed64(index_entries_, offset_);
+        auto size_pos = index_entries_.size();
+        PutFixed64(index_entries_, 0);
+        PutFixed64(index_entries_, block_builder_.first_key().size());
+        index_entries_.append(block_builder_.first_key());
+        block_buf_.clear();
+        auto size = block_builder_.Finish(block_buf_, options_.data_block_hash_ratio);
+        *reinterpret_cast<size_t*>(index_entries_.data() + size_pos) = size;
+        ok_ = ok_ && file_.Append(block_buf_);
+        offset_ += size;
+        ++block_cnt_;
+    }
+
+private:
+    constexpr static const size_t write_buffer_size_ = 1024 * 1024;
+    std::string name_;
+    TableOptions options_;
+    common::WritableFile file_;
+    DataBlockBuilder block_builder_;
+    std::string block_buf_;
+    std::string index_entries_;
+    TableProperties properties_;
+    LearnedIndexBuilder learned_index_;
+    size_t offset_ = 0;
+    size_t block_cnt_ = 0;
+    size_t file_size_ = 0;
+    bool ok_ = false;
 };
 
 // no empty sst
@@ -210,203 +638,110 @@ class SST {
 public:
     class Iterator {
     public:
-        Iterator(SST* sst, bool rbegin = false): sst_(sst) {
+        // fill_cache = false for scans that should not wash out the block cache (compaction)
+        Iterator(SST* sst, bool rbegin = false, bool fill_cache = true): sst_(sst), fill_cache_(fill_cache) {
             if (rbegin) {
-                data_block_index_it_ = sst_->data_block_index().end();
-                --data_block_index_it_;
-                data_block_entry_it_ = data_block_index_it_->Get().data_index().end();
-                --data_block_entry_it_;
+                block_index_ = sst_->data_block_size() - 1;
+                LoadBlock();
+                entry_index_ = block_ ? block_->index.data_index().size() - 1 : 0;
             } else {
-                data_block_index_it_ = sst_->data_block_index().begin();
-                data_block_entry_it_ = data_block_index_it_->Get().data_index().begin();
+                block_index_ = 0;
+                LoadBlock();
+                entry_index_ = 0;
             }
         }
 
         EntryIndex& operator * () {
-            return *data_block_entry_it_;
+            return block_->index.data_index()[entry_index_];
         }
 
         bool operator ! () {
-            return data_block_index_it_ == sst_->data_block_index().end();
+            return block_ == nullptr;
+        }
+
+        // false once a block could not be read, the iterator then looks exhausted before the end of the table
+        bool status_ok() const {
+            return status_ok_;
         }
 
         Iterator& operator ++ () {
-            ++data_block_entry_it_;
-            if (data_block_entry_it_ == data_block_index_it_->Get().data_index().end()) {
-                ++data_block_index_it_;
-                data_block_entry_it_ = data_block_index_it_->Get().data_index().begin();
+            if (++entry_index_ == block_->index.data_index().size()) {
+                ++block_index_;
+                entry_index_ = 0;
+                LoadBlock();
             }
             return *this;
         }
+
+        // first entry with key >= target
+        void Seek(std::string_view target) {
+            auto i = sst_->index_block.Find(target);
+            block_index_ = i == size_t(-1) ? 0 : i;
+            entry_index_ = 0;
+            LoadBlock();
+            if (!block_) {
+                return;
+            }
+            auto& entries = block_->index.data_index();
+            entry_index_ = block_->index.LowerBound(target);
+            if (entry_index_ == entries.size()) {
+                ++block_index_;
+                entry_index_ = 0;
+                LoadBlock();
+            }
+        }
     private:
-        std::vector<DataBlockIndexIndex>::iterator data_block_index_it_;
-        std::vector<EntryIndex>::iterator data_block_entry_it_;
+        // blocks are read prefetch_blocks_ at a time with one MultiRead
+        void LoadBlock() {
+            block_ = nullptr;
+            if (block_index_ >= sst_->data_block_size()) {
+                return;
+            }
+            if (block_index_ < window_begin_ || block_index_ >= window_begin_ + window_.size()) {
+                window_begin_ = block_index_;
+                std::vector<size_t> indices;
+                for (size_t i = block_index_; i < sst_->data_block_size() && indices.size() < prefetch_blocks_; i++) {
+                    indices.emplace_back(i);
+                }
+                window_ = sst_->ReadBlocks(indices, fill_cache_);
+            }
+            block_ = window_[block_index_ - window_begin_];
+            if (!block_) {
+                std::cout << "sst " << sst_->id() << " read block " << block_index_ << " failed" << std::endl;
+                status_ok_ = false;
+            }
+        }
+
+    private:
+        constexpr static const size_t prefetch_blocks_ = 8;
         SST* sst_;
+        bool fill_cache_;
+        size_t block_index_ = 0;
+        size_t entry_index_ = 0;
+        std::shared_ptr<DataBlock> block_;
+        size_t window_begin_ = 0;
+        std::vector<std::shared_ptr<DataBlock> > window_;
+        bool status_ok_ = true;
     };
 
     SST() {}
 
-    SST(std::vector<EntryView> entries, int id) {
-
-        common::BloomFilter bloom_filter;
-        bloom_filter.Init(entries.size(), 0.01);
-        size_t data_block_size = sizeof(size_t); // data_block_size
-        size_t index_block_size = 2 * sizeof(size_t) * (entries.size() + 1);
-        index_block_size += (*entries.begin()).key.size();
-        for (auto it = entries.begin(); it != entries.end(); ++it) {
-            bloom_filter.Insert((*it).key.data(), (*it).key.size());
-            data_block_size += (*it).key.size() + (*it).value.size();
-        }
-        data_block_size += entries.size() * 2 * sizeof(size_t);
-        data_block_size += bloom_filter.binary_size();
-        data_block_size += sizeof(size_t); // cnt
-
-        file_size_ = index_block_size + data_block_size;
-        
-        id_ = id;
-        name_ = std::to_string(id_) + ".sst";
-        // std::cout << "open file " << std::endl;
-        fd_ = open(name_.c_str(), O_RDWR);
-        if (fd_ == -1) {
-            fd_ = open(name_.c_str(), O_RDWR | O_CREAT, 0700);
-        }
-
-        lseek(fd_, file_size_ - 1, SEEK_SET);
-        write(fd_, "1", 1);
-
-        // std::cout << " fd is " << fd_ << " size is " << file_size_ << std::endl;
-        data_ = (char*)mmap(NULL, file_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
-        // std::cout << " create data " << std::endl;
-        char* index_block_ptr = data_;
-        char* data_block_ptr = data_ + index_block_size;
-        size_t index_block_index = 0;
-        size_t data_block_index = 0;
-        // std::cout << "assign " << std::endl;
-        // memcpy(data_, &index_block_size, 4);
-        *reinterpret_cast<size_t*>(index_block_ptr) = index_block_size;
-        // std::cout << " index block size " << index_block_size << std::endl;
-        // std::cout << " data block size " << data_block_size << std::endl;
-        // std::cout << " bloom filter size " << bloom_filter.binary_size() << std::endl;
-        index_block_index += sizeof(size_t);
-        // std::cout << "assign 2" << std::endl;
-        *reinterpret_cast<size_t*>(index_block_ptr + index_block_index) = 1; // cnt
-        index_block_ptr += sizeof(size_t);
-        *reinterpret_cast<size_t*>(index_block_ptr + index_block_index) = index_block_size; // offset
-        index_block_index += sizeof(size_t);
-        *reinterpret_cast<size_t*>(index_block_ptr + index_block_index) = (*entries.begin()).key.size(); // key size
-        index_block_index += sizeof(size_t);
-        memcpy(index_block_ptr + index_block_index, (*entries.begin()).key.data(), (*entries.begin()).key.size());
-
-        // std::cout << "memcpy index_block" << std::endl;
-        // std::cout << "offset " << data_block_ptr - data_ << std::endl;
-        *reinterpret_cast<size_t*>(data_block_ptr) = data_block_size;
-        data_block_index += sizeof(size_t);
-        data_block_index += bloom_filter.Save(data_block_ptr + data_block_index);
-        *reinterpret_cast<size_t*>(data_block_ptr + data_block_index) = entries.size();
-        data_block_index += sizeof(size_t);
-        for (auto it = entries.begin(); it != entries.end(); ++it) {
-            *reinterpret_cast<size_t*>(data_block_ptr + data_block_index) = (*it).key.size();
-            data_block_index += sizeof(size_t);
-            *reinterpret_cast<size_t*>(data_block_ptr + data_block_index) = (*it).value.size();
-            data_block_index += sizeof(size_t);
-            memcpy(data_block_ptr + data_block_index, (*it).key.data(), (*it).key.size());
-            data_block_index += (*it).key.size();
-            memcpy(data_block_ptr + data_block_index, (*it).value.data(), (*it).value.size());
-            data_block_index += (*it).value.size();
-        }
-
-        // for (int i = 0; i < file_size_; i++) {
-        //     std::cout << int(data_[i]) << " ";
-        // } std::cout << std::endl;
-
-        // std::cout << "load index" << std::endl;
-
-        index_block.Load(data_);
-
-        // std::cout << " finish loaded " << std::endl;
-        loaded_ = true;
-        ready_ = true;
+    SST(std::vector<EntryView> entries, int id, uint64_t smallest_seq = 0, uint64_t largest_seq = 0, const TableOptions& options = TableOptions()) {
+        SetId(id);
+        SetOptions(options);
+        Build(entries.begin(), entries.end(), smallest_seq, largest_seq, 0);
     }
 
-    SST(MemeTable& memtable, size_t id) {
-        // std::cout << "make sst " << id << std::endl;
-        // 每个 memtable 保证了小于 pagesize，切分留到 compaction 做
-        common::BloomFilter bloom_filter;
-        bloom_filter.Init(memtable.size(), 0.01);
-        size_t data_block_size = sizeof(size_t); // data_block_size
-        size_t index_block_size = 2 * sizeof(size_t) * (memtable.size() + 1);
-        index_block_size += (*memtable.begin()).key.size();
-        std::cout << (*memtable.begin()).key.size() << " " << (*memtable.begin()).key << std::endl;
-        for (auto it = memtable.begin(); it != memtable.end(); ++it) {
-            bloom_filter.Insert((*it).key.c_str(), (*it).key.size());
-            data_block_size += (*it).key.size() + (*it).value.size();
-        }
-        data_block_size += memtable.size() * 2 * sizeof(size_t);
-        data_block_size += bloom_filter.binary_size();
-        data_block_size += sizeof(size_t); // cnt
-
-        file_size_ = index_block_size + data_block_size;
-        
-        id_ = id;
-        name_ = std::to_string(id_) + ".sst";
-        // std::cout << "open file " << std::endl;
-        fd_ = open(name_.c_str(), O_RDWR);
-        if (fd_ == -1) {
-            fd_ = open(name_.c_str(), O_RDWR | O_CREAT, 0700);
-        }
-
-        lseek(fd_, file_size_ - 1, SEEK_SET);
-        write(fd_, "1", 1);
-
-        // std::cout << " fd is " << fd_ << " size is " << file_size_ << std::endl;
-        data_ = (char*)mmap(NULL, file_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
-        // std::cout << " create data " << std::endl;
-        char* index_block_ptr = data_;
-        char* data_block_ptr = data_ + index_block_size;
-        size_t index_block_index = 0;
-        size_t data_block_index = 0;
-        *reinterpret_cast<size_t*>(index_block_ptr) = index_block_size;
-        // std::cout << " index block size " << index_block_size << std::endl;
-        // std::cout << " data block size " << data_block_size << std::endl;
-        // std::cout << " bloom filter size " << bloom_filter.binary_size() << std::endl;
-        index_block_index += sizeof(size_t);
-        *reinterpret_cast<size_t*>(index_block_ptr + index_block_index) = 1; // cnt
-        index_block_ptr += sizeof(size_t);
-        *reinterpret_cast<size_t*>(index_block_ptr + index_block_index) = index_block_size; // offset
-        index_block_index += sizeof(size_t);
-        *reinterpret_cast<size_t*>(index_block_ptr + index_block_index) = (*memtable.begin()).key.size(); // key size
-        index_block_index += sizeof(size_t);
-        memcpy(index_block_ptr + index_block_index, (*memtable.begin()).key.c_str(), (*memtable.begin()).key.size());
-
-        // std::cout << "memcpy index_block" << std::endl;
-        // std::cout << "offset " << data_block_ptr - data_ << std::endl;
-        *reinterpret_cast<size_t*>(data_block_ptr) = data_block_size;
-        data_block_index += sizeof(size_t);
-        data_block_index += bloom_filter.Save(data_block_ptr + data_block_index);
-        *reinterpret_cast<size_t*>(data_block_ptr + data_block_index) = memtable.size();
-        data_block_index += sizeof(size_t);
-        for (auto it = memtable.begin(); it != memtable.end(); ++it) {
-            *reinterpret_cast<size_t*>(data_block_ptr + data_block_index) = (*it).key.size();
-            data_block_index += sizeof(size_t);
-            *reinterpret_cast<size_t*>(data_block_ptr + data_block_index) = (*it).value.size();
-            data_block_index += sizeof(size_t);
-            memcpy(data_block_ptr + data_block_index, (*it).key.c_str(), (*it).key.size());
-            data_block_index += (*it).key.size();
-            memcpy(data_block_ptr + data_block_index, (*it).value.c_str(), (*it).value.size());
-            data_block_index += (*it).value.size();
-        }
-
-        // for (int i = 0; i < file_size_; i++) {
-        //     std::cout << int(data_[i]) << " ";
-        // } std::cout << std::endl;
-
-        // std::cout << "load index" << std::endl;
-
-        index_block.Load(data_);
-
-        // std::cout << " finish loaded " << std::endl;
-        loaded_ = true;
-        ready_ = true;
+    SST(MemeTable& memtable, size_t id, const TableOptions& options = TableOptions(), size_t path_id = 0) {
+        SetId(id);
+        SetOptions(options);
+        SetPathId(path_id);
+        BuildWith([&memtable](TableBuilder& builder) {
+            memtable.ForEach([&builder](std::string_view key, std::string_view value, ValueType type) {
+                builder.Add(key, value, type);
+                return true;
+            });
+        }, memtable.smallest_seq(), memtable.largest_seq(), memtable.binary_size());
     }
 
     Iterator begin() {
@@ -440,21 +775,66 @@ public:
         return file_size_;
     }
 
+    static std::string FileName(size_t id, const std::string& dir = "") {
+        return common::JoinPath(dir, std::to_string(id) + ".sst");
+    }
+
     void SetId(int id) {
         id_ = id;
-        name_ = std::to_string(id_) + ".sst";
+        name_ = FileName(id_, options_.Path(path_id_));
+    }
+
+    void SetOptions(const TableOptions& options) {
+        options_ = options;
+        name_ = FileName(id_, options_.Path(path_id_));
+    }
+
+    void SetPathId(size_t path_id) {
+        path_id_ = path_id;
+        name_ = FileName(id_, options_.Path(path_id_));
+    }
+
+    size_t path_id() const {
+        return path_id_;
     }
+
+    // only footer, properties and index block are read, data blocks are read on demand
     bool Load() {
-        fd_ = open(name_.c_str(), O_RDWR);
-        struct stat stat_buf;
-        stat(name_.c_str(), &stat_buf);
-        file_size_ = stat_buf.st_size;
-        // std::cout << "file size " << file_size_ << std::endl;
-        data_ = (char*)mmap(NULL, file_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
-        if (!data_) {
+        Close();
+        file_ = common::RandomAccessFile::New(options_.read_mode);
+        if (!file_->Open(name_)) {
+            file_ = nullptr;
+            return false;
+        }
+        file_size_ = file_->size();
+        Footer footer;
+        common::ReadRequest footer_read(file_size_ - Footer::binary_size, Footer::binary_size);
+        if (file_size_ < Footer::binary_size || !file_->Read(footer_read) || !footer.Load(footer_read.result.data())) {
+            std::cout << "sst " << id_ << " bad footer" << std::endl;
+            file_ = nullptr;
+            return false;
+        }
+        common::ReadRequest properties_read(footer.properties_offset, footer.properties_size);
+        index_read_ = common::ReadRequest(footer.index_offset, footer.index_size);
+        if (!file_->Read(properties_read) || !file_->Read(index_read_)) {
+            std::cout << "sst " << id_ << " read index failed" << std::endl;
+            file_ = nullptr;
             return false;
         }
-        index_block.Load(data_);
+        auto properties_size = properties_.Load(properties_read.result.data());
+        index_block.Load(const_cast<char*>(index_read_.result.data()));
+        // a model that does not match the file is not used
+        learned_index_.Clear();
+        if (footer.properties_size > properties_size &&
+                (!learned_index_.Load(properties_read.result.substr(properties_size), properties_.smallest_key) ||
+                 learned_index_.block_count() != index_block.data_block_size())) {
+            learned_index_.Clear();
+        }
+        if (options_.memory_budget) {
+            index_charge_ = footer.index_size + footer.properties_size +
+                index_block.data_block_index().capacity() * sizeof(DataBlockIndexIndex) + index_block.search_index_size();
+            options_.memory_budget->Reserve(MemoryConsumer::kTableIndex, index_charge_);
+        }
         loaded_ = true;
         ready_ = true;
         return true;
@@ -464,38 +844,241 @@ public:
         if (!loaded_) {
             return;
         }
-        // std::cout << " in close " << std::endl;
-        munmap(data_, file_size_);
-        // std::cout << "finish munmap" << std::endl;
-        if (fd_ != -1) {
-            close(fd_);
+        if (options_.memory_budget) {
+            options_.memory_budget->Release(MemoryConsumer::kTableIndex, index_charge_);
         }
+        index_charge_ = 0;
+        // blocks still cached keep their own reference to an mmaped file
+        file_ = nullptr;
         ready_ = false;
         loaded_ = false;
     }
 
     const std::string_view key() const {
-        return index_block.key();
+        return properties_.smallest_key;
+    }
+
+    const std::string_view largest_key() const {
+        return properties_.largest_key;
+    }
+
+    const TableProperties& properties() const {
+        return properties_;
+    }
+
+    // empty when the file has none or it did not fit
+    const LearnedIndex& learned_index() const {
+        return learned_index_;
+    }
+
+    // Gets searched only where the learned index put the key, and those its windows missed and searched in full
+    size_t learned_hit_cnt() const {
+        return learned_hit_cnt_;
+    }
+
+    size_t learned_fallback_cnt() const {
+        return learned_fallback_cnt_;
     }
 
     bool Get(std::string_view key, std::string& value) {
-        return index_block.Get(key, value);
+        ValueType type;
+        return Get(key, value, type);
     }
 
-    std::vector<DataBlockIndexIndex>& data_block_index() {
-        return index_block.data_block_index();
+    // type tells a plain value from a tombstone or a BlobIndex
+    bool Get(std::string_view key, std::string& value, ValueType& type) {
+        PinnableValue pinned;
+        if (!Get(key, pinned, type)) {
+            return false;
+        }
+        value.assign(pinned.view());
+        return true;
+    }
+
+    // value points into the data block and keeps it alive, no copy is made
+    bool Get(std::string_view key, PinnableValue& value, ValueType& type) {
+        size_t begin, end;
+        bool hit = true;
+        auto i = FindBlock(key, begin, end, hit);
+        if (i == size_t(-1)) {
+            CountLearned(hit);
+            return false;
+        }
+        auto block = ReadBlock(i);
+        if (!block) {
+            return false;
+        }
+        bool block_hit = true;
+        auto entry = block->index.Find(key, begin, end, &block_hit);
+        CountLearned(hit && block_hit);
+        if (entry == nullptr) {
+            return false;
+        }
+        type = entry->type;
+        value.Pin(entry->value, std::move(block));
+        return true;
+    }
+
+    // blocks of all keys are read in one batch, found[i] marks keys[i] as done and is skipped
+    size_t MultiGet(const std::vector<std::string_view>& keys, std::vector<std::string>& values, std::vector<bool>& found) {
+        std::vector<size_t> indices;
+        std::vector<size_t> key_block(keys.size(), -1);
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (found[i]) {
+                continue;
+            }
+            auto block_index = index_block.Find(keys[i]);
+            if (block_index == size_t(-1)) {
+                continue;
+            }
+            auto it = std::find(indices.begin(), indices.end(), block_index);
+            key_block[i] = it - indices.begin();
+            if (it == indices.end()) {
+                indices.emplace_back(block_index);
+            }
+        }
+        auto blocks = ReadBlocks(indices);
+        size_t cnt = 0;
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (key_block[i] == size_t(-1) || !blocks[key_block[i]]) {
+                continue;
+            }
+            if (blocks[key_block[i]]->index.Get(keys[i], values[i])) {
+                found[i] = true;
+                ++cnt;
+            }
+        }
+        return cnt;
+    }
+
+    std::shared_ptr<DataBlock> ReadBlock(size_t i, bool fill_cache = true) {
+        auto block = LookupBlock(i);
+        if (block) {
+            return block;
+        }
+        auto& block_index = index_block.data_block_index()[i];
+        common::ReadRequest read(block_index.offset(), block_index.size());
+        if (!file_->Read(read)) {
+            return nullptr;
+        }
+        return ParseBlock(i, std::move(read), fill_cache);
+    }
+
+    // uncached blocks go to the file as one MultiRead, io_uring submits them together
+    std::vector<std::shared_ptr<DataBlock> > ReadBlocks(const std::vector<size_t>& indices, bool fill_cache = true) {
+        std::vector<std::shared_ptr<DataBlock> > blocks(indices.size());
+        std::vector<size_t> missing;
+        std::vector<common::ReadRequest> reads;
+        for (size_t i = 0; i < indices.size(); i++) {
+            blocks[i] = LookupBlock(indices[i]);
+            if (!blocks[i]) {
+                auto& block_index = index_block.data_block_index()[indices[i]];
+                missing.emplace_back(i);
+                reads.emplace_back(block_index.offset(), block_index.size());
+            }
+        }
+        if (!missing.empty()) {
+            file_->MultiRead(reads);
+            for (size_t i = 0; i < missing.size(); i++) {
+                if (reads[i].ok) {
+                    blocks[missing[i]] = ParseBlock(indices[missing[i]], std::move(reads[i]), fill_cache);
+                }
+            }
+        }
+        return blocks;
+    }
+
+    size_t data_block_size() {
+        return index_block.data_block_size();
+    }
+private:
+    std::shared_ptr<DataBlock> LookupBlock(size_t i) {
+        if (!options_.block_cache) {
+            return nullptr;
+        }
+        return options_.block_cache->Lookup(id_, index_block.data_block_index()[i].offset());
+    }
+
+    /*
+    the only data block key can be in, -1 if it is before the first one.
+    with a learned index [begin, end] is where the model puts key in the block, otherwise the whole block
+    */
+    size_t FindBlock(std::string_view key, size_t& begin, size_t& end, bool& hit) {
+        begin = 0;
+        end = -1;
+        if (learned_index_.empty()) {
+            return index_block.Find(key);
+        }
+        size_t first, last;
+        learned_index_.Predict(key, first, last);
+        auto i = index_block.Find(key, learned_index_.BlockOf(first), learned_index_.BlockOf(last), &hit);
+        if (i != size_t(-1)) {
+            auto block_first = learned_index_.FirstRank(i);
+            begin = first > block_first ? first - block_first : 0;
+            end = last > block_first ? last - block_first : 0;
+        }
+        return i;
+    }
+
+    void CountLearned(bool hit) {
+        if (!learned_index_.empty()) {
+            ++(hit ? learned_hit_cnt_ : learned_fallback_cnt_);
+        }
+    }
+
+    std::shared_ptr<DataBlock> ParseBlock(size_t i, common::ReadRequest&& read, bool fill_cache) {
+        auto block = std::make_shared<DataBlock>();
+        if (file_->mmaped()) {
+            block->file = file_;
+        }
+        block->read = std::move(read);
+        block->index.Load(const_cast<char*>(block->read.result.data()), 0);
+        if (fill_cache && options_.block_cache) {
+            options_.block_cache->Insert(id_, index_block.data_block_index()[i].offset(), block, block->charge());
+        }
+        return block;
+    }
+
+    // It yields entries in key order with .key .value .type
+    template <typename It>
+    void Build(It begin, It end, uint64_t smallest_seq, uint64_t largest_seq, size_t expected_size) {
+        BuildWith([begin, end](TableBuilder& builder) {
+            for (auto it = begin; it != end; ++it) {
+                builder.Add((*it).key, (*it).value, (*it).type);
+            }
+        }, smallest_seq, largest_seq, expected_size);
+    }
+
+    // add(builder) adds the entries in key order
+    template <typename Add>
+    void BuildWith(Add&& add, uint64_t smallest_seq, uint64_t largest_seq, size_t expected_size) {
+        TableBuilder builder(name_, options_);
+        builder.SetSeqRange(smallest_seq, largest_seq);
+        bool ok = builder.Open(expected_size);
+        if (ok) {
+            add(builder);
+        }
+        if (!ok || !builder.Finish() || !Load()) {
+            std::cout << "write sst " << id_ << " failed" << std::endl;
+        }
     }
+
 private:
     bool ready_ = false;
     int64_t id_ = 0;
+    size_t path_id_ = 0;
     std::string name_;
-    char* data_;
-    int fd_ = -1;
+    TableOptions options_;
+    std::shared_ptr<common::RandomAccessFile> file_;
+    common::ReadRequest index_read_;
+    size_t index_charge_ = 0;
     IndexBlockIndex index_block;
+    TableProperties properties_;
+    LearnedIndex learned_index_;
+    std::atomic_size_t learned_hit_cnt_{0};
+    std::atomic_size_t learned_fallback_cnt_{0};
     bool loaded_ = false;
     size_t file_size_ = 0;
 };
-
-
 }
 }
\ No newline at end of file
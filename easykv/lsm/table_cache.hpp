@@ -0,0 +1,181 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "easykv/cache/concurrent_cache.hpp"
+#include "easykv/lsm/blob_file.hpp"
+#include "easykv/lsm/file_deleter.hpp"
+#include "easykv/lsm/sst.hpp"
+#include "easykv/lsm/version_edit.hpp"
+
+namespace easykv {
+namespace lsm {
+
+/*
+TableCache keeps at most capacity files open (at least one of each kind), a quarter is for blob files and the rest for ssts (fd + index),
+every other sst only lives in the manifest as FileMetaData and is opened on first access,
+all ssts share the TableOptions (read mode, block cache) given here.
+files leaving the manifest are closed here and handed to the FileDeleter once no version holds them
+*/
+class TableCache {
+    struct CachedTable {
+        explicit operator size_t() const {
+            return id;
+        }
+        size_t id;
+        std::shared_ptr<SST> sst;
+    };
+
+    struct CachedBlob {
+        explicit operator size_t() const {
+            return id;
+        }
+        size_t id;
+        std::shared_ptr<BlobFileReader> reader;
+    };
+
+    // a pinned blob value keeps its reader (and the mapping) and its read buffer alive
+    struct PinnedBlob {
+        std::shared_ptr<BlobFileReader> reader;
+        common::ReadRequest read;
+    };
+
+public:
+    explicit TableCache(size_t capacity = 1024, const TableOptions& options = TableOptions(), std::shared_ptr<FileDeleter> deleter = nullptr)
+        : cache_(capacity > BlobCapacity(capacity) ? capacity - BlobCapacity(capacity) : 1), blob_cache_(BlobCapacity(capacity)),
+          options_(options), deleter_(std::move(deleter)) {
+        if (!deleter_) {
+            deleter_ = std::make_shared<FileDeleter>();
+        }
+    }
+
+    // readers hold the returned sst, eviction only drops the cache's reference
+    std::shared_ptr<SST> Get(const FileMetaData& meta) {
+        auto cached = cache_.Get(meta.id);
+        if (cached) {
+            return cached->sst;
+        }
+        auto sst_ptr = std::make_shared<SST>();
+        sst_ptr->SetId(meta.id);
+        sst_ptr->SetOptions(options_);
+        sst_ptr->SetPathId(meta.path_id);
+        if (!sst_ptr->Load()) {
+            std::cout << "open sst " << meta.id << " failed" << std::endl;
+            return nullptr;
+        }
+        ++open_cnt_;
+        CachedTable table{meta.id, sst_ptr};
+        cache_.Put(table);
+        return sst_ptr;
+    }
+
+    // register a freshly written sst, it is still open so keep it hot
+    std::shared_ptr<FileMetaData> Insert(std::shared_ptr<SST> sst) {
+        auto meta = std::make_shared<FileMetaData>();
+        meta->id = sst->id();
+        meta->file_size = sst->binary_size();
+        meta->path_id = sst->path_id();
+        meta->properties = sst->properties();
+        CachedTable table{meta->id, std::move(sst)};
+        cache_.Put(table);
+        return meta;
+    }
+
+    // drop the open sst of id, e.g. one whose file moves to another path before any version holds it
+    void Erase(size_t id) {
+        cache_.Erase(id);
+    }
+
+    // blob readers are kept in their own part of the open file budget
+    std::shared_ptr<BlobFileReader> GetBlob(size_t id) {
+        auto cached = blob_cache_.Get(id);
+        if (cached) {
+            return cached->reader;
+        }
+        auto reader = std::make_shared<BlobFileReader>();
+        if (!reader->Open(id, options_.read_mode, options_.db_path)) {
+            return nullptr;
+        }
+        CachedBlob blob{id, reader};
+        blob_cache_.Put(blob);
+        return reader;
+    }
+
+    // value of an entry of type kTypeBlobIndex
+    bool ReadBlob(std::string_view encoded, std::string& value) {
+        BlobIndex index;
+        if (!index.Decode(encoded)) {
+            return false;
+        }
+        auto reader = GetBlob(index.file_id);
+        return reader && reader->Get(index, value);
+    }
+
+    bool ReadBlob(std::string_view encoded, PinnableValue& value) {
+        BlobIndex index;
+        if (!index.Decode(encoded)) {
+            return false;
+        }
+        auto blob = std::make_shared<PinnedBlob>();
+        blob->reader = GetBlob(index.file_id);
+        if (!blob->reader || !blob->reader->Read(index, blob->read)) {
+            return false;
+        }
+        auto result = blob->read.result;
+        value.Pin(result, std::move(blob));
+        return true;
+    }
+
+    // meta left the newest version, versions still holding it may open the sst again until they are released
+    void MarkObsolete(FileMetaData& meta) {
+        cache_.Erase(meta.id);
+        auto name = SST::FileName(meta.id, options_.Path(meta.path_id));
+        meta.on_obsolete = [deleter = deleter_, name](const FileMetaData&) {
+            deleter->Schedule(name);
+        };
+    }
+
+    // the same for a blob file, blob readers in flight keep it mapped or open until they are done too
+    void MarkObsolete(BlobFileMeta& meta) {
+        blob_cache_.Erase(meta.id);
+        auto name = BlobFileName(meta.id, options_.db_path);
+        meta.handle->on_obsolete = [deleter = deleter_, name]() {
+            deleter->Schedule(name);
+        };
+    }
+
+    const TableOptions& options() const {
+        return options_;
+    }
+
+    FileDeleter& deleter() {
+        return *deleter_;
+    }
+
+    size_t size() const {
+        return cache_.TrueSize();
+    }
+
+    // how many times an sst had to be opened from disk
+    size_t open_cnt() const {
+        return open_cnt_;
+    }
+
+private:
+    static size_t BlobCapacity(size_t capacity) {
+        return std::max<size_t>(capacity / 4, 1);
+    }
+
+private:
+    cpputil::cache::ConcurrentLRUCache<size_t, CachedTable> cache_;
+    cpputil::cache::ConcurrentLRUCache<size_t, CachedBlob> blob_cache_;
+    TableOptions options_;
+    std::shared_ptr<FileDeleter> deleter_;
+    std::atomic_size_t open_cnt_{0};
+};
+
+}
+}
@@ -0,0 +1,426 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "easykv/lsm/blob_file.hpp"
+#include "easykv/lsm/sst.hpp"
+
+namespace easykv {
+namespace lsm {
+
+/*
+FileMetaData in file
+|id(size_t)|file_size(size_t)|path_id(size_t)|TableProperties|
+
+VersionEdit in file
+|next_file_id(size_t)|last_sequence(size_t)|added_cnt(size_t)|(level, FileMetaData)...|deleted_cnt(size_t)|(level, id)...|
+|added_blob_cnt(size_t)|BlobFileMeta...|deleted_blob_cnt(size_t)|id...|blob_garbage_cnt(size_t)|(id, count, bytes)...|
+
+ManifestLog in file
+|(record_size(size_t) | checksum(size_t) | VersionEdit)...|
+*/
+
+// everything the manifest knows about an sst without opening it
+struct FileMetaData {
+    size_t id = 0;
+    size_t file_size = 0;
+    size_t path_id = 0; // data directory, see TableOptions::Path
+    TableProperties properties;
+    // set once the file left the newest version, runs when the last version holding it is released
+    std::function<void(const FileMetaData&)> on_obsolete;
+
+    ~FileMetaData() {
+        if (on_obsolete) {
+            on_obsolete(*this);
+        }
+    }
+
+    const std::string& smallest() const {
+        return properties.smallest_key;
+    }
+
+    const std::string& largest() const {
+        return properties.largest_key;
+    }
+
+    size_t binary_size() const {
+        return 3 * sizeof(size_t) + properties.binary_size();
+    }
+
+    size_t Save(char* s) const {
+        size_t index = 0;
+        *reinterpret_cast<size_t*>(s + index) = id;
+        index += sizeof(size_t);
+        *reinterpret_cast<size_t*>(s + index) = file_size;
+        index += sizeof(size_t);
+        *reinterpret_cast<size_t*>(s + index) = path_id;
+        index += sizeof(size_t);
+        index += properties.Save(s + index);
+        return index;
+    }
+
+    size_t Load(char* s) {
+        size_t index = 0;
+        id = *reinterpret_cast<size_t*>(s + index);
+        index += sizeof(size_t);
+        file_size = *reinterpret_cast<size_t*>(s + index);
+        index += sizeof(size_t);
+        path_id = *reinterpret_cast<size_t*>(s + index);
+        index += sizeof(size_t);
+        index += properties.Load(s + index);
+        return index;
+    }
+
+    bool Overlap(std::string_view key) const {
+        return key >= smallest() && key <= largest();
+    }
+};
+
+class VersionEdit {
+public:
+    void AddFile(size_t level, std::shared_ptr<FileMetaData> meta) {
+        if (meta->id > next_file_id_) {
+            next_file_id_ = meta->id;
+        }
+        added_files_.emplace_back(level, std::move(meta));
+    }
+
+    void DeleteFile(size_t level, size_t id) {
+        deleted_files_.emplace_back(level, id);
+    }
+
+    void AddBlobFile(std::shared_ptr<BlobFileMeta> meta) {
+        SetNextFileId(meta->id);
+        added_blob_files_.emplace_back(std::move(meta));
+    }
+
+    void DeleteBlobFile(size_t id) {
+        deleted_blob_files_.emplace_back(id);
+    }
+
+    // a dropped entry pointed at bytes of blob file id
+    void AddBlobGarbage(size_t id, size_t bytes) {
+        for (auto& garbage : blob_garbages_) {
+            if (garbage.id == id) {
+                ++garbage.count;
+                garbage.bytes += bytes;
+                return;
+            }
+        }
+        blob_garbages_.push_back(BlobGarbage{id, 1, bytes});
+    }
+
+    void SetNextFileId(size_t id) {
+        if (id > next_file_id_) {
+            next_file_id_ = id;
+        }
+    }
+
+    size_t next_file_id() const {
+        return next_file_id_;
+    }
+
+    void SetLastSequence(uint64_t seq) {
+        if (seq > last_sequence_) {
+            last_sequence_ = seq;
+        }
+    }
+
+    uint64_t last_sequence() const {
+        return last_sequence_;
+    }
+
+    bool empty() const {
+        return added_files_.empty() && deleted_files_.empty() && added_blob_files_.empty()
+            && deleted_blob_files_.empty() && blob_garbages_.empty();
+    }
+
+    const std::vector<std::pair<size_t, std::shared_ptr<FileMetaData> > >& added_files() const {
+        return added_files_;
+    }
+
+    const std::vector<std::pair<size_t, size_t> >& deleted_files() const {
+        return deleted_files_;
+    }
+
+    const std::vector<std::shared_ptr<BlobFileMeta> >& added_blob_files() const {
+        return added_blob_files_;
+    }
+
+    const std::vector<size_t>& deleted_blob_files() const {
+        return deleted_blob_files_;
+    }
+
+    struct BlobGarbage {
+        size_t id;
+        size_t count;
+        size_t bytes;
+    };
+
+    const std::vector<BlobGarbage>& blob_garbages() const {
+        return blob_garbages_;
+    }
+
+    size_t binary_size() const {
+        size_t res = 4 * sizeof(size_t) + sizeof(size_t) * added_files_.size() + 2 * sizeof(size_t) * deleted_files_.size();
+        for (auto& [level, meta] : added_files_) {
+            res += meta->binary_size();
+        }
+        res += 3 * sizeof(size_t) + BlobFileMeta::binary_size * added_blob_files_.size()
+            + sizeof(size_t) * deleted_blob_files_.size() + 3 * sizeof(size_t) * blob_garbages_.size();
+        return res;
+    }
+
+    size_t Save(char* s) const {
+        size_t index = 0;
+        *reinterpret_cast<size_t*>(s + index) = next_file_id_;
+        index += sizeof(size_t);
+        *reinterpret_cast<size_t*>(s + index) = last_sequence_;
+        index += sizeof(size_t);
+        *reinterpret_cast<size_t*>(s + index) = added_files_.size();
+        index += sizeof(size_t);
+        for (auto& [level, meta] : added_files_) {
+            *reinterpret_cast<size_t*>(s + index) = level;
+            index += sizeof(size_t);
+            index += meta->Save(s + index);
+        }
+        *reinterpret_cast<size_t*>(s + index) = deleted_files_.size();
+        index += sizeof(size_t);
+        for (auto& [level, id] : deleted_files_) {
+            *reinterpret_cast<size_t*>(s + index) = level;
+            index += sizeof(size_t);
+            *reinterpret_cast<size_t*>(s + index) = id;
+            index += sizeof(size_t);
+        }
+        *reinterpret_cast<size_t*>(s + index) = added_blob_files_.size();
+        index += sizeof(size_t);
+        for (auto& meta : added_blob_files_) {
+            index += meta->Save(s + index);
+        }
+        *reinterpret_cast<size_t*>(s + index) = deleted_blob_files_.size();
+        index += sizeof(size_t);
+        for (auto id : deleted_blob_files_) {
+            *reinterpret_cast<size_t*>(s + index) = id;
+            index += sizeof(size_t);
+        }
+        *reinterpret_cast<size_t*>(s + index) = blob_garbages_.size();
+        index += sizeof(size_t);
+        for (auto& garbage : blob_garbages_) {
+            for (auto field : {garbage.id, garbage.count, garbage.bytes}) {
+                *reinterpret_cast<size_t*>(s + index) = field;
+                index += sizeof(size_t);
+            }
+        }
+        return index;
+    }
+
+    size_t Load(char* s) {
+        size_t index = 0;
+        next_file_id_ = *reinterpret_cast<size_t*>(s + index);
+        index += sizeof(size_t);
+        last_sequence_ = *reinterpret_cast<size_t*>(s + index);
+        index += sizeof(size_t);
+        auto added_cnt = *reinterpret_cast<size_t*>(s + index);
+        index += sizeof(size_t);
+        added_files_.clear();
+        added_files_.reserve(added_cnt);
+        for (size_t i = 0; i < added_cnt; i++) {
+            auto level = *reinterpret_cast<size_t*>(s + index);
+            index += sizeof(size_t);
+            auto meta = std::make_shared<FileMetaData>();
+            index += meta->Load(s + index);
+            added_files_.emplace_back(level, std::move(meta));
+        }
+        auto deleted_cnt = *reinterpret_cast<size_t*>(s + index);
+        index += sizeof(size_t);
+        deleted_files_.clear();
+        deleted_files_.reserve(deleted_cnt);
+        for (size_t i = 0; i < deleted_cnt; i++) {
+            auto level = *reinterpret_cast<size_t*>(s + index);
+            index += sizeof(size_t);
+            deleted_files_.emplace_back(level, *reinterpret_cast<size_t*>(s + index));
+            index += sizeof(size_t);
+        }
+        auto added_blob_cnt = *reinterpret_cast<size_t*>(s + index);
+        index += sizeof(size_t);
+        added_blob_files_.clear();
+        for (size_t i = 0; i < added_blob_cnt; i++) {
+            auto meta = std::make_shared<BlobFileMeta>();
+            index += meta->Load(s + index);
+            added_blob_files_.emplace_back(std::move(meta));
+        }
+        auto deleted_blob_cnt = *reinterpret_cast<size_t*>(s + index);
+        index += sizeof(size_t);
+        deleted_blob_files_.clear();
+        for (size_t i = 0; i < deleted_blob_cnt; i++) {
+            deleted_blob_files_.emplace_back(*reinterpret_cast<size_t*>(s + index));
+            index += sizeof(size_t);
+        }
+        auto blob_garbage_cnt = *reinterpret_cast<size_t*>(s + index);
+        index += sizeof(size_t);
+        blob_garbages_.clear();
+        for (size_t i = 0; i < blob_garbage_cnt; i++) {
+            BlobGarbage garbage;
+            garbage.id = *reinterpret_cast<size_t*>(s + index);
+            garbage.count = *reinterpret_cast<size_t*>(s + index + sizeof(size_t));
+            garbage.bytes = *reinterpret_cast<size_t*>(s + index + 2 * sizeof(size_t));
+            index += 3 * sizeof(size_t);
+            blob_garbages_.emplace_back(garbage);
+        }
+        return index;
+    }
+
+private:
+    size_t next_file_id_ = 0;
+    uint64_t last_sequence_ = 0;
+    std::vector<std::pair<size_t, std::shared_ptr<FileMetaData> > > added_files_;
+    std::vector<std::pair<size_t, size_t> > deleted_files_;
+    std::vector<std::shared_ptr<BlobFileMeta> > added_blob_files_;
+    std::vector<size_t> deleted_blob_files_;
+    std::vector<BlobGarbage> blob_garbages_;
+};
+
+// append-only log of VersionEdit, every record is fsynced before the version is installed
+class ManifestLog {
+public:
+    explicit ManifestLog(std::string name = "manifest.log"): name_(std::move(name)) {}
+
+    ~ManifestLog() {
+        Close();
+    }
+
+    bool Open() {
+        fd_ = open(name_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0700);
+        return fd_ != -1;
+    }
+
+    void Close() {
+        if (fd_ != -1) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    bool Append(const VersionEdit& edit) {
+        return Append(std::vector<VersionEdit>{edit});
+    }
+
+    /*
+    one fdatasync for the whole batch, a torn tail only loses a suffix of it.
+    a failed append is cut off again (best effort), its version is never installed
+    */
+    bool Append(const std::vector<VersionEdit>& edits) {
+        std::string buf;
+        for (auto& edit : edits) {
+            auto offset = buf.size();
+            buf.resize(offset + 2 * sizeof(size_t) + edit.binary_size());
+            auto record_size = edit.Save(buf.data() + offset + 2 * sizeof(size_t));
+            *reinterpret_cast<size_t*>(buf.data() + offset) = record_size;
+            *reinterpret_cast<size_t*>(buf.data() + offset + sizeof(size_t)) = Checksum(buf.data() + offset + 2 * sizeof(size_t), record_size);
+        }
+        auto offset = lseek(fd_, 0, SEEK_END);
+        if (offset == -1) {
+            return false;
+        }
+        size_t written = 0;
+        while (written < buf.size()) {
+            auto n = write(fd_, buf.data() + written, buf.size() - written);
+            if (n <= 0) {
+                Truncate(offset);
+                return false;
+            }
+            written += n;
+        }
+        if (fdatasync(fd_) != 0) {
+            Truncate(offset);
+            return false;
+        }
+        record_cnt_ += edits.size();
+        return true;
+    }
+
+    // drop every record, called after a snapshot covering them is durable
+    bool Reset() {
+        if (ftruncate(fd_, 0) != 0) {
+            return false;
+        }
+        record_cnt_ = 0;
+        return fdatasync(fd_) == 0;
+    }
+
+    // stops at the first torn or corrupted record, it was never acknowledged
+    template <typename F>
+    size_t Replay(F&& apply) {
+        auto fd = open(name_.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return 0;
+        }
+        struct stat stat_buf;
+        fstat(fd, &stat_buf);
+        size_t file_size = stat_buf.st_size;
+        size_t cnt = 0;
+        if (file_size > 0) {
+            auto data = (char*)mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            size_t index = 0;
+            while (index + 2 * sizeof(size_t) <= file_size) {
+                auto record_size = *reinterpret_cast<size_t*>(data + index);
+                auto checksum = *reinterpret_cast<size_t*>(data + index + sizeof(size_t));
+                index += 2 * sizeof(size_t);
+                if (record_size > file_size - index || Checksum(data + index, record_size) != checksum) {
+                    break;
+                }
+                VersionEdit edit;
+                edit.Load(data + index);
+                apply(edit);
+                index += record_size;
+                ++cnt;
+            }
+            munmap(data, file_size);
+        }
+        close(fd);
+        record_cnt_ = cnt;
+        return cnt;
+    }
+
+    size_t record_cnt() const {
+        return record_cnt_;
+    }
+
+private:
+    void Truncate(off_t size) {
+        if (ftruncate(fd_, size) != 0 || fdatasync(fd_) != 0) {
+            std::cout << "truncate " << name_ << " to " << size << " failed" << std::endl;
+        }
+    }
+
+    static size_t Checksum(const char* s, size_t len) {
+        size_t res = 14695981039346656037ull; // fnv-1a
+        for (size_t i = 0; i < len; i++) {
+            res ^= static_cast<unsigned char>(s[i]);
+            res *= 1099511628211ull;
+        }
+        return res;
+    }
+
+private:
+    std::string name_;
+    int fd_ = -1;
+    size_t record_cnt_ = 0;
+};
+
+}
+}
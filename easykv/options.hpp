@@ -0,0 +1,94 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "easykv/lsm/compaction_filter.hpp"
+#include "easykv/lsm/memory_budget.hpp"
+#include "easykv/lsm/memtable_rep.hpp"
+#include "easykv/lsm/merge_operator.hpp"
+#include "easykv/utils/file.hpp"
+#include "easykv/utils/rate_limiter.hpp"
+
+namespace easykv {
+
+struct DBOptions {
+    // directory of the manifest, ssts and blob files, created on open. empty is the working directory
+    std::string db_path;
+    // data directories by level, level i goes to level_paths[min(i, size - 1)], e.g. {nvme, nvme, ssd}.
+    // empty keeps every sst in db_path
+    std::vector<std::string> level_paths;
+    // core the flush and compaction thread is pinned to, -1 leaves it to the scheduler
+    int flush_cpu = -1;
+    // a memtable is handed to the flush thread once it holds write_buffer_size bytes
+    size_t write_buffer_size = 3 * 1024 * 1024;
+    // memtables, block cache and sst indexes are charged to it, share one between DBs to bound a host.
+    // nullptr leaves memory unbounded
+    std::shared_ptr<lsm::MemoryBudget> memory_budget;
+    // upper bound of ssts and blob files kept open by the table cache, a quarter of it goes to blob files
+    size_t max_open_files = 1024;
+    // target size of an sst data block, the unit of reads and of the block cache
+    size_t block_size = 4096;
+    // bytes of parsed data blocks kept in memory, 0 disables the block cache
+    size_t block_cache_capacity = 64 * 1024 * 1024;
+    // kDirect/kIoUring keep cold reads off the page cache, kMmap is the old behaviour
+    common::ReadMode read_mode = common::ReadMode::kMmap;
+    // flush and compaction write ssts with O_DIRECT, their pages never become dirty page cache
+    bool use_direct_writes = false;
+    // start writeback of a new sst every bytes_per_sync bytes instead of one burst at the end
+    size_t bytes_per_sync = 1024 * 1024;
+    // values of at least min_blob_size are kept in blob files at flush, the lsm only holds a BlobIndex.
+    // 0 keeps every value inline
+    size_t min_blob_size = 0;
+    // a blob file is rewritten once this share of its bytes is no longer referenced
+    double blob_gc_garbage_ratio = 0.5;
+    // > 0 adds a hash index to each data block for O(1) point lookups inside it, about 1 / ratio bytes per entry.
+    // 0.75 is a good start, 0 builds none
+    double data_block_hash_ratio = 0;
+    // > 0 stores a piecewise linear model of key -> position in each new sst, Gets then search only the window
+    // it predicts. a file whose model is off by more than this many entries gets none, and so does every file at 1:
+    // the model needs one entry of slack for rounding, 2 is the least that builds one
+    size_t learned_index_max_error = 0;
+    // kSkipList is sorted as it is written. kHashLinkList serves point Gets from hash buckets,
+    // kVector only appends and suits bulk loads: both sort when scanned or frozen.
+    // kArt is a radix tree, lookups cost the key length instead of full key compares, for long shared prefixes
+    lsm::MemTableRepType memtable_rep = lsm::MemTableRepType::kSkipList;
+    // buckets of a kHashLinkList memtable, fixed for its lifetime
+    size_t memtable_hash_bucket_count = 1 << 14;
+    // a background thread packs every immutable memtable into a sorted array (FrozenMemTable) for lock free Gets
+    // until it is flushed, the memtable is held twice meanwhile
+    bool freeze_immutable_memtables = true;
+    // rows kept by the hot-key cache consulted first by Get, 0 disables it
+    size_t row_cache_capacity = 0;
+    // folds the operands written by DB::Merge, nullptr refuses merges
+    std::shared_ptr<lsm::MergeOperator> merge_operator;
+    // drops or rewrites values while they are compacted, nullptr keeps them
+    std::shared_ptr<lsm::CompactionFilterFactory> compaction_filter_factory;
+    // obsolete ssts and blob files are unlinked by a background thread at this rate, 0 unlinks them at once
+    size_t delete_rate_bytes_per_sec = 0;
+    // the flush thread rewrites ssts holding expired ttl values this often, 0 leaves it to DB::CompactExpired
+    size_t ttl_compaction_period_ms = 0;
+    // paces sst and blob writes of flushes and compactions, flushes first. share one between DBs on a device.
+    // an auto tuned limiter is tuned by the compaction debt of this db. nullptr writes at full speed
+    std::shared_ptr<common::RateLimiter> rate_limiter;
+};
+
+struct ShardedDBOptions {
+    enum class Partition {
+        kHash,
+        kRange,
+    };
+    size_t shard_num = 4;
+    Partition partition = Partition::kHash;
+    // kRange only: sorted, shard i holds [split_keys[i - 1], split_keys[i]), shard_num is split_keys.size() + 1
+    std::vector<std::string> split_keys;
+    // every shard is a DB in path/shard_<i>
+    std::string path = "shards";
+    // the flush thread of shard i runs on core i % hardware threads
+    bool pin_cpus = false;
+    // db_path and flush_cpu are set per shard
+    DBOptions db_options;
+};
+
+}
\ No newline at end of file
@@ -239,7 +239,7 @@ public:
             rsp.set_allocated_base(base);
             return;
         }
-        if (!InnerPut(req.key(), req.value())) {
+        if (!InnerPut(req.key(), req.value(), req.mode())) {
             auto base = new Base;
             base->set_code(-1);
             rsp.set_allocated_base(base);
@@ -262,13 +262,13 @@ public:
             rsp->set_allocated_leader_addr(addr);
             return;
         }
-        std::string value;
+        easykv::lsm::PinnableValue value; // copied once, straight into the response
         bool res = db_->Get(req->key(), value);
         if (!res) {
             auto base = new raft::Base();
             base->set_code(1); // empty
         } else {
-            rsp->set_value(value);
+            rsp->set_value(value.data(), value.size());
         }
     }
 
@@ -300,10 +300,11 @@ public:
     }
     
 private:
-    bool InnerPut(const std::string& key, const std::string& value) {
+    // mode is Entry.mode, a merge replicates as one entry like a put
+    bool InnerPut(const std::string& key, const std::string& value, int32_t mode = 0) {
         //TODO 用异步回调优化
         size_t now_idx;
-        if (!raft_log_.Put(key, value, term_, now_idx)) {
+        if (!raft_log_.Put(key, value, term_, now_idx, mode)) {
             return false;
         }
         while (true) {
@@ -3,6 +3,7 @@
 #include <array>
 #include <atomic>
 #include <cstddef>
+#include <iostream>
 #include <mutex>
 #include <string>
 
@@ -44,11 +45,16 @@ public:
                 sleep(3);
                 // usleep(10000);
                 std::unique_lock<std::mutex> lock(lock_);
-                if (last_append_ < commited_) {
+                if (last_append_ < commited_ && !apply_failed_) {
                     lock.unlock();
-                    ++last_append_;
-                    auto& entry = queue_.At(last_append_ - start_index_ - 1);
-                    db_->Put(entry.key(), entry.value());
+                    auto& entry = queue_.At(last_append_ - start_index_);
+                    if (Apply(entry)) {
+                        ++last_append_;
+                    } else {
+                        // skipping the entry would let this replica diverge, nothing after it is applied
+                        std::cout << "apply raft entry " << entry.index() << " failed" << std::endl;
+                        apply_failed_ = true;
+                    }
                 } else {
                     lock.unlock();
                     if (stop_) {
@@ -88,7 +94,7 @@ public:
         return queue_.RAt(index_ - index);
     }
 
-    bool Put(const std::string& key, const std::string& value, int64_t term, size_t& idx) {
+    bool Put(const std::string& key, const std::string& value, int64_t term, size_t& idx, int32_t mode = 0) {
         std::unique_lock<std::mutex> guard(lock_);
         if (stop_) {
             return false;
@@ -97,7 +103,7 @@ public:
         entry.set_index(index_ + 1);
         entry.set_key(key);
         entry.set_value(value);
-        entry.set_mode(0);
+        entry.set_mode(mode);
         entry.set_term(term);
         if (queue_.PushBack(entry)) {
             ++index_;
@@ -143,11 +149,27 @@ public:
     //     return queue_.RAt(index_ - index) == entry;
     // }
 
+    // a committed entry could not be applied to the db, e.g. a merge without a merge operator
+    bool apply_failed() const {
+        return apply_failed_;
+    }
+
     void UpdateCommit(size_t leader_commit) {
         std::unique_lock<std::mutex> lock(lock_);
         commited_ = std::max(commited_, std::min(index_.load(), leader_commit));
     }
 private:
+    bool Apply(const Entry& entry) {
+        if (entry.mode() == 1) {
+            db_->Delete(entry.key());
+        } else if (entry.mode() == 2) {
+            return db_->Merge(entry.key(), entry.value());
+        } else {
+            db_->Put(entry.key(), entry.value());
+        }
+        return true;
+    }
+
     void Load(char* s) {
         start_index_ = index_ = commited_ = last_append_ = *reinterpret_cast<size_t*>(s);
     }
@@ -160,6 +182,7 @@ private:
     std::mutex lock_;
     std::thread sync_thread;
     std::atomic_bool stop_{false};
+    std::atomic_bool apply_failed_{false};
     std::atomic_size_t index_;
     cpputil::pbds::RingBufferQueue<Entry> queue_;
     size_t commited_;
@@ -0,0 +1,142 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "easykv/db.hpp"
+#include "easykv/lsm/iterator.hpp"
+#include "easykv/lsm/pinnable_value.hpp"
+#include "easykv/options.hpp"
+#include "easykv/utils/file.hpp"
+#include "easykv/write_batch.hpp"
+
+namespace easykv {
+
+/*
+ShardedDB partitions keys over independent DBs, each with its own directory, memtable,
+locks and flush thread, so writers on different shards never contend.
+kHash spreads keys evenly, kRange keeps ranges together so a scan touches few shards.
+batches and MultiGet are split per shard, iterators merge the shards back into key order
+*/
+class ShardedDB {
+public:
+    explicit ShardedDB(const ShardedDBOptions& options = ShardedDBOptions()): options_(options) {
+        if (options_.partition == ShardedDBOptions::Partition::kRange) {
+            options_.shard_num = options_.split_keys.size() + 1;
+        }
+        options_.shard_num = std::max<size_t>(options_.shard_num, 1);
+        common::CreateDirs(options_.path);
+        auto cpu_num = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        shards_.reserve(options_.shard_num);
+        for (size_t i = 0; i < options_.shard_num; i++) {
+            auto db_options = options_.db_options;
+            db_options.db_path = common::JoinPath(options_.path, "shard_" + std::to_string(i));
+            db_options.flush_cpu = options_.pin_cpus ? static_cast<int>(i % cpu_num) : -1;
+            shards_.emplace_back(std::make_unique<DB>(db_options));
+        }
+    }
+
+    size_t Shard(std::string_view key) const {
+        if (options_.partition == ShardedDBOptions::Partition::kRange) {
+            return std::upper_bound(options_.split_keys.begin(), options_.split_keys.end(), key) - options_.split_keys.begin();
+        }
+        // the row cache stripes on the plain hash, the shard takes the high bits of a remix
+        auto hash = std::hash<std::string_view>()(key) * 0x9e3779b97f4a7c15ull;
+        return (hash >> 32) % shards_.size();
+    }
+
+    bool Get(std::string_view key, std::string& value) {
+        return shards_[Shard(key)]->Get(key, value);
+    }
+
+    bool Get(std::string_view key, lsm::PinnableValue& value) {
+        return shards_[Shard(key)]->Get(key, value);
+    }
+
+    void Put(std::string_view key, std::string_view value) {
+        shards_[Shard(key)]->Put(key, value);
+    }
+
+    void Put(std::string_view key, std::string_view value, std::chrono::milliseconds ttl) {
+        shards_[Shard(key)]->Put(key, value, ttl);
+    }
+
+    void Delete(std::string_view key) {
+        shards_[Shard(key)]->Delete(key);
+    }
+
+    bool Merge(std::string_view key, std::string_view operand) {
+        return shards_[Shard(key)]->Merge(key, operand);
+    }
+
+    // every shard gets its part of the batch in the original order
+    void Write(const WriteBatch& batch) {
+        std::vector<WriteBatch> batches(shards_.size());
+        for (auto& entry : batch.entries()) {
+            batches[Shard(entry.key)].Append(entry);
+        }
+        for (size_t i = 0; i < shards_.size(); i++) {
+            if (batches[i].size() > 0) {
+                shards_[i]->Write(batches[i]);
+            }
+        }
+    }
+
+    // values and found are resized to keys, returns how many keys were found
+    size_t MultiGet(const std::vector<std::string_view>& keys, std::vector<std::string>& values, std::vector<bool>& found) {
+        values.resize(keys.size());
+        found.assign(keys.size(), false);
+        std::vector<std::vector<size_t> > positions(shards_.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            positions[Shard(keys[i])].emplace_back(i);
+        }
+        size_t cnt = 0;
+        for (size_t shard = 0; shard < shards_.size(); shard++) {
+            if (positions[shard].empty()) {
+                continue;
+            }
+            std::vector<std::string_view> shard_keys;
+            shard_keys.reserve(positions[shard].size());
+            for (auto i : positions[shard]) {
+                shard_keys.emplace_back(keys[i]);
+            }
+            std::vector<std::string> shard_values;
+            std::vector<bool> shard_found;
+            cnt += shards_[shard]->MultiGet(shard_keys, shard_values, shard_found);
+            for (size_t j = 0; j < positions[shard].size(); j++) {
+                values[positions[shard][j]] = std::move(shard_values[j]);
+                found[positions[shard][j]] = shard_found[j];
+            }
+        }
+        return cnt;
+    }
+
+    // shards own disjoint keys, the merge only restores the global key order
+    std::unique_ptr<lsm::InternalIterator> NewIterator() {
+        std::vector<std::unique_ptr<lsm::InternalIterator> > children;
+        children.reserve(shards_.size());
+        for (auto& shard : shards_) {
+            children.emplace_back(shard->NewIterator());
+        }
+        return std::make_unique<lsm::MergingIterator>(std::move(children));
+    }
+
+    size_t shard_num() const {
+        return shards_.size();
+    }
+
+    DB& shard(size_t i) {
+        return *shards_[i];
+    }
+
+private:
+    ShardedDBOptions options_;
+    std::vector<std::unique_ptr<DB> > shards_;
+};
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "easykv/lsm/format.hpp"
+#include "easykv/lsm/sst.hpp"
+
+namespace easykv {
+
+/*
+SstFileWriter builds a standalone sst offline, e.g. from a sorted dump, for DB::IngestExternalFile.
+keys must be added in strictly increasing order, an out of order key is refused and the file stays usable.
+block_size and use_direct_writes of options are used, the db's own options need not match
+*/
+class SstFileWriter {
+public:
+    explicit SstFileWriter(const lsm::TableOptions& options = lsm::TableOptions()): options_(options) {}
+
+    // expected_size only preallocates
+    bool Open(const std::string& name, size_t expected_size = 0) {
+        name_ = name;
+        last_key_.clear();
+        entry_cnt_ = 0;
+        builder_ = std::make_unique<lsm::TableBuilder>(name_, options_);
+        return builder_->Open(expected_size);
+    }
+
+    bool Put(std::string_view key, std::string_view value) {
+        return Add(key, value, lsm::kTypeValue);
+    }
+
+    // shadows the key in the levels below the one the file is ingested to
+    bool Delete(std::string_view key) {
+        return Add(key, std::string_view(), lsm::kTypeDeletion);
+    }
+
+    // the file is synced once Finish returns, an empty file is refused
+    bool Finish() {
+        if (!builder_ || entry_cnt_ == 0) {
+            return false;
+        }
+        bool ok = builder_->Finish();
+        builder_ = nullptr;
+        return ok;
+    }
+
+    const std::string& name() const {
+        return name_;
+    }
+
+    size_t entry_cnt() const {
+        return entry_cnt_;
+    }
+
+private:
+    bool Add(std::string_view key, std::string_view value, lsm::ValueType type) {
+        if (!builder_ || (entry_cnt_ > 0 && key <= last_key_)) {
+            return false;
+        }
+        builder_->Add(key, value, type);
+        last_key_.assign(key);
+        ++entry_cnt_;
+        return true;
+    }
+
+private:
+    lsm::TableOptions options_;
+    std::string name_;
+    std::unique_ptr<lsm::TableBuilder> builder_;
+    std::string last_key_;
+    size_t entry_cnt_ = 0;
+};
+
+}
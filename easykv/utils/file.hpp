@@ -0,0 +1,645 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "easykv/utils/rate_limiter.hpp"
+
+namespace easykv {
+namespace common {
+
+/*
+how an sst is read:
+kMmap    map the whole file read only, a cold read is a page fault on the caller
+kPRead   pread a block into a private buffer, readahead stays with the kernel
+kDirect  pread with O_DIRECT, bypasses the page cache so the block cache is the only cache
+kIoUring like kDirect, MultiRead submits the whole batch to io_uring at once
+*/
+enum class ReadMode {
+    kMmap,
+    kPRead,
+    kDirect,
+    kIoUring,
+};
+
+// heap buffer aligned for O_DIRECT
+class AlignedBuffer {
+public:
+    constexpr static const size_t alignment = 4096;
+
+    void Reserve(size_t n) {
+        n = (n + alignment - 1) & ~(alignment - 1);
+        if (n <= capacity_) {
+            return;
+        }
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, alignment, n) != 0) {
+            ptr = nullptr;
+            n = 0;
+        }
+        data_.reset(static_cast<char*>(ptr));
+        capacity_ = n;
+    }
+
+    char* data() {
+        return data_.get();
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+private:
+    struct Free {
+        void operator () (char* ptr) const {
+            free(ptr);
+        }
+    };
+    std::unique_ptr<char, Free> data_;
+    size_t capacity_ = 0;
+};
+
+struct ReadRequest {
+    ReadRequest() = default;
+    ReadRequest(size_t offset, size_t size): offset(offset), size(size) {}
+    size_t offset = 0;
+    size_t size = 0;
+    // points into the mapping for kMmap, into buf otherwise
+    std::string_view result;
+    AlignedBuffer buf;
+    bool ok = false;
+};
+
+class RandomAccessFile {
+public:
+    virtual ~RandomAccessFile() {
+        if (fd_ != -1) {
+            close(fd_);
+        }
+    }
+
+    virtual bool Open(const std::string& name) = 0;
+
+    virtual bool Read(ReadRequest& req) = 0;
+
+    virtual bool MultiRead(std::vector<ReadRequest>& reqs) {
+        bool ok = true;
+        for (auto& req : reqs) {
+            ok &= Read(req);
+        }
+        return ok;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // result views stay valid as long as the file, not only the request
+    virtual bool mmaped() const {
+        return false;
+    }
+
+    static std::unique_ptr<RandomAccessFile> New(ReadMode mode);
+
+protected:
+    bool OpenFd(const std::string& name, int flags) {
+        fd_ = open(name.c_str(), O_RDONLY | flags);
+        if (fd_ == -1) {
+            return false;
+        }
+        struct stat stat_buf;
+        if (fstat(fd_, &stat_buf) != 0) {
+            close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        size_ = stat_buf.st_size;
+        return true;
+    }
+
+protected:
+    int fd_ = -1;
+    size_t size_ = 0;
+};
+
+class MmapFile : public RandomAccessFile {
+public:
+    ~MmapFile() override {
+        if (data_ != nullptr) {
+            munmap(data_, size_);
+        }
+    }
+
+    bool Open(const std::string& name) override {
+        if (!OpenFd(name, 0)) {
+            return false;
+        }
+        auto data = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        data_ = static_cast<char*>(data);
+        return true;
+    }
+
+    bool Read(ReadRequest& req) override {
+        req.ok = req.offset + req.size <= size_;
+        if (req.ok) {
+            req.result = std::string_view(data_ + req.offset, req.size);
+        }
+        return req.ok;
+    }
+
+    bool mmaped() const override {
+        return true;
+    }
+
+private:
+    char* data_ = nullptr;
+};
+
+class PReadFile : public RandomAccessFile {
+public:
+    explicit PReadFile(bool direct): direct_(direct) {}
+
+    // falls back to buffered io where the fs refuses O_DIRECT (tmpfs)
+    bool Open(const std::string& name) override {
+        if (direct_ && OpenFd(name, O_DIRECT)) {
+            return true;
+        }
+        direct_ = false;
+        return OpenFd(name, 0);
+    }
+
+    bool Read(ReadRequest& req) override {
+        size_t begin = 0;
+        size_t len = 0;
+        Prepare(req, begin, len);
+        size_t done = 0;
+        while (done < len) {
+            auto n = pread(fd_, req.buf.data() + done, len - done, begin + done);
+            if (n <= 0) {
+                break;
+            }
+            done += n;
+        }
+        return Finish(req, begin, done);
+    }
+
+protected:
+    // O_DIRECT wants offset, length and buffer aligned, read the covering pages
+    void Prepare(ReadRequest& req, size_t& begin, size_t& len) {
+        begin = req.offset;
+        size_t end = req.offset + req.size;
+        if (direct_) {
+            begin &= ~(AlignedBuffer::alignment - 1);
+            end = (end + AlignedBuffer::alignment - 1) & ~(AlignedBuffer::alignment - 1);
+        }
+        len = end - begin;
+        req.buf.Reserve(len);
+    }
+
+    bool Finish(ReadRequest& req, size_t begin, size_t done) {
+        req.ok = req.buf.data() != nullptr && begin + done >= req.offset + req.size;
+        if (req.ok) {
+            req.result = std::string_view(req.buf.data() + req.offset - begin, req.size);
+        }
+        return req.ok;
+    }
+
+protected:
+    bool direct_;
+};
+
+/*
+minimal io_uring over the raw syscalls (no liburing dependency),
+one ring per thread, only IORING_OP_READ is used
+*/
+class IoUring {
+public:
+    constexpr static const unsigned entries = 64;
+
+    ~IoUring() {
+        if (sqes_ != nullptr) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_) {
+            munmap(cq_ptr_, cq_size_);
+        }
+        if (sq_ptr_ != nullptr) {
+            munmap(sq_ptr_, sq_size_);
+        }
+        if (fd_ != -1) {
+            close(fd_);
+        }
+    }
+
+    // nullptr when the ring could not be set up or broke down, the caller reads with pread then
+    static IoUring* ThreadLocal() {
+        thread_local IoUring ring;
+        thread_local bool ok = ring.Init();
+        return ok && !ring.broken_ ? &ring : nullptr;
+    }
+
+    struct Read {
+        char* buf;
+        size_t len;
+        size_t offset;
+    };
+
+    /*
+    res[i] is the bytes reads[i] got or -errno. on false no read of the batch is left in the ring,
+    the buffers may go right away
+    */
+    bool Submit(int fd, const std::vector<Read>& reads, std::vector<int>& res) {
+        res.assign(reads.size(), -1);
+        size_t next = 0;
+        size_t done = 0;
+        size_t inflight = 0;
+        unsigned to_submit = 0;
+        while (done < reads.size()) {
+            while (next < reads.size() && inflight < sq_entries_) {
+                unsigned tail = *sq_tail_;
+                unsigned idx = tail & *sq_mask_;
+                auto sqe = &sqes_[idx];
+                memset(sqe, 0, sizeof(*sqe));
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = fd;
+                sqe->addr = reinterpret_cast<uint64_t>(reads[next].buf);
+                sqe->len = reads[next].len;
+                sqe->off = reads[next].offset;
+                sqe->user_data = next;
+                sq_array_[idx] = idx;
+                __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+                ++next;
+                ++inflight;
+                ++to_submit;
+            }
+            auto submitted = syscall(__NR_io_uring_enter, fd_, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (submitted < 0) {
+                if (errno == EINTR || errno == EAGAIN) {
+                    continue;
+                }
+                // reads the kernel never took are taken back, the taken ones must land before their buffers go
+                unsigned untaken = *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+                __atomic_store_n(sq_tail_, *sq_tail_ - untaken, __ATOMIC_RELEASE);
+                inflight -= untaken;
+                Drain(inflight, res);
+                return false;
+            }
+            to_submit -= submitted;
+            Reap(inflight, done, res);
+        }
+        return true;
+    }
+
+private:
+    void Reap(size_t& inflight, size_t& done, std::vector<int>& res) {
+        unsigned head = __atomic_load_n(cq_head_, __ATOMIC_ACQUIRE);
+        while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            auto cqe = &cqes_[head & *cq_mask_];
+            res[cqe->user_data] = cqe->res;
+            ++head;
+            ++done;
+            --inflight;
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    // waits out the reads still in flight. a ring that can not even wait is torn down, closing it cancels them
+    void Drain(size_t inflight, std::vector<int>& res) {
+        size_t done = 0;
+        while (inflight > 0) {
+            if (syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR && errno != EAGAIN) {
+                broken_ = true;
+                close(fd_);
+                fd_ = -1;
+                return;
+            }
+            Reap(inflight, done, res);
+        }
+    }
+
+    bool Init() {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd_ = syscall(__NR_io_uring_setup, entries, &params);
+        if (fd_ < 0) {
+            fd_ = -1;
+            return false;
+        }
+        sq_entries_ = params.sq_entries;
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        }
+        auto sq_ptr = mmap(NULL, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) {
+            return false;
+        }
+        sq_ptr_ = static_cast<char*>(sq_ptr);
+        if (single_mmap) {
+            cq_ptr_ = sq_ptr_;
+        } else {
+            auto cq_ptr = mmap(NULL, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+            if (cq_ptr == MAP_FAILED) {
+                return false;
+            }
+            cq_ptr_ = static_cast<char*>(cq_ptr);
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        auto sqes = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return false;
+        }
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+        sq_head_ = reinterpret_cast<unsigned*>(sq_ptr_ + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq_ptr_ + params.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned*>(sq_ptr_ + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq_ptr_ + params.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned*>(cq_ptr_ + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq_ptr_ + params.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned*>(cq_ptr_ + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq_ptr_ + params.cq_off.cqes);
+        return true;
+    }
+
+private:
+    int fd_ = -1;
+    unsigned sq_entries_ = 0;
+    size_t sq_size_ = 0;
+    size_t cq_size_ = 0;
+    size_t sqes_size_ = 0;
+    char* sq_ptr_ = nullptr;
+    char* cq_ptr_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+    bool broken_ = false;
+};
+
+class IoUringFile : public PReadFile {
+public:
+    IoUringFile(): PReadFile(true) {}
+
+    // single reads gain nothing from the ring, only batches go through it
+    bool MultiRead(std::vector<ReadRequest>& reqs) override {
+        auto ring = IoUring::ThreadLocal();
+        if (ring == nullptr || reqs.size() < 2) {
+            return RandomAccessFile::MultiRead(reqs);
+        }
+        std::vector<IoUring::Read> reads;
+        std::vector<size_t> begins;
+        reads.reserve(reqs.size());
+        begins.reserve(reqs.size());
+        for (auto& req : reqs) {
+            size_t begin = 0;
+            size_t len = 0;
+            Prepare(req, begin, len);
+            reads.push_back(IoUring::Read{req.buf.data(), len, begin});
+            begins.emplace_back(begin);
+        }
+        std::vector<int> res;
+        if (!ring->Submit(fd_, reads, res)) {
+            return RandomAccessFile::MultiRead(reqs);
+        }
+        bool ok = true;
+        for (size_t i = 0; i < reqs.size(); i++) {
+            // a short read (signal, page cache miss) is finished with pread
+            if (res[i] < 0 || !Finish(reqs[i], begins[i], res[i])) {
+                ok &= Read(reqs[i]);
+            }
+        }
+        return ok;
+    }
+};
+
+/*
+WritableFile appends through an aligned buffer instead of a writable mapping:
+the file is preallocated with fallocate, written buffer_size at a time,
+and every bytes_per_sync bytes sync_file_range starts writeback so dirty pages never pile up.
+with direct the page cache is bypassed, the tail is padded to the alignment and truncated on Close
+*/
+class WritableFile {
+public:
+    explicit WritableFile(bool direct = false, size_t buffer_size = 1024 * 1024, size_t bytes_per_sync = 1024 * 1024)
+        : direct_(direct), bytes_per_sync_(bytes_per_sync) {
+        buffer_size_ = std::max(buffer_size, AlignedBuffer::alignment) & ~(AlignedBuffer::alignment - 1);
+    }
+
+    ~WritableFile() {
+        Close();
+    }
+
+    WritableFile(const WritableFile&) = delete;
+    WritableFile& operator = (const WritableFile&) = delete;
+
+    // preallocate is a hint, a file system without fallocate just grows the file
+    bool Open(const std::string& name, size_t preallocate = 0) {
+        if (direct_) {
+            fd_ = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0700);
+        }
+        if (fd_ == -1) {
+            direct_ = false;
+            fd_ = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0700);
+        }
+        if (fd_ == -1) {
+            return false;
+        }
+        if (preallocate > 0) {
+            fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, preallocate);
+        }
+        buf_.Reserve(buffer_size_);
+        return buf_.data() != nullptr;
+    }
+
+    bool Append(std::string_view data) {
+        while (!data.empty()) {
+            auto n = std::min(data.size(), buffer_size_ - buffered_);
+            memcpy(buf_.data() + buffered_, data.data(), n);
+            buffered_ += n;
+            data.remove_prefix(n);
+            if (buffered_ == buffer_size_ && !Flush()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // writes out the buffer, with direct only whole aligned pages leave it
+    bool Flush() {
+        size_t len = buffered_;
+        if (direct_) {
+            len &= ~(AlignedBuffer::alignment - 1);
+        }
+        if (!WriteRaw(buf_.data(), len)) {
+            return false;
+        }
+        memmove(buf_.data(), buf_.data() + len, buffered_ - len);
+        buffered_ -= len;
+        RangeSync();
+        return true;
+    }
+
+    // data is durable once Sync returns
+    bool Sync() {
+        return Flush() && fdatasync(fd_) == 0;
+    }
+
+    bool Close() {
+        if (fd_ == -1) {
+            return true;
+        }
+        bool ok = Flush();
+        if (ok && buffered_ > 0) { // direct tail: pad, write, cut back to the real size
+            auto padded = (buffered_ + AlignedBuffer::alignment - 1) & ~(AlignedBuffer::alignment - 1);
+            memset(buf_.data() + buffered_, 0, padded - buffered_);
+            auto size = size_ + buffered_;
+            ok = WriteRaw(buf_.data(), padded) && ftruncate(fd_, size) == 0;
+            size_ = size;
+            buffered_ = 0;
+        }
+        ok = ok && fdatasync(fd_) == 0;
+        close(fd_);
+        fd_ = -1;
+        return ok;
+    }
+
+    // bytes appended so far
+    size_t size() const {
+        return size_ + buffered_;
+    }
+
+    // every write to the file first takes its bytes from limiter, nullptr writes at full speed
+    void SetRateLimiter(RateLimiter* limiter, RateLimiter::Priority priority) {
+        rate_limiter_ = limiter;
+        priority_ = priority;
+    }
+
+private:
+    bool WriteRaw(const char* data, size_t len) {
+        if (rate_limiter_) {
+            rate_limiter_->Request(len, priority_);
+        }
+        size_t written = 0;
+        while (written < len) {
+            auto n = write(fd_, data + written, len - written);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            written += n;
+        }
+        size_ += len;
+        return true;
+    }
+
+    // kick off writeback of what was written since the last call, never waits for it
+    void RangeSync() {
+        if (direct_ || bytes_per_sync_ == 0 || size_ - synced_ < bytes_per_sync_) {
+            return;
+        }
+        sync_file_range(fd_, synced_, size_ - synced_, SYNC_FILE_RANGE_WRITE);
+        synced_ = size_;
+    }
+
+private:
+    bool direct_;
+    size_t buffer_size_;
+    size_t bytes_per_sync_;
+    int fd_ = -1;
+    AlignedBuffer buf_;
+    size_t buffered_ = 0;
+    size_t size_ = 0;
+    size_t synced_ = 0;
+    RateLimiter* rate_limiter_ = nullptr;
+    RateLimiter::Priority priority_ = RateLimiter::Priority::kLow;
+};
+
+inline std::unique_ptr<RandomAccessFile> RandomAccessFile::New(ReadMode mode) {
+    switch (mode) {
+        case ReadMode::kPRead:
+            return std::make_unique<PReadFile>(false);
+        case ReadMode::kDirect:
+            return std::make_unique<PReadFile>(true);
+        case ReadMode::kIoUring:
+            return std::make_unique<IoUringFile>();
+        default:
+            return std::make_unique<MmapFile>();
+    }
+}
+
+// name inside dir, an empty dir is the working directory
+inline std::string JoinPath(const std::string& dir, const std::string& name) {
+    if (dir.empty()) {
+        return name;
+    }
+    return dir.back() == '/' ? dir + name : dir + "/" + name;
+}
+
+// dst is written through WritableFile and synced before it returns
+inline bool CopyFile(const std::string& src, const std::string& dst) {
+    int fd = open(src.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    WritableFile file;
+    bool ok = file.Open(dst);
+    std::string buf(1024 * 1024, '\0');
+    while (ok) {
+        auto n = read(fd, buf.data(), buf.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ok = n == 0;
+            break;
+        }
+        ok = file.Append(std::string_view(buf.data(), n));
+    }
+    close(fd);
+    return file.Close() && ok;
+}
+
+// creates dir and its missing parents
+inline bool CreateDirs(const std::string& dir) {
+    for (size_t pos = 1; pos <= dir.size(); pos++) {
+        if (pos == dir.size() || dir[pos] == '/') {
+            auto prefix = dir.substr(0, pos);
+            if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+}
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+namespace easykv {
+namespace common {
+
+/*
+RateLimiter is a token bucket shared by every background writer (flush, compaction, blob gc) of one
+or more DBs, so their writes leave the device bandwidth foreground reads need.
+tokens refill continuously, at most one refill period's worth is banked.
+a kHigh request (flush) goes first: kLow requests (compaction) wait while one is queued.
+auto tuned, the limit follows the compaction debt reported through Tune, from rate_bytes_per_sec / tune_range_
+with no debt up to rate_bytes_per_sec
+*/
+class RateLimiter {
+public:
+    enum class Priority {
+        kHigh = 0, // flush, a stalled flush stalls writers
+        kLow = 1, // compaction
+    };
+
+    explicit RateLimiter(size_t rate_bytes_per_sec, bool auto_tuned = false)
+        : max_rate_(std::max<size_t>(rate_bytes_per_sec, 1)), auto_tuned_(auto_tuned),
+          rate_(auto_tuned ? std::max<size_t>(max_rate_ / tune_range_, 1) : max_rate_),
+          last_refill_(std::chrono::steady_clock::now()) {}
+
+    // blocks until bytes may be written, a request larger than the burst is granted in parts
+    void Request(size_t bytes, Priority priority) {
+        while (bytes > 0) {
+            auto n = std::min(bytes, burst());
+            Acquire(n, priority);
+            bytes -= n;
+        }
+    }
+
+    // debt_ratio is compaction debt over what the writer considers a full backlog, ignored unless auto tuned
+    void Tune(double debt_ratio) {
+        if (!auto_tuned_) {
+            return;
+        }
+        debt_ratio = std::min(std::max(debt_ratio, 0.0), 1.0);
+        auto min_rate = std::max<size_t>(max_rate_ / tune_range_, 1);
+        SetBytesPerSecond(min_rate + static_cast<size_t>((max_rate_ - min_rate) * debt_ratio));
+    }
+
+    void SetBytesPerSecond(size_t rate_bytes_per_sec) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        Refill();
+        rate_ = std::max<size_t>(rate_bytes_per_sec, 1);
+        cv_.notify_all();
+    }
+
+    size_t bytes_per_second() const {
+        return rate_;
+    }
+
+    size_t total_bytes(Priority priority) const {
+        return total_bytes_[static_cast<size_t>(priority)];
+    }
+
+private:
+    // tokens banked at most, also the largest single grant
+    size_t burst() const {
+        return std::max<size_t>(rate_ * refill_period_us_ / 1000000, min_burst_);
+    }
+
+    void Acquire(size_t bytes, Priority priority) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        bool high = priority == Priority::kHigh;
+        if (high) {
+            ++high_waiting_;
+        }
+        while (true) {
+            Refill();
+            // the bucket may go into debt, a request granted before the rate dropped still fits
+            double needed = std::min(bytes, burst());
+            if (available_ >= needed && (high || high_waiting_ == 0)) {
+                available_ -= bytes;
+                break;
+            }
+            // short of tokens: sleep until they are there, a low request behind a high one is woken by it
+            auto missing = available_ >= needed ? burst() : needed - available_;
+            cv_.wait_for(lock, std::chrono::microseconds(std::max<size_t>(missing * 1e6 / rate_, 100)));
+        }
+        if (high) {
+            --high_waiting_;
+            cv_.notify_all();
+        }
+        total_bytes_[static_cast<size_t>(priority)] += bytes;
+    }
+
+    // mutex_ held
+    void Refill() {
+        auto now = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - last_refill_).count();
+        last_refill_ = now;
+        available_ = std::min<double>(available_ + rate_ * (elapsed / 1e6), burst());
+    }
+
+private:
+    constexpr static const size_t refill_period_us_ = 100 * 1000;
+    constexpr static const size_t min_burst_ = 4096;
+    constexpr static const size_t tune_range_ = 8;
+    size_t max_rate_;
+    bool auto_tuned_;
+    std::atomic_size_t rate_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::chrono::steady_clock::time_point last_refill_;
+    double available_ = 0;
+    size_t high_waiting_ = 0;
+    std::array<std::atomic_size_t, 2> total_bytes_{};
+};
+
+}
+}
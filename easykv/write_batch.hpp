@@ -0,0 +1,61 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "easykv/lsm/format.hpp"
+
+namespace easykv {
+
+// puts, deletes and merges applied by Write in the order they were added
+class WriteBatch {
+public:
+    struct Entry {
+        lsm::ValueType type;
+        std::string key;
+        std::string value;
+    };
+
+    void Put(std::string_view key, std::string_view value) {
+        entries_.push_back(Entry{lsm::kTypeValue, std::string(key), std::string(value)});
+    }
+
+    // the value reads as deleted once ttl has passed since this call
+    void Put(std::string_view key, std::string_view value, std::chrono::milliseconds ttl) {
+        std::string entry(value);
+        lsm::AppendExpiry(entry, lsm::NowMicros() + std::chrono::duration_cast<std::chrono::microseconds>(ttl).count());
+        entries_.push_back(Entry{lsm::kTypeValueWithTTL, std::string(key), std::move(entry)});
+    }
+
+    void Delete(std::string_view key) {
+        entries_.push_back(Entry{lsm::kTypeDeletion, std::string(key), std::string()});
+    }
+
+    // needs DBOptions::merge_operator
+    void Merge(std::string_view key, std::string_view operand) {
+        entries_.push_back(Entry{lsm::kTypeMerge, std::string(key), std::string(operand)});
+    }
+
+    // an entry of another batch as it is, e.g. when a batch is split
+    void Append(const Entry& entry) {
+        entries_.push_back(entry);
+    }
+
+    void Clear() {
+        entries_.clear();
+    }
+
+    size_t size() const {
+        return entries_.size();
+    }
+
+    const std::vector<Entry>& entries() const {
+        return entries_;
+    }
+
+private:
+    std::vector<Entry> entries_;
+};
+
+}
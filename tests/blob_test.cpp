@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+#include <iostream>
+#include <string>
+
+#include "easykv/db.hpp"
+#include "easykv/options.hpp"
+
+namespace {
+
+std::string BlobValue(int round, int i) {
+    return std::string(4096, 'a' + (round * 7 + i) % 26) + std::to_string(round) + "_" + std::to_string(i);
+}
+
+void CheckAll(easykv::DB& db, int n) {
+    for (int i = 0; i < n; i++) {
+        std::string value;
+        ASSERT_EQ(db.Get("blob" + std::to_string(i), value), true) << i;
+        ASSERT_EQ(value, BlobValue(i % 2 == 0 ? 1 : 0, i));
+    }
+}
+
+}
+
+TEST(Blob, SeparationAndGC) {
+    easykv::DBOptions options;
+    options.min_blob_size = 1024;
+    options.blob_gc_garbage_ratio = 2; // no background gc while writing
+    const int n = 2000;
+    {
+        easykv::DB db(options);
+        for (int i = 0; i < n; i++) {
+            db.Put("blob" + std::to_string(i), BlobValue(0, i));
+        }
+        for (int i = 0; i < n; i += 2) { // half of every round 0 blob file becomes garbage
+            db.Put("blob" + std::to_string(i), BlobValue(1, i));
+        }
+        CheckAll(db, n);
+        db.Put("small", "inline");
+        std::string value;
+        ASSERT_EQ(db.Get("small", value), true);
+        ASSERT_EQ(value, "inline");
+    }
+    options.blob_gc_garbage_ratio = 0.3;
+    {
+        easykv::DB db(options);
+        CheckAll(db, n);
+        auto it = db.NewIterator();
+        ASSERT_GT(db.BlobGC(), 0);
+        CheckAll(db, n);
+        ASSERT_EQ(db.BlobGC(), 0);
+        // the collected files stay on disk for the version the iterator was made from
+        int cnt = 0;
+        for (it->Seek("blob"); it->Valid() && it->key().substr(0, 4) == "blob"; it->Next()) {
+            int i = std::stoi(std::string(it->key().substr(4)));
+            ASSERT_EQ(it->value(), BlobValue(i % 2 == 0 ? 1 : 0, i));
+            ++cnt;
+        }
+        ASSERT_EQ(cnt, n);
+    }
+    easykv::DB db(options);
+    CheckAll(db, n);
+}
@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <cstdio>
+#include <filesystem>
 #include <functional>
 #include <gtest/gtest.h>
 #include <iostream>
@@ -141,4 +143,57 @@ TEST(Compaction, Read) {
         ASSERT_EQ(std::to_string(i), value);
     }
 
-}
\ No newline at end of file
+}
+TEST(Compaction, TrivialMove) {
+    const int n = 10000;
+    auto make_sst = [](int begin, int end, size_t id, const easykv::lsm::TableOptions& options) {
+        std::vector<std::string> keys;
+        for (int i = begin; i < end; i++) {
+            char key[16];
+            snprintf(key, sizeof(key), "k%07d", i);
+            keys.emplace_back(key);
+        }
+        std::vector<easykv::lsm::EntryView> entries;
+        for (auto& key : keys) {
+            entries.emplace_back(key, key);
+        }
+        return std::make_shared<easykv::lsm::SST>(entries, id, 0, 0, options);
+    };
+    easykv::lsm::TableOptions options;
+    options.db_path = "trivial_move_db";
+    std::filesystem::remove_all(options.db_path);
+    easykv::common::CreateDirs(options.db_path);
+    auto manifest = std::make_shared<easykv::lsm::Manifest>(std::make_shared<easykv::lsm::TableCache>(16, options));
+    // sequential ingest, every file moves down as is
+    manifest = manifest->InsertAndUpdate(make_sst(0, n, 1, options));
+    manifest = manifest->InsertAndUpdate(make_sst(n, 2 * n, 2, options));
+    auto edits = manifest->SizeTieredCompaction(3);
+    ASSERT_EQ(edits.size(), 1);
+    ASSERT_EQ(edits[0].added_files().size(), 2);
+    for (auto& [level, meta] : edits[0].added_files()) {
+        ASSERT_EQ(level, 1);
+        ASSERT_LE(meta->id, 2);
+    }
+    ASSERT_EQ(std::filesystem::exists(easykv::lsm::SST::FileName(3, options.db_path)), false);
+    // an overlapping file is merged with what it overlaps, a disjoint one still moves
+    manifest = manifest->InsertAndUpdate(make_sst(n / 2, n + n / 2, 4, options));
+    manifest = manifest->InsertAndUpdate(make_sst(3 * n, 4 * n, 5, options));
+    edits = manifest->SizeTieredCompaction(6);
+    ASSERT_EQ(edits.size(), 1);
+    std::vector<size_t> added;
+    for (auto& [level, meta] : edits[0].added_files()) {
+        added.emplace_back(meta->id);
+    }
+    std::sort(added.begin(), added.end());
+    ASSERT_EQ(added, std::vector<size_t>({5, 6}));
+    ASSERT_EQ(manifest->file_cnt(), 2);
+    for (int i = 0; i < 4 * n; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "k%07d", i);
+        std::string value;
+        ASSERT_EQ(manifest->Get(key, value), i < 2 * n || i >= 3 * n);
+        if (i < 2 * n || i >= 3 * n) {
+            ASSERT_EQ(value, key);
+        }
+    }
+}
@@ -1,10 +1,15 @@
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
 #include <functional>
 #include <gtest/gtest.h>
 #include <iostream>
 #include <string>
+#include <thread>
 
 #include "easykv/db.hpp"
 #include "easykv/pool/thread_pool.hpp"
+#include "easykv/sst_file_writer.hpp"
 
 TEST(DB, Function) {
     easykv::DB db;
@@ -67,4 +72,526 @@ TEST(DB, Read) {
         db.Get(std::to_string(i), value);
         ASSERT_EQ(value, std::to_string(i + 1));
     }
-}
\ No newline at end of file
+}
+TEST(DB, RowCacheAndDelete) {
+    easykv::DBOptions options;
+    options.row_cache_capacity = 1000;
+    const int n = 100;
+    {
+        easykv::DB db(options);
+        for (int i = 0; i < n; i++) {
+            db.Put("row_" + std::to_string(i), std::to_string(i));
+        }
+        for (int round = 0; round < 3; round++) {
+            for (int i = 0; i < n; i++) {
+                std::string value;
+                ASSERT_EQ(db.Get("row_" + std::to_string(i), value), true);
+                ASSERT_EQ(value, std::to_string(i));
+            }
+        }
+        ASSERT_GT(db.row_cache_hit_cnt(), 0);
+        ASSERT_GE(db.row_cache_miss_cnt(), n);
+        // a cached row never outlives a write
+        for (int i = 0; i < n; i += 2) {
+            db.Put("row_" + std::to_string(i), std::to_string(i + 1));
+            db.Delete("row_" + std::to_string(i + 1));
+        }
+        for (int i = 0; i < n; i++) {
+            std::string value;
+            if (i % 2 == 1) {
+                ASSERT_EQ(db.Get("row_" + std::to_string(i), value), false);
+            } else {
+                ASSERT_EQ(db.Get("row_" + std::to_string(i), value), true);
+                ASSERT_EQ(value, std::to_string(i + 1));
+            }
+        }
+    }
+    easykv::DB db(options);
+    for (int i = 0; i < n; i++) {
+        std::string value;
+        ASSERT_EQ(db.Get("row_" + std::to_string(i), value), i % 2 == 0);
+    }
+}
+
+TEST(DB, MemoryBudget) {
+    auto budget = std::make_shared<easykv::lsm::MemoryBudget>(4 * 1024 * 1024);
+    easykv::DBOptions options;
+    options.memory_budget = budget;
+    options.block_cache_capacity = 1024 * 1024;
+    const int n = 100000;
+    const std::string padding(64, 'x');
+    {
+        easykv::DB db(options);
+        for (int i = 0; i < n; i++) {
+            db.Put("budget_" + std::to_string(i), padding + std::to_string(i));
+            // the budget flushes well before write_buffer_size
+            ASSERT_LE(budget->usage(easykv::lsm::MemoryConsumer::kMemTable), budget->write_buffer_limit());
+        }
+        for (int i = 0; i < n; i += 13) {
+            std::string value;
+            ASSERT_EQ(db.Get("budget_" + std::to_string(i), value), true);
+            ASSERT_EQ(value, padding + std::to_string(i));
+        }
+        ASSERT_GT(budget->usage(easykv::lsm::MemoryConsumer::kTableIndex), 0);
+        ASSERT_LE(budget->usage(easykv::lsm::MemoryConsumer::kBlockCache), options.block_cache_capacity);
+    }
+    // every consumer gave its bytes back
+    ASSERT_EQ(budget->usage(), 0);
+}
+
+TEST(DB, LevelPaths) {
+    std::filesystem::remove_all("level_db");
+    easykv::DBOptions options;
+    options.db_path = "level_db";
+    options.level_paths = {"level_db/fast", "level_db/fast", "level_db/slow"};
+    easykv::DBOptions other_options;
+    other_options.db_path = "level_db/other";
+    const int n = 150000;
+    const std::string padding(96, 'p');
+    auto count_ssts = [](const std::string& dir) {
+        size_t cnt = 0;
+        for (auto& entry : std::filesystem::directory_iterator(dir)) {
+            cnt += entry.path().extension() == ".sst";
+        }
+        return cnt;
+    };
+    {
+        // two instances in one process no longer share files
+        easykv::DB db(options);
+        easykv::DB other(other_options);
+        for (int i = 0; i < n; i++) {
+            db.Put(std::to_string(i), padding + std::to_string(i));
+            other.Put(std::to_string(i), std::to_string(i));
+        }
+    }
+    ASSERT_EQ(count_ssts("level_db"), 0);
+    ASSERT_GT(count_ssts("level_db/fast"), 0);
+    ASSERT_GT(count_ssts("level_db/slow"), 0); // compacted past level 1
+    ASSERT_GT(count_ssts("level_db/other"), 0);
+    easykv::DB db(options);
+    easykv::DB other(other_options);
+    for (int i = 0; i < n; i += 11) {
+        std::string value;
+        ASSERT_EQ(db.Get(std::to_string(i), value), true);
+        ASSERT_EQ(value, padding + std::to_string(i));
+        ASSERT_EQ(other.Get(std::to_string(i), value), true);
+        ASSERT_EQ(value, std::to_string(i));
+    }
+}
+
+TEST(DB, ObsoleteFiles) {
+    const int n = 150000;
+    auto count_ssts = [](const std::string& dir) {
+        size_t cnt = 0;
+        for (auto& entry : std::filesystem::directory_iterator(dir)) {
+            cnt += entry.path().extension() == ".sst";
+        }
+        return cnt;
+    };
+    // unlinked at once, then by the rate limited background thread
+    for (size_t rate : {size_t(0), size_t(256 * 1024 * 1024)}) {
+        std::filesystem::remove_all("obsolete_db");
+        easykv::DBOptions options;
+        options.db_path = "obsolete_db";
+        options.delete_rate_bytes_per_sec = rate;
+        options.write_buffer_size = 64 * 1024;
+        {
+            easykv::DB db(options);
+            for (int i = 0; i < n; i++) {
+                db.Put(std::to_string(i), std::to_string(i));
+            }
+            // a scan pins its version, the files it reads outlive the compactions that replace them
+            auto it = db.NewIterator();
+            it->SeekToFirst();
+            for (int i = 0; i < n; i++) {
+                db.Put(std::to_string(i), std::to_string(i + 1));
+            }
+            size_t cnt = 0;
+            for (; it->Valid(); it->Next()) {
+                ++cnt;
+            }
+            ASSERT_EQ(cnt, n);
+            for (int i = 0; i < 100 && db.file_deleter().deleted_cnt() == 0; i++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            ASSERT_GT(db.file_deleter().deleted_cnt(), 0);
+        }
+        auto table_cache = std::make_shared<easykv::lsm::TableCache>(16, [] {
+            easykv::lsm::TableOptions table_options;
+            table_options.db_path = "obsolete_db";
+            return table_options;
+        }());
+        ASSERT_EQ(count_ssts("obsolete_db"), easykv::lsm::Manifest(table_cache).file_cnt());
+        easykv::DB db(options);
+        for (int i = 0; i < n; i += 7) {
+            std::string value;
+            ASSERT_EQ(db.Get(std::to_string(i), value), true);
+            ASSERT_EQ(value, std::to_string(i + 1));
+        }
+    }
+}
+
+TEST(DB, BulkAppend) {
+    std::filesystem::remove_all("bulk_db");
+    easykv::DBOptions options;
+    options.db_path = "bulk_db";
+    const int n = 20000;
+    auto key_of = [](int i) {
+        char key[16];
+        snprintf(key, sizeof(key), "t%08d", i);
+        return std::string(key);
+    };
+    {
+        // nothing is flushed after the batch, the manifest alone carries its seqs past a reopen
+        {
+            easykv::DB db(options);
+            easykv::WriteBatch batch;
+            for (int i = 1; i <= n; i++) {
+                batch.Put(key_of(i), std::to_string(i));
+            }
+            ASSERT_EQ(db.BulkAppend(batch), true);
+        }
+        auto table_cache = std::make_shared<easykv::lsm::TableCache>(16, [] {
+            easykv::lsm::TableOptions table_options;
+            table_options.db_path = "bulk_db";
+            return table_options;
+        }());
+        ASSERT_EQ(easykv::lsm::Manifest(table_cache).last_sequence(), n);
+        std::filesystem::remove_all("bulk_db");
+    }
+    {
+        easykv::DB db(options);
+        db.Put(key_of(0), "memtable");
+        easykv::WriteBatch batch;
+        for (int i = 1; i <= n; i++) {
+            batch.Put(key_of(i), std::to_string(i));
+        }
+        ASSERT_EQ(db.BulkAppend(batch), true);
+        // behind the appended keys, or out of order
+        easykv::WriteBatch behind;
+        behind.Put(key_of(n / 2), "x");
+        ASSERT_EQ(db.BulkAppend(behind), false);
+        easykv::WriteBatch unordered;
+        unordered.Put(key_of(n + 2), "x");
+        unordered.Put(key_of(n + 1), "x");
+        ASSERT_EQ(db.BulkAppend(unordered), false);
+        db.Put(key_of(n / 2), "newer");
+        easykv::WriteBatch next;
+        next.Put(key_of(n + 1), std::to_string(n + 1));
+        ASSERT_EQ(db.BulkAppend(next), true);
+    }
+    easykv::DB db(options);
+    std::string value;
+    ASSERT_EQ(db.Get(key_of(0), value), true);
+    ASSERT_EQ(value, "memtable");
+    for (int i = 1; i <= n + 1; i++) {
+        ASSERT_EQ(db.Get(key_of(i), value), true);
+        ASSERT_EQ(value, i == n / 2 ? "newer" : std::to_string(i));
+    }
+    auto it = db.NewIterator();
+    int i = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next(), i++) {
+        ASSERT_EQ(it->key(), key_of(i));
+    }
+    ASSERT_EQ(i, n + 2);
+}
+
+TEST(DB, IngestExternalFile) {
+    std::filesystem::remove_all("ingest_db");
+    std::filesystem::remove_all("ingest_src");
+    easykv::common::CreateDirs("ingest_src");
+    easykv::DBOptions options;
+    options.db_path = "ingest_db";
+    options.level_paths = {"ingest_db/fast", "ingest_db/slow"};
+    options.row_cache_capacity = 1024;
+    const int n = 20000;
+    auto key_of = [](int i) {
+        char key[16];
+        snprintf(key, sizeof(key), "k%08d", i);
+        return std::string(key);
+    };
+    // two disjoint files and one overlapping both
+    auto write_file = [&key_of](const std::string& name, int begin, int end, const std::string& prefix) {
+        easykv::SstFileWriter writer;
+        EXPECT_EQ(writer.Open(name), true);
+        for (int i = begin; i < end; i++) {
+            EXPECT_EQ(writer.Put(key_of(i), prefix + std::to_string(i)), true);
+        }
+        EXPECT_EQ(writer.Put(key_of(begin), "out of order"), false);
+        EXPECT_EQ(writer.Finish(), true);
+    };
+    write_file("ingest_src/a.sst", 0, n, "a");
+    write_file("ingest_src/b.sst", n, 2 * n, "b");
+    write_file("ingest_src/c.sst", n / 2, n + n / 2, "c");
+    {
+        easykv::DB db(options);
+        db.Put(key_of(1), "memtable");
+        std::string value;
+        ASSERT_EQ(db.Get(key_of(1), value), true); // cached row
+        ASSERT_EQ(db.IngestExternalFile({"ingest_src/a.sst", "ingest_src/b.sst"}, true), true);
+        ASSERT_EQ(std::filesystem::exists("ingest_src/a.sst"), false);
+        ASSERT_EQ(db.IngestExternalFile({"ingest_src/c.sst"}), true);
+        ASSERT_EQ(std::filesystem::exists("ingest_src/c.sst"), true);
+        ASSERT_EQ(db.IngestExternalFile({"ingest_src/missing.sst"}), false);
+        ASSERT_EQ(db.Get(key_of(1), value), true);
+        ASSERT_EQ(value, "a1");
+        db.Put(key_of(2), "newer");
+    }
+    // every ingested file sits in the path of its level, b.sst went below level 0
+    auto count_ssts = [](const std::string& dir) {
+        size_t cnt = 0;
+        for (auto& entry : std::filesystem::directory_iterator(dir)) {
+            cnt += entry.path().extension() == ".sst";
+        }
+        return cnt;
+    };
+    ASSERT_EQ(count_ssts("ingest_db"), 0);
+    ASSERT_GT(count_ssts("ingest_db/slow"), 0);
+    easykv::DB db(options);
+    for (int i = 0; i < 2 * n; i++) {
+        std::string value;
+        ASSERT_EQ(db.Get(key_of(i), value), true);
+        if (i == 2) {
+            ASSERT_EQ(value, "newer");
+        } else if (i >= n / 2 && i < n + n / 2) {
+            ASSERT_EQ(value, "c" + std::to_string(i));
+        } else {
+            ASSERT_EQ(value, (i < n ? "a" : "b") + std::to_string(i));
+        }
+    }
+}
+
+TEST(DB, Merge) {
+    std::filesystem::remove_all("merge_db");
+    easykv::DBOptions options;
+    options.db_path = "merge_db";
+    options.write_buffer_size = 64 * 1024; // operands of one key spread over memtables, level 0 and compactions
+    options.merge_operator = std::make_shared<easykv::lsm::UInt64AddOperator>();
+    using easykv::lsm::UInt64AddOperator;
+    const int keys = 100;
+    const int rounds = 200;
+    auto counter = [](int i) {
+        return "counter" + std::to_string(i);
+    };
+    // key i is set to i first when i % 3 == 1, deleted halfway when i % 3 == 2
+    auto expected = [rounds](int i) -> uint64_t {
+        if (i % 3 == 2) {
+            return (rounds - rounds / 2) * i;
+        }
+        return (i % 3 == 1 ? i : 0) + rounds * i;
+    };
+    {
+        easykv::DB db(options);
+        for (int i = 0; i < keys; i++) {
+            if (i % 3 == 1) {
+                db.Put(counter(i), UInt64AddOperator::Encode(i));
+            }
+        }
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < keys; i++) {
+                if (r == rounds / 2 && i % 3 == 2) {
+                    db.Delete(counter(i));
+                }
+                ASSERT_EQ(db.Merge(counter(i), UInt64AddOperator::Encode(i)), true);
+            }
+            db.Put("padding" + std::to_string(r), std::string(1024, 'p'));
+        }
+        for (int i = 0; i < keys; i++) {
+            std::string value;
+            ASSERT_EQ(db.Get(counter(i), value), true);
+            ASSERT_EQ(UInt64AddOperator::Decode(value), expected(i));
+        }
+        auto it = db.NewIterator();
+        int cnt = 0;
+        for (it->Seek("counter"); it->Valid() && it->key().substr(0, 7) == "counter"; it->Next()) {
+            ++cnt;
+            auto i = std::stoi(std::string(it->key().substr(7)));
+            ASSERT_EQ(UInt64AddOperator::Decode(it->value()), expected(i));
+        }
+        ASSERT_EQ(cnt, keys);
+        ASSERT_EQ(it->ok(), true);
+    }
+    easykv::DB db(options);
+    for (int i = 0; i < keys; i++) {
+        std::string value;
+        ASSERT_EQ(db.Get(counter(i), value), true);
+        ASSERT_EQ(UInt64AddOperator::Decode(value), expected(i));
+    }
+    // a list built by appends in one batch
+    easykv::WriteBatch batch;
+    batch.Merge("list", "a");
+    batch.Merge("list", "b");
+    batch.Merge("list", "c");
+    easykv::DBOptions append_options;
+    append_options.db_path = "merge_db/append";
+    append_options.merge_operator = std::make_shared<easykv::lsm::StringAppendOperator>();
+    easykv::DB append_db(append_options);
+    append_db.Write(batch);
+    std::string value;
+    ASSERT_EQ(append_db.Get("list", value), true);
+    ASSERT_EQ(value, "a,b,c");
+    ASSERT_EQ(db.Merge("no operator", "x"), true);
+    easykv::DB plain(easykv::DBOptions{});
+    ASSERT_EQ(plain.Merge("no operator", "x"), false);
+}
+
+TEST(DB, TTL) {
+    std::filesystem::remove_all("ttl_db");
+    easykv::DBOptions options;
+    options.db_path = "ttl_db";
+    options.write_buffer_size = 64 * 1024;
+    options.row_cache_capacity = 1024;
+    const int keys = 2000;
+    auto key = [](int i) {
+        return "key" + std::to_string(i);
+    };
+    {
+        easykv::DB db(options);
+        // even keys expire soon, odd keys outlive the test
+        for (int i = 0; i < keys; i++) {
+            auto ttl = i % 2 == 0 ? std::chrono::milliseconds(300) : std::chrono::hours(1);
+            db.Put(key(i), std::string(100, 'v') + std::to_string(i), ttl);
+        }
+        db.Put("plain", "value");
+        std::string value;
+        ASSERT_EQ(db.Get(key(0), value), true); // cached with its expiry
+        ASSERT_EQ(value, std::string(100, 'v') + "0");
+        int cnt = 0;
+        auto it = db.NewIterator();
+        for (it->SeekToFirst(); it->Valid(); it->Next()) {
+            ++cnt;
+        }
+        ASSERT_EQ(cnt, keys + 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        for (int i = 0; i < keys; i++) {
+            ASSERT_EQ(db.Get(key(i), value), i % 2 == 1);
+            if (i % 2 == 1) {
+                ASSERT_EQ(value, std::string(100, 'v') + std::to_string(i));
+            }
+        }
+        cnt = 0;
+        it = db.NewIterator();
+        for (it->SeekToFirst(); it->Valid(); it->Next()) {
+            ++cnt;
+            ASSERT_EQ(it->key() == "plain" || it->value() == std::string(100, 'v') + std::string(it->key().substr(3)), true);
+        }
+        ASSERT_EQ(cnt, keys / 2 + 1);
+        ASSERT_GT(db.CompactExpired(), 0);
+        ASSERT_EQ(db.CompactExpired(), 0);
+        ASSERT_EQ(db.Get(key(0), value), false);
+        ASSERT_EQ(db.Get(key(1), value), true);
+    }
+    {
+        easykv::DB db(options);
+        std::string value;
+        for (int i = 0; i < keys; i++) {
+            ASSERT_EQ(db.Get(key(i), value), i % 2 == 1);
+        }
+        ASSERT_EQ(db.Get("plain", value), true);
+    }
+    // the flush thread finds expired files by itself
+    options.ttl_compaction_period_ms = 100;
+    easykv::DB db(options);
+    for (int i = 0; i < keys; i++) {
+        db.Put("short" + std::to_string(i), std::string(100, 's'), std::chrono::milliseconds(100));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    ASSERT_EQ(db.CompactExpired(), 0);
+    std::string value;
+    ASSERT_EQ(db.Get("short0", value), false);
+}
+
+TEST(DB, CompactionFilter) {
+    // leases marked released are dropped, names are upper cased
+    class LeaseFilter : public easykv::lsm::CompactionFilter {
+    public:
+        Decision Filter(std::string_view key, std::string_view value, std::string& new_value) override {
+            if (key.substr(0, 5) == "lease") {
+                return value == "released" ? Decision::kRemove : Decision::kKeep;
+            }
+            if (key.substr(0, 4) == "name") {
+                new_value.assign(value);
+                for (auto& c : new_value) {
+                    c = toupper(c);
+                }
+                return Decision::kChangeValue;
+            }
+            return Decision::kKeep;
+        }
+    };
+    class LeaseFilterFactory : public easykv::lsm::CompactionFilterFactory {
+    public:
+        std::unique_ptr<easykv::lsm::CompactionFilter> CreateCompactionFilter(
+                const easykv::lsm::CompactionFilterContext& /* context */) const override {
+            ++created_cnt;
+            return std::make_unique<LeaseFilter>();
+        }
+        mutable std::atomic_size_t created_cnt{0};
+    };
+    std::filesystem::remove_all("filter_db");
+    auto factory = std::make_shared<LeaseFilterFactory>();
+    easykv::DBOptions options;
+    options.db_path = "filter_db";
+    options.write_buffer_size = 64 * 1024;
+    options.compaction_filter_factory = factory;
+    const int keys = 100;
+    {
+        easykv::DB db(options);
+        for (int i = 0; i < keys; i++) {
+            db.Put("lease" + std::to_string(i), i % 2 == 0 ? "released" : "held");
+            db.Put("name" + std::to_string(i), "name" + std::to_string(i), std::chrono::hours(1));
+        }
+        std::string value;
+        ASSERT_EQ(db.Get("lease0", value), true); // not compacted yet
+        ASSERT_EQ(value, "released");
+        for (int i = 0; i < 300; i++) {
+            db.Put("padding" + std::to_string(i), std::string(1024, 'p'));
+        }
+    }
+    ASSERT_GT(factory->created_cnt, 0);
+    easykv::DB db(options);
+    for (int i = 0; i < keys; i++) {
+        std::string value;
+        ASSERT_EQ(db.Get("lease" + std::to_string(i), value), i % 2 == 1);
+        ASSERT_EQ(db.Get("name" + std::to_string(i), value), true);
+        ASSERT_EQ(value, "NAME" + std::to_string(i));
+    }
+    std::string value;
+    ASSERT_EQ(db.Get("padding0", value), true);
+    ASSERT_EQ(value, std::string(1024, 'p'));
+}
+
+TEST(DB, IteratorStatus) {
+    auto memtable = std::make_shared<easykv::lsm::MemeTable>();
+    easykv::lsm::BlobIndex missing;
+    missing.file_id = 999999; // no such blob file
+    missing.size = 8;
+    memtable->Put("a", "value", 1);
+    memtable->Put("b", missing.Encode(), 2, easykv::lsm::kTypeBlobIndex);
+    std::vector<std::unique_ptr<easykv::lsm::InternalIterator> > children;
+    children.emplace_back(std::make_unique<easykv::lsm::MemTableIterator>(memtable));
+    easykv::lsm::DBIterator it(std::make_unique<easykv::lsm::MergingIterator>(std::move(children)),
+        std::make_shared<easykv::lsm::TableCache>());
+    it.SeekToFirst();
+    ASSERT_EQ(it.value(), "value");
+    ASSERT_EQ(it.ok(), true);
+    it.Next();
+    ASSERT_EQ(it.Valid(), true);
+    ASSERT_EQ(it.value(), "");
+    ASSERT_EQ(it.ok(), false); // an empty value that is not the real one
+}
+
+TEST(DB, LockPath) {
+    std::filesystem::remove_all("lock_db");
+    easykv::DBOptions options;
+    options.db_path = "lock_db";
+    {
+        easykv::DB db(options);
+        ASSERT_THROW(easykv::DB second(options), std::runtime_error);
+        db.Put("key", "value");
+    }
+    easykv::DB db(options); // released by the first one
+    std::string value;
+    ASSERT_EQ(db.Get("key", value), true);
+    ASSERT_EQ(value, "value");
+}
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "easykv/lsm/manifest.hpp"
+#include "easykv/lsm/sst.hpp"
+#include "easykv/lsm/version_edit.hpp"
+
+namespace {
+
+std::shared_ptr<easykv::lsm::SST> MakeSST(int begin, int end, size_t id) {
+    std::vector<std::string> keys;
+    for (int i = begin; i < end; i++) {
+        keys.emplace_back(std::to_string(i));
+    }
+    std::sort(keys.begin(), keys.end());
+    std::vector<easykv::lsm::EntryView> entries;
+    for (auto& key : keys) {
+        entries.emplace_back(key, key);
+    }
+    return std::make_shared<easykv::lsm::SST>(entries, id);
+}
+
+}
+
+TEST(Manifest, ReplayLog) {
+    unlink("manifest");
+    unlink("manifest.log");
+    const int n = 10000;
+    {
+        auto manifest = std::make_shared<easykv::lsm::Manifest>();
+        easykv::lsm::ManifestLog log(manifest->log_name());
+        ASSERT_EQ(log.Open(), true);
+        for (size_t id = 1001; id <= 1002; id++) {
+            easykv::lsm::VersionEdit edit;
+            edit.AddFile(0, manifest->table_cache()->Insert(MakeSST((id - 1001) * n, (id - 1000) * n, id)));
+            manifest->Apply(edit);
+            ASSERT_EQ(log.Append(edit), true);
+        }
+        size_t next_id = 1003;
+        auto edits = manifest->SizeTieredCompaction([&next_id]() {
+            return next_id++;
+        });
+        ASSERT_EQ(log.Append(edits), true);
+        // no Save(), as if the process crashed here
+    }
+    {
+        auto fd = open("manifest.log", O_WRONLY | O_APPEND);
+        ASSERT_NE(fd, -1);
+        size_t torn[] = {1024, 0}; // record header without a body
+        ASSERT_EQ(write(fd, torn, sizeof(torn)), sizeof(torn));
+        close(fd);
+    }
+    auto recovered = std::make_shared<easykv::lsm::Manifest>();
+    ASSERT_EQ(recovered->max_sst_id(), 1003);
+    ASSERT_EQ(recovered->table_cache()->open_cnt(), 0);
+    for (int i = 0; i < 2 * n; i++) {
+        std::string value;
+        ASSERT_EQ(recovered->Get(std::to_string(i), value), true);
+        ASSERT_EQ(value, std::to_string(i));
+    }
+    ASSERT_EQ(recovered->Save(), true);
+    easykv::lsm::ManifestLog log(recovered->log_name());
+    ASSERT_EQ(log.Open(), true);
+    ASSERT_EQ(log.Reset(), true);
+    auto reloaded = std::make_shared<easykv::lsm::Manifest>();
+    ASSERT_EQ(reloaded->max_sst_id(), 1003);
+    std::string value;
+    ASSERT_EQ(reloaded->Get(std::to_string(n + 1), value), true);
+    ASSERT_EQ(value, std::to_string(n + 1));
+    unlink("manifest");
+    unlink("manifest.log");
+}
+
+TEST(Manifest, ObsoleteOnlyOnceInstalled) {
+    unlink("manifest");
+    unlink("manifest.log");
+    auto manifest = std::make_shared<easykv::lsm::Manifest>();
+    {
+        easykv::lsm::VersionEdit add;
+        add.AddFile(0, manifest->table_cache()->Insert(MakeSST(0, 100, 2001)));
+        manifest->Apply(add);
+    }
+    auto name = easykv::lsm::SST::FileName(2001);
+    easykv::lsm::VersionEdit drop;
+    drop.DeleteFile(0, 2001);
+    {
+        // as if the edit failed to log: the version is dropped without being installed
+        auto dropped = std::make_shared<easykv::lsm::Manifest>(*manifest);
+        dropped->Apply(drop);
+    }
+    ASSERT_EQ(access(name.c_str(), F_OK), 0);
+    auto installed = std::make_shared<easykv::lsm::Manifest>(*manifest);
+    installed->Apply(drop);
+    installed->ReleaseObsolete();
+    ASSERT_EQ(access(name.c_str(), F_OK), 0); // manifest still holds it
+    manifest = installed;
+    ASSERT_EQ(access(name.c_str(), F_OK), -1);
+    unlink("manifest");
+    unlink("manifest.log");
+}
@@ -0,0 +1,57 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "easykv/lsm/memtable.hpp"
+#include "easykv/utils/global_random.h"
+
+using easykv::lsm::MemTableRepType;
+
+// random inserts, point reads and the sorted walk of a flush on each rep
+int main() {
+    const int n = 200000;
+    const int gets = 2000;
+    std::vector<std::string> keys;
+    keys.reserve(n);
+    for (int i = 0; i < n; i++) {
+        // 40-80 bytes, long shared prefixes
+        auto r = cpputil::common::GlobalRand();
+        keys.emplace_back("service/user_profile/region-eu-west/tenant-" + std::to_string(r % 64) + "/user-" + std::to_string(r));
+    }
+    std::string value(100, 'v');
+    const MemTableRepType reps[] = {MemTableRepType::kSkipList, MemTableRepType::kHashLinkList, MemTableRepType::kVector,
+        MemTableRepType::kArt};
+    const char* names[] = {"skiplist", "hash_link_list", "vector", "art"};
+    auto elapsed_us = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    };
+    for (auto rep : reps) {
+        easykv::lsm::MemeTable memtable(rep);
+        auto start = std::chrono::steady_clock::now();
+        for (auto& key : keys) {
+            memtable.Put(key, value);
+        }
+        auto put_us = elapsed_us(start);
+        start = std::chrono::steady_clock::now();
+        std::string got;
+        for (int i = 0; i < gets; i++) {
+            if (!memtable.Get(keys[i * (n / gets)], got)) {
+                std::cout << names[static_cast<int>(rep)] << ": lost " << keys[i * (n / gets)] << std::endl;
+                return 1;
+            }
+        }
+        auto get_us = elapsed_us(start);
+        start = std::chrono::steady_clock::now();
+        size_t count = 0;
+        memtable.ForEach([&count](std::string_view /* key */, std::string_view /* value */, easykv::lsm::ValueType /* type */) {
+            ++count;
+            return true;
+        });
+        auto scan_us = elapsed_us(start);
+        std::cout << names[static_cast<int>(rep)] << ": put " << put_us * 1000 / n << "ns/op, get " << get_us * 1000 / gets
+            << "ns/op, sorted scan of " << count << " entries " << scan_us / 1000 << "ms, "
+            << memtable.binary_size() << " bytes" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "easykv/lsm/iterator.hpp"
+#include "easykv/lsm/memtable.hpp"
+
+using easykv::lsm::MemTableRepType;
+
+static const MemTableRepType kReps[] = {MemTableRepType::kSkipList, MemTableRepType::kHashLinkList, MemTableRepType::kVector,
+    MemTableRepType::kArt};
+
+TEST(MemTable, Freeze) {
+    // every size up to a few full trees of the eytzinger layout
+    for (auto rep : kReps)
+    for (int n : {0, 1, 2, 3, 7, 8, 100, 1023, 1024, 1025}) {
+        auto memtable = std::make_shared<easykv::lsm::MemeTable>(rep, 64);
+        auto key = [](int i) {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "key%06d", 2 * i + 1); // even numbers fall between keys
+            return std::string(buf);
+        };
+        for (int i = n - 1; i >= 0; i--) {
+            memtable->Put(key(i), std::to_string(i), i + 1, i % 5 == 0 ? easykv::lsm::kTypeDeletion : easykv::lsm::kTypeValue);
+        }
+        easykv::lsm::MemoryBudget budget(1024 * 1024);
+        memtable->Freeze(&budget);
+        auto frozen = memtable->frozen_table();
+        ASSERT_NE(frozen, nullptr);
+        ASSERT_EQ(frozen->size(), n);
+        ASSERT_EQ(budget.usage(easykv::lsm::MemoryConsumer::kImmutableMemTable), frozen->binary_size());
+        memtable->ReleaseFrozen(&budget);
+        ASSERT_EQ(budget.usage(), 0);
+        for (int i = 0; i < n; i++) {
+            std::string value;
+            easykv::lsm::ValueType type;
+            ASSERT_EQ(memtable->Get(key(i), value, type), true);
+            ASSERT_EQ(value, std::to_string(i));
+            ASSERT_EQ(type, i % 5 == 0 ? easykv::lsm::kTypeDeletion : easykv::lsm::kTypeValue);
+            char buf[16];
+            snprintf(buf, sizeof(buf), "key%06d", 2 * i);
+            ASSERT_EQ(memtable->Get(buf, value, type), false);
+            ASSERT_EQ(frozen->Find(buf), i);
+        }
+        ASSERT_EQ(frozen->Find("key999999"), n);
+        std::string last;
+        ASSERT_EQ(memtable->LastKey(last), n > 0);
+        if (n > 0) {
+            ASSERT_EQ(last, key(n - 1));
+        }
+        int i = 0;
+        memtable->ForEach([&](std::string_view k, std::string_view /* value */, easykv::lsm::ValueType /* type */) {
+            EXPECT_EQ(k, key(i));
+            ++i;
+            return true;
+        });
+        ASSERT_EQ(i, n);
+        easykv::lsm::MemTableIterator it(memtable);
+        i = n / 2;
+        for (it.Seek(key(n / 2)); it.Valid(); it.Next()) {
+            ASSERT_EQ(it.key(), key(i));
+            ASSERT_EQ(it.value(), std::to_string(i));
+            ++i;
+        }
+        ASSERT_EQ(i, n);
+    }
+}
+
+TEST(MemTable, Reps) {
+    for (auto rep : kReps) {
+        auto memtable = std::make_shared<easykv::lsm::MemeTable>(rep, 16);
+        // out of order, every key written twice
+        for (int round = 0; round < 2; round++) {
+            for (int i = 0; i < 1000; i++) {
+                int k = i * 7 % 1000;
+                memtable->Put("key" + std::to_string(1000 + k), std::to_string(k + round), k + 1);
+            }
+        }
+        memtable->Upsert("key1500", 2001, [](bool found, std::string& value, easykv::lsm::ValueType& /* type */) {
+            ASSERT_EQ(found, true);
+            value += "!";
+        });
+        std::string value;
+        ASSERT_EQ(memtable->Get("key1500", value), true);
+        ASSERT_EQ(value, "501!");
+        ASSERT_EQ(memtable->Get("key1000", value), true);
+        ASSERT_EQ(value, "1");
+        ASSERT_EQ(memtable->Get("key2000", value), false);
+        ASSERT_EQ(memtable->largest_seq(), 2001);
+        std::string last;
+        ASSERT_EQ(memtable->LastKey(last), true);
+        ASSERT_EQ(last, "key1999");
+        // the keys at least, an art adds the inner nodes it allocated, far more than the values here
+        size_t key_size = 1000 * 7;
+        ASSERT_GT(memtable->binary_size(), key_size + (rep == MemTableRepType::kArt ? 16 * 1024 : 0));
+
+        // scanned before and after Freeze: sorted, one entry per key, the newest
+        for (int frozen = 0; frozen < 2; frozen++) {
+            if (frozen) {
+                memtable->Freeze();
+            }
+            easykv::lsm::MemTableIterator it(memtable);
+            int i = 0;
+            for (it.Seek("key1"); it.Valid(); it.Next()) {
+                ASSERT_EQ(it.key(), "key" + std::to_string(1000 + i));
+                ASSERT_EQ(it.value(), std::to_string(i + 1) + (i == 500 ? "!" : ""));
+                ++i;
+            }
+            ASSERT_EQ(i, 1000);
+            i = 0;
+            memtable->ForEach([&](std::string_view key, std::string_view /* value */, easykv::lsm::ValueType /* type */) {
+                EXPECT_EQ(key, "key" + std::to_string(1000 + i));
+                return ++i < 10;
+            });
+            ASSERT_EQ(i, 10);
+        }
+    }
+}
+
+TEST(MemTable, ArtConcurrent) {
+    auto memtable = std::make_shared<easykv::lsm::MemeTable>(MemTableRepType::kArt);
+    const int writers = 4;
+    const int n = 20000;
+    // keys that are prefixes of one another and share long runs, written while readers look them up
+    auto key = [](int i) {
+        return "tenant/" + std::to_string(i % 97) + "/object/" + std::to_string(i);
+    };
+    std::atomic_bool done{false};
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; w++) {
+        threads.emplace_back([&, w]() {
+            for (int i = w; i < n; i += writers) {
+                memtable->Put(key(i), std::to_string(i));
+            }
+        });
+    }
+    std::atomic_int mismatches{0};
+    for (int r = 0; r < 2; r++) {
+        threads.emplace_back([&]() {
+            std::string value;
+            while (!done) {
+                for (int i = 0; i < n; i += 101) {
+                    if (memtable->Get(key(i), value) && value != std::to_string(i)) {
+                        ++mismatches;
+                    }
+                }
+            }
+        });
+    }
+    for (int w = 0; w < writers; w++) {
+        threads[w].join();
+    }
+    done = true;
+    for (size_t t = writers; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    ASSERT_EQ(mismatches, 0);
+    ASSERT_EQ(memtable->size(), n);
+    std::vector<std::string> keys;
+    for (int i = 0; i < n; i++) {
+        std::string value;
+        ASSERT_EQ(memtable->Get(key(i), value), true);
+        ASSERT_EQ(value, std::to_string(i));
+        keys.push_back(key(i));
+    }
+    std::sort(keys.begin(), keys.end());
+    size_t i = 0;
+    memtable->ForEach([&](std::string_view k, std::string_view /* value */, easykv::lsm::ValueType /* type */) {
+        EXPECT_EQ(k, keys[i]);
+        ++i;
+        return true;
+    });
+    ASSERT_EQ(i, keys.size());
+    std::string last;
+    ASSERT_EQ(memtable->LastKey(last), true);
+    ASSERT_EQ(last, keys.back());
+}
@@ -0,0 +1,80 @@
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "easykv/db.hpp"
+#include "easykv/utils/rate_limiter.hpp"
+
+using easykv::common::RateLimiter;
+
+TEST(RateLimiter, Limit) {
+    RateLimiter limiter(1024 * 1024);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10; i++) {
+        limiter.Request(64 * 1024, RateLimiter::Priority::kLow);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    ASSERT_GE(elapsed, 500);
+    ASSERT_LT(elapsed, 2000);
+    ASSERT_EQ(limiter.total_bytes(RateLimiter::Priority::kLow), 640 * 1024);
+    ASSERT_EQ(limiter.total_bytes(RateLimiter::Priority::kHigh), 0);
+}
+
+TEST(RateLimiter, Priority) {
+    RateLimiter limiter(1024 * 1024);
+    std::atomic_bool low_done{false};
+    std::atomic_bool high_done_first{false};
+    std::thread low([&]() {
+        for (int i = 0; i < 32; i++) {
+            limiter.Request(16 * 1024, RateLimiter::Priority::kLow);
+        }
+        low_done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    for (int i = 0; i < 8; i++) {
+        limiter.Request(16 * 1024, RateLimiter::Priority::kHigh);
+    }
+    high_done_first = !low_done;
+    low.join();
+    ASSERT_EQ(high_done_first, true);
+}
+
+TEST(RateLimiter, AutoTune) {
+    RateLimiter limiter(8 * 1024 * 1024, true);
+    ASSERT_EQ(limiter.bytes_per_second(), 1024 * 1024);
+    limiter.Tune(1);
+    ASSERT_EQ(limiter.bytes_per_second(), 8 * 1024 * 1024);
+    limiter.Tune(0.5);
+    ASSERT_EQ(limiter.bytes_per_second(), 1024 * 1024 + 7 * 512 * 1024);
+    limiter.Tune(0);
+    ASSERT_EQ(limiter.bytes_per_second(), 1024 * 1024);
+    RateLimiter fixed(8 * 1024 * 1024);
+    fixed.Tune(0);
+    ASSERT_EQ(fixed.bytes_per_second(), 8 * 1024 * 1024);
+}
+
+TEST(RateLimiter, DB) {
+    std::filesystem::remove_all("rate_limited_db");
+    auto limiter = std::make_shared<RateLimiter>(64 * 1024 * 1024, true);
+    easykv::DBOptions options;
+    options.db_path = "rate_limited_db";
+    options.write_buffer_size = 64 * 1024;
+    options.rate_limiter = limiter;
+    {
+        easykv::DB db(options);
+        for (int i = 0; i < 1000; i++) {
+            db.Put("key" + std::to_string(i), std::string(512, 'v'));
+        }
+    }
+    // flushes took the high priority, the compactions behind them the low one
+    ASSERT_GT(limiter->total_bytes(RateLimiter::Priority::kHigh), 0);
+    ASSERT_GT(limiter->total_bytes(RateLimiter::Priority::kLow), 0);
+    easykv::DB db(options);
+    std::string value;
+    ASSERT_EQ(db.Get("key999", value), true);
+    ASSERT_EQ(value, std::string(512, 'v'));
+}
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "easykv/sharded_db.hpp"
+#include "easykv/write_batch.hpp"
+
+namespace {
+
+std::string Key(int i) {
+    auto key = std::to_string(i);
+    return std::string(6 - key.size(), '0') + key;
+}
+
+void CheckShardedDB(easykv::ShardedDBOptions options) {
+    std::filesystem::remove_all(options.path);
+    options.db_options.write_buffer_size = 64 * 1024; // several flushes per shard
+    const int n = 40000;
+    const std::string padding(32, 'v');
+    {
+        easykv::ShardedDB db(options);
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; t++) {
+            writers.emplace_back([&db, &padding, t]() {
+                for (int i = t; i < n; i += 4) {
+                    db.Put(Key(i), padding + Key(i));
+                }
+            });
+        }
+        for (auto& writer : writers) {
+            writer.join();
+        }
+        easykv::WriteBatch batch;
+        for (int i = 0; i < n; i += 3) {
+            batch.Delete(Key(i));
+        }
+        batch.Put(Key(0), "again");
+        db.Write(batch);
+        for (size_t i = 0; i < db.shard_num(); i++) {
+            auto it = db.shard(i).NewIterator();
+            it->SeekToFirst();
+            ASSERT_EQ(it->Valid(), true); // every shard took a part of the keys
+        }
+
+        std::vector<std::string> keys;
+        for (int i = 0; i < n; i += 7) {
+            keys.emplace_back(Key(i));
+        }
+        std::vector<std::string_view> key_views(keys.begin(), keys.end());
+        std::vector<std::string> values;
+        std::vector<bool> found;
+        db.MultiGet(key_views, values, found);
+        for (size_t j = 0; j < keys.size(); j++) {
+            int i = j * 7;
+            if (i == 0) {
+                ASSERT_EQ(values[j], "again");
+            } else if (i % 3 == 0) {
+                ASSERT_EQ(found[j], false);
+            } else {
+                ASSERT_EQ(found[j], true);
+                ASSERT_EQ(values[j], padding + Key(i));
+            }
+        }
+    }
+    // reopen, every shard recovers from its own directory
+    easykv::ShardedDB db(options);
+    auto it = db.NewIterator();
+    int expected = 0;
+    int cnt = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        while (expected != 0 && expected % 3 == 0) {
+            ++expected;
+        }
+        ASSERT_EQ(it->key(), Key(expected));
+        ASSERT_EQ(it->value(), expected == 0 ? std::string("again") : padding + Key(expected));
+        ++expected;
+        ++cnt;
+    }
+    ASSERT_EQ(cnt, n - (n + 2) / 3 + 1);
+    it->Seek(Key(n / 2));
+    ASSERT_EQ(it->Valid(), true);
+    ASSERT_GE(it->key(), Key(n / 2));
+    ASSERT_LE(it->key(), Key(n / 2 + 2));
+}
+
+}
+
+TEST(ShardedDB, Hash) {
+    easykv::ShardedDBOptions options;
+    options.path = "sharded_hash";
+    options.shard_num = 4;
+    options.pin_cpus = true;
+    CheckShardedDB(options);
+}
+
+TEST(ShardedDB, Range) {
+    easykv::ShardedDBOptions options;
+    options.path = "sharded_range";
+    options.partition = easykv::ShardedDBOptions::Partition::kRange;
+    options.split_keys = {Key(10000), Key(20000), Key(30000)};
+    CheckShardedDB(options);
+}
@@ -1,3 +1,4 @@
+#include <cstdio>
 #include <functional>
 #include <gtest/gtest.h>
 #include <iostream>
@@ -64,4 +65,51 @@ TEST(SkipList, Concurrent) {
         }
     });
     pool.ConcurrentRun(functions);
-}
\ No newline at end of file
+}
+
+TEST(SkipList, Append) {
+    easykv::lsm::ConcurrentSkipList skip_list;
+    const int n = 10000;
+    std::string last;
+    ASSERT_EQ(skip_list.LastKey(last), false);
+    cpputil::pool::ThreadPool pool(4);
+    std::vector<std::function<void()>> functions;
+    // time ordered keys take the tail path, the odd keys are put in the middle meanwhile
+    functions.emplace_back([n, &skip_list]() {
+        for (int i = 0; i < n; i += 2) {
+            char key[16];
+            snprintf(key, sizeof(key), "%08d", i);
+            skip_list.Put(key, key);
+        }
+    });
+    functions.emplace_back([n, &skip_list]() {
+        for (int i = n - 1; i > 0; i -= 2) {
+            char key[16];
+            snprintf(key, sizeof(key), "%08d", i);
+            skip_list.Put(key, key);
+        }
+    });
+    pool.ConcurrentRun(functions);
+    ASSERT_EQ(skip_list.size(), n);
+    int i = 0;
+    for (auto it = skip_list.begin(); it != skip_list.end(); ++it, ++i) {
+        char key[16];
+        snprintf(key, sizeof(key), "%08d", i);
+        ASSERT_EQ((*it).key, key);
+    }
+    ASSERT_EQ(i, n);
+    // the tail is found again after it was deleted
+    char key[16];
+    snprintf(key, sizeof(key), "%08d", n - 1);
+    skip_list.Delete(key);
+    snprintf(key, sizeof(key), "%08d", n - 2);
+    ASSERT_EQ(skip_list.LastKey(last), true);
+    ASSERT_EQ(last, key);
+    snprintf(key, sizeof(key), "%08d", n);
+    skip_list.Put(key, key);
+    ASSERT_EQ(skip_list.LastKey(last), true);
+    ASSERT_EQ(last, key);
+    std::string value;
+    ASSERT_EQ(skip_list.Get(key, value), true);
+    ASSERT_EQ(value, key);
+}
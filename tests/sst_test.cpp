@@ -0,0 +1,383 @@
+#include <algorithm>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "easykv/lsm/format.hpp"
+#include "easykv/lsm/learned_index.hpp"
+#include "easykv/lsm/prefix_index.hpp"
+#include "easykv/lsm/sst.hpp"
+
+TEST(SST, Properties) {
+    const int n = 1000;
+    std::vector<std::string> keys;
+    for (int i = 0; i < n; i++) {
+        keys.emplace_back(std::to_string(i));
+    }
+    std::sort(keys.begin(), keys.end());
+    std::vector<easykv::lsm::EntryView> entries;
+    size_t raw_size = 0;
+    for (int i = 0; i < n; i++) {
+        if (i % 10 == 0) {
+            entries.emplace_back(keys[i], std::string_view(), easykv::lsm::kTypeDeletion);
+        } else {
+            entries.emplace_back(keys[i], keys[i]);
+            raw_size += keys[i].size();
+        }
+        raw_size += keys[i].size();
+    }
+    {
+        easykv::lsm::SST sst(entries, 3001, 7, 42);
+        ASSERT_EQ(sst.properties().entry_count, n);
+    }
+    easykv::lsm::SST sst;
+    sst.SetId(3001);
+    ASSERT_EQ(sst.Load(), true);
+    auto& properties = sst.properties();
+    ASSERT_EQ(properties.smallest_key, keys.front());
+    ASSERT_EQ(properties.largest_key, keys.back());
+    ASSERT_EQ(sst.key(), keys.front());
+    ASSERT_EQ(sst.largest_key(), keys.back());
+    ASSERT_EQ(properties.entry_count, n);
+    ASSERT_EQ(properties.tombstone_count, n / 10);
+    ASSERT_EQ(properties.raw_key_size + properties.raw_value_size, raw_size);
+    ASSERT_LT(properties.data_size, sst.binary_size());
+    ASSERT_EQ(properties.smallest_seq, 7);
+    ASSERT_EQ(properties.largest_seq, 42);
+
+    std::string value;
+    ASSERT_EQ(sst.Get(keys[1], value), true);
+    ASSERT_EQ(value, keys[1]);
+    ASSERT_EQ((*sst.begin()).type, easykv::lsm::kTypeDeletion);
+}
+
+TEST(SST, ReadModes) {
+    const int n = 10000;
+    std::vector<std::string> keys;
+    for (int i = 0; i < n; i++) {
+        keys.emplace_back(std::to_string(i));
+    }
+    std::sort(keys.begin(), keys.end());
+    std::vector<easykv::lsm::EntryView> entries;
+    for (auto& key : keys) {
+        entries.emplace_back(key, key);
+    }
+    {
+        easykv::lsm::SST sst(entries, 3002);
+        ASSERT_GT(sst.data_block_size(), 1);
+    }
+    for (auto mode : {easykv::common::ReadMode::kMmap, easykv::common::ReadMode::kPRead,
+            easykv::common::ReadMode::kDirect, easykv::common::ReadMode::kIoUring}) {
+        easykv::lsm::TableOptions options;
+        options.read_mode = mode;
+        options.block_cache = std::make_shared<easykv::lsm::BlockCache>(1024 * 1024);
+        easykv::lsm::SST sst;
+        sst.SetId(3002);
+        sst.SetOptions(options);
+        ASSERT_EQ(sst.Load(), true);
+        for (int i = 0; i < n; i++) {
+            std::string value;
+            ASSERT_EQ(sst.Get(keys[i], value), true);
+            ASSERT_EQ(value, keys[i]);
+        }
+        std::string value;
+        ASSERT_EQ(sst.Get("a", value), false);
+        ASSERT_GT(options.block_cache->hit_cnt(), 0);
+        ASSERT_LE(options.block_cache->usage(), options.block_cache->capacity());
+
+        size_t cnt = 0;
+        for (auto it = sst.begin(); !!it; ++it) {
+            ASSERT_EQ((*it).key, keys[cnt]);
+            ++cnt;
+        }
+        ASSERT_EQ(cnt, n);
+
+        std::vector<std::string_view> batch;
+        for (int i = 0; i < n; i += 97) {
+            batch.emplace_back(keys[i]);
+        }
+        batch.emplace_back("a");
+        std::vector<std::string> values(batch.size());
+        std::vector<bool> found(batch.size(), false);
+        ASSERT_EQ(sst.MultiGet(batch, values, found), batch.size() - 1);
+        for (size_t i = 0; i + 1 < batch.size(); i++) {
+            ASSERT_EQ(found[i], true);
+            ASSERT_EQ(values[i], batch[i]);
+        }
+        ASSERT_EQ(found.back(), false);
+    }
+    unlink("3002.sst");
+}
+
+TEST(SST, ReadBlockFailure) {
+    const int n = 10000;
+    std::vector<std::string> keys;
+    for (int i = 0; i < n; i++) {
+        keys.emplace_back(std::to_string(i));
+    }
+    std::sort(keys.begin(), keys.end());
+    std::vector<easykv::lsm::EntryView> entries;
+    for (auto& key : keys) {
+        entries.emplace_back(key, key);
+    }
+    {
+        easykv::lsm::SST sst(entries, 3010);
+    }
+    easykv::lsm::TableOptions options;
+    options.read_mode = easykv::common::ReadMode::kPRead;
+    easykv::lsm::SST sst;
+    sst.SetId(3010);
+    sst.SetOptions(options);
+    ASSERT_EQ(sst.Load(), true);
+    struct stat stat_buf;
+    ASSERT_EQ(stat("3010.sst", &stat_buf), 0);
+    // index and footer are in memory already, the second half of the data blocks is gone
+    ASSERT_EQ(truncate("3010.sst", stat_buf.st_size / 2), 0);
+
+    size_t cnt = 0;
+    auto it = sst.begin();
+    for (; !!it; ++it) {
+        ++cnt;
+    }
+    ASSERT_LT(cnt, n);
+    ASSERT_EQ(it.status_ok(), false); // cut short, not the end of the table
+    auto whole = sst.begin();
+    ASSERT_EQ(whole.status_ok(), true);
+    unlink("3010.sst");
+}
+
+TEST(SST, DirectWrite) {
+    const int n = 100000;
+    std::vector<std::string> keys;
+    for (int i = 0; i < n; i++) {
+        keys.emplace_back(std::to_string(i));
+    }
+    std::sort(keys.begin(), keys.end());
+    easykv::lsm::TableOptions options;
+    options.use_direct_writes = true;
+    options.bytes_per_sync = 64 * 1024;
+    size_t file_size = 0;
+    {
+        easykv::lsm::TableBuilder builder(easykv::lsm::SST::FileName(3003), options);
+        builder.SetSeqRange(1, n);
+        ASSERT_EQ(builder.Open(n * 64), true);
+        for (auto& key : keys) {
+            builder.Add(key, key);
+        }
+        ASSERT_EQ(builder.Finish(), true);
+        file_size = builder.file_size();
+        ASSERT_EQ(builder.properties().entry_count, n);
+    }
+    struct stat stat_buf;
+    ASSERT_EQ(stat(easykv::lsm::SST::FileName(3003).c_str(), &stat_buf), 0);
+    ASSERT_EQ(stat_buf.st_size, file_size); // padding of the direct tail is cut off
+
+    easykv::lsm::SST sst;
+    sst.SetId(3003);
+    ASSERT_EQ(sst.Load(), true);
+    ASSERT_EQ(sst.properties().largest_seq, n);
+    for (int i = 0; i < n; i += 7) {
+        std::string value;
+        ASSERT_EQ(sst.Get(keys[i], value), true);
+        ASSERT_EQ(value, keys[i]);
+    }
+    unlink("3003.sst");
+}
+
+TEST(SST, PinnedGet) {
+    const int n = 1000;
+    std::vector<std::string> keys;
+    for (int i = 0; i < n; i++) {
+        keys.emplace_back(std::to_string(i));
+    }
+    std::sort(keys.begin(), keys.end());
+    std::vector<easykv::lsm::EntryView> entries;
+    for (auto& key : keys) {
+        entries.emplace_back(key, key);
+    }
+    {
+        easykv::lsm::SST sst(entries, 3004);
+    }
+    for (auto mode : {easykv::common::ReadMode::kMmap, easykv::common::ReadMode::kPRead}) {
+        std::vector<easykv::lsm::PinnableValue> values(n);
+        {
+            easykv::lsm::TableOptions options;
+            options.read_mode = mode;
+            easykv::lsm::SST sst;
+            sst.SetId(3004);
+            sst.SetOptions(options);
+            ASSERT_EQ(sst.Load(), true);
+            for (int i = 0; i < n; i++) {
+                easykv::lsm::ValueType type;
+                ASSERT_EQ(sst.Get(keys[i], values[i], type), true);
+                ASSERT_EQ(values[i].pinned(), true);
+            }
+        }
+        // the sst is gone, the blocks live on in the values
+        for (int i = 0; i < n; i++) {
+            ASSERT_EQ(values[i].view(), keys[i]);
+        }
+        easykv::lsm::PinnableValue moved(std::move(values[0]));
+        ASSERT_EQ(moved.view(), keys[0]);
+        ASSERT_EQ(values[0].size(), 0);
+    }
+    unlink("3004.sst");
+}
+
+TEST(SST, PrefixIndex) {
+    // keys sharing long runs, keys that are prefixes of others, zero bytes where the padding goes
+    std::vector<std::string> keys;
+    for (int i = 0; i < 3000; i++) {
+        auto key = "tenant/0042/" + std::to_string(i * 7919 % 10007);
+        keys.push_back(i % 3 == 0 ? key : key.substr(0, 12 + i % 5));
+        if (i % 11 == 0) {
+            keys.back().push_back('\0');
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    for (size_t n : {size_t(0), size_t(1), size_t(2), size_t(15), size_t(16), size_t(17), keys.size()}) {
+        std::vector<std::string_view> views(keys.begin(), keys.begin() + n);
+        easykv::lsm::PrefixIndex index;
+        index.Build(views);
+        ASSERT_EQ(index.size(), n);
+        std::vector<std::string> targets(keys.begin(), keys.end());
+        for (auto& key : keys) {
+            targets.push_back(key + '\0');
+            targets.push_back(key.substr(0, key.size() - 1));
+        }
+        for (std::string target : {"", "a", "tenant/0042", "tenant/0042/", "tenant/0042/\xff", "u"}) {
+            targets.push_back(target);
+        }
+        for (auto& target : targets) {
+            ASSERT_EQ(index.LowerBound(target), std::lower_bound(views.begin(), views.end(), target) - views.begin());
+            ASSERT_EQ(index.UpperBound(target), std::upper_bound(views.begin(), views.end(), target) - views.begin());
+        }
+    }
+}
+
+TEST(SST, LearnedIndex) {
+    auto build = [](const std::vector<std::string>& keys, int id, size_t max_error) {
+        std::vector<easykv::lsm::EntryView> entries;
+        for (auto& key : keys) {
+            entries.emplace_back(key, key);
+        }
+        easykv::lsm::TableOptions options;
+        options.learned_index_max_error = max_error;
+        easykv::lsm::SST sst(entries, id, 0, 0, options);
+        return !sst.learned_index().empty();
+    };
+    // evenly spread numeric keys fit, every key and every gap between keys is still found right
+    std::vector<std::string> keys;
+    for (int i = 0; i < 20000; i++) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "user%012d", i * 37);
+        keys.emplace_back(buf);
+    }
+    ASSERT_EQ(build(keys, 3003, 16), true);
+    easykv::lsm::SST sst;
+    sst.SetId(3003);
+    ASSERT_EQ(sst.Load(), true);
+    ASSERT_EQ(sst.learned_index().empty(), false);
+    for (int i = 0; i < 20000; i++) {
+        std::string value;
+        ASSERT_EQ(sst.Get(keys[i], value), true);
+        ASSERT_EQ(value, keys[i]);
+    }
+    // the model holds every key of the file, none of them needed the full search
+    ASSERT_EQ(sst.learned_hit_cnt(), 20000);
+    ASSERT_EQ(sst.learned_fallback_cnt(), 0);
+    for (int i = 0; i < 20000; i++) {
+        std::string value;
+        ASSERT_EQ(sst.Get(keys[i] + "0", value), false);
+    }
+    std::string value;
+    for (auto key : {"", "a", "user", "user999999999999", "v"}) {
+        ASSERT_EQ(sst.Get(key, value), false);
+    }
+    size_t cnt = 0;
+    for (auto it = sst.begin(); !!it; ++it) {
+        ++cnt;
+    }
+    ASSERT_EQ(cnt, keys.size());
+
+    // a skewed run needs more than the allowed error, the file falls back to the plain search
+    keys.clear();
+    for (int i = 0; i < 60; i++) {
+        keys.emplace_back(std::string(i, 'z'));
+    }
+    for (int i = 0; i < 1000; i++) {
+        keys.emplace_back("a" + std::to_string(i));
+    }
+    std::sort(keys.begin(), keys.end());
+    ASSERT_EQ(build(keys, 3004, 2), false);
+    easykv::lsm::SST skewed;
+    skewed.SetId(3004);
+    ASSERT_EQ(skewed.Load(), true);
+    for (auto& key : keys) {
+        ASSERT_EQ(skewed.Get(key, value), true);
+    }
+    unlink("3003.sst");
+    unlink("3004.sst");
+
+    // no slack left for rounding at 1, and a block count past the end of the model is malformed
+    ASSERT_EQ(build(keys, 3005, 1), false);
+    easykv::lsm::LearnedIndexBuilder builder;
+    builder.StartBlock();
+    for (int i = 0; i < 100; i++) {
+        builder.Add("key" + std::to_string(1000 + i));
+    }
+    auto model = builder.Finish(4);
+    easykv::lsm::LearnedIndex index;
+    ASSERT_EQ(index.Load(model, "key1000"), true);
+    uint64_t segment_cnt;
+    memcpy(&segment_cnt, model.data() + 3 * sizeof(uint64_t), sizeof(uint64_t));
+    uint64_t block_cnt = uint64_t(1) << 60;
+    memcpy(model.data() + (4 + 3 * segment_cnt) * sizeof(uint64_t), &block_cnt, sizeof(uint64_t));
+    ASSERT_EQ(index.Load(model, "key1000"), false);
+    unlink("3005.sst");
+}
+
+TEST(SST, DataBlockHashIndex) {
+    std::vector<std::string> keys;
+    for (int i = 0; i < 5000; i++) {
+        keys.emplace_back("key" + std::to_string(i));
+    }
+    std::sort(keys.begin(), keys.end());
+    std::vector<easykv::lsm::EntryView> entries;
+    for (auto& key : keys) {
+        entries.emplace_back(key, key);
+    }
+    easykv::lsm::TableOptions options;
+    options.data_block_hash_ratio = 0.75;
+    easykv::lsm::SST hashed(entries, 3005, 0, 0, options);
+    easykv::lsm::SST plain(entries, 3006);
+    ASSERT_EQ(hashed.data_block_size(), plain.data_block_size());
+    for (auto& key : keys) {
+        std::string value;
+        ASSERT_EQ(hashed.Get(key, value), true);
+        ASSERT_EQ(value, key);
+        ASSERT_EQ(hashed.Get(key + "x", value), false);
+    }
+    // the hash index follows the entries, a scan parses the same entries as without it
+    auto it = hashed.begin();
+    for (auto& key : keys) {
+        ASSERT_EQ(!!it, true);
+        ASSERT_EQ((*it).key, key);
+        ++it;
+    }
+    ASSERT_EQ(!!it, false);
+    auto block = hashed.ReadBlock(0);
+    ASSERT_EQ(block->index.data_index().size(), plain.ReadBlock(0)->index.data_index().size());
+    ASSERT_EQ(block->index.LowerBound(keys[1]), 1);
+    ASSERT_GT(block->index.hash_bucket_cnt(), block->index.data_index().size());
+    ASSERT_EQ(plain.ReadBlock(0)->index.hash_bucket_cnt(), 0);
+    unlink("3005.sst");
+    unlink("3006.sst");
+}
@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "easykv/lsm/sst.hpp"
+#include "easykv/lsm/table_cache.hpp"
+
+TEST(TableCache, LazyOpen) {
+    const int n = 1000;
+    const size_t file_num = 8;
+    std::vector<std::shared_ptr<easykv::lsm::FileMetaData> > metas;
+    {
+        easykv::lsm::TableCache writer(file_num);
+        for (size_t id = 2001; id < 2001 + file_num; id++) {
+            std::vector<std::string> keys;
+            for (int i = 0; i < n; i++) {
+                keys.emplace_back(std::to_string(id * n + i));
+            }
+            std::sort(keys.begin(), keys.end());
+            std::vector<easykv::lsm::EntryView> entries;
+            for (auto& key : keys) {
+                entries.emplace_back(key, key);
+            }
+            metas.emplace_back(writer.Insert(std::make_shared<easykv::lsm::SST>(entries, id)));
+        }
+    }
+    ASSERT_EQ(metas.front()->smallest(), std::to_string(2001 * n));
+    ASSERT_EQ(metas.front()->largest(), std::to_string(2001 * n + n - 1));
+
+    easykv::lsm::TableCache table_cache(2);
+    ASSERT_EQ(table_cache.size(), 0);
+    for (int round = 0; round < 2; round++) {
+        for (auto& meta : metas) {
+            auto sst_ptr = table_cache.Get(*meta);
+            ASSERT_NE(sst_ptr, nullptr);
+            std::string value;
+            ASSERT_EQ(sst_ptr->Get(meta->smallest(), value), true);
+            ASSERT_EQ(value, meta->smallest());
+            ASSERT_LE(table_cache.size(), 2);
+        }
+    }
+    ASSERT_EQ(table_cache.open_cnt(), 2 * file_num);
+
+    auto pinned = table_cache.Get(*metas.back());
+    ASSERT_EQ(table_cache.open_cnt(), 2 * file_num);
+    ASSERT_EQ(table_cache.Get(*metas.front()) != nullptr, true);
+    ASSERT_EQ(table_cache.Get(*metas[1]) != nullptr, true);
+    std::string value;
+    ASSERT_EQ(pinned->Get(metas.back()->largest(), value), true); // evicted but still pinned
+}